@@ -0,0 +1,69 @@
+#!/bin/bash
+# Compares the native path (kalec + cc) with the bytecode path (kalec -emit-bytecode +
+# tigervm) on every program in testcases/.
+#
+# usage: bench/bytecode.sh [build-dir]
+#   RUNS     runs per program, default 5
+#   TIMEOUT  seconds before a run is given up, default 10
+#   CC       linker driver for the native path, default cc
+
+ROOT=$(cd "$(dirname "$0")/.." && pwd)
+BUILD=${1:-$ROOT/build}
+RUNS=${RUNS:-5}
+TIMEOUT=${TIMEOUT:-10}
+CC=${CC:-cc}
+KALEC=$BUILD/kalec
+TIGERVM=$BUILD/tigervm
+RUNTIME=$BUILD/libruntime.a
+
+for tool in "$KALEC" "$TIGERVM" "$RUNTIME"; do
+  if [ ! -e "$tool" ]; then
+    echo "missing $tool, build the project first" >&2
+    exit 1
+  fi
+done
+
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+now() { date +%s%N; }
+
+# prints the mean wall time of a command in ms, or "timeout"/"error".
+measure() {
+  local total=0 start status
+  for ((i = 0; i < RUNS; i++)); do
+    start=$(now)
+    timeout "$TIMEOUT" "$@" </dev/null >/dev/null 2>&1
+    status=$?
+    [ $status -eq 124 ] && { echo timeout; return; }
+    [ $status -ge 128 ] && { echo error; return; }
+    total=$((total + $(now) - start))
+  done
+  awk -v t=$total -v n=$RUNS 'BEGIN { printf "%.2f", t / n / 1e6 }'
+}
+
+# prints the wall time of a single build step in ms, or "error".
+build() {
+  local start=$(now)
+  "$@" >/dev/null 2>&1 || { echo error; return; }
+  awk -v t=$(($(now) - start)) 'BEGIN { printf "%.2f", t / 1e6 }'
+}
+
+native_build() {
+  "$KALEC" -O2 -o "$WORK/$1.o" "$2" && "$CC" -o "$WORK/$1" "$WORK/$1.o" "$RUNTIME"
+}
+
+printf "%-16s %12s %12s %12s %12s\n" program "native build" "native run" "tbc build" "vm run"
+for source in "$ROOT"/testcases/*.tig; do
+  name=$(basename "$source" .tig)
+
+  native_build_ms=$(build native_build "$name" "$source")
+  native_run_ms=-
+  [ "$native_build_ms" != error ] && native_run_ms=$(measure "$WORK/$name")
+
+  tbc_build_ms=$(build "$KALEC" -emit-bytecode -o "$WORK/$name.tbc" "$source")
+  vm_run_ms=-
+  [ "$tbc_build_ms" != error ] && vm_run_ms=$(measure "$TIGERVM" "$WORK/$name.tbc")
+
+  printf "%-16s %12s %12s %12s %12s\n" "$name" "$native_build_ms" "$native_run_ms" "$tbc_build_ms" "$vm_run_ms"
+done
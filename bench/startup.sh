@@ -0,0 +1,46 @@
+#!/bin/bash
+# Measures how long kalec takes to get to its first diagnostic, on programs that fail to
+# parse or to type check, against a program it compiles. Runs bypass kalecd unless
+# DAEMON is set.
+#
+# usage: bench/startup.sh [build-dir]
+#   RUNS    runs per case, default 20
+#   DAEMON  forward to a running kalecd as kalec does by default
+
+ROOT=$(cd "$(dirname "$0")/.." && pwd)
+BUILD=${1:-$ROOT/build}
+RUNS=${RUNS:-20}
+KALEC=$BUILD/kalec
+
+if [ ! -e "$KALEC" ]; then
+  echo "missing $KALEC, build the project first" >&2
+  exit 1
+fi
+[ -z "$DAEMON" ] && export KALEC_NO_DAEMON=1
+
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+printf 'let var x := in x end\n' >"$WORK/syntax.tig"
+printf 'let var x : int := "one" in x end\n' >"$WORK/type.tig"
+printf '0\n' >"$WORK/empty.tig"
+
+now() { date +%s%N; }
+
+# prints the median wall time of a command in ms.
+measure() {
+  local start
+  for ((i = 0; i < RUNS; i++)); do
+    start=$(now)
+    "$@" </dev/null >/dev/null 2>&1
+    echo $(($(now) - start))
+  done | sort -n | awk '{ t[NR] = $1 } END { printf "%.2f", t[int((NR + 1) / 2)] / 1e6 }'
+}
+
+size=$(wc -c <"$KALEC")
+printf "kalec: %d bytes\n" "$size"
+printf "%-24s %12s\n" case "median ms"
+printf "%-24s %12s\n" "syntax error" "$(measure "$KALEC" -o "$WORK/out.o" "$WORK/syntax.tig")"
+printf "%-24s %12s\n" "type error" "$(measure "$KALEC" -o "$WORK/out.o" "$WORK/type.tig")"
+printf "%-24s %12s\n" "empty program -O0" "$(measure "$KALEC" -O0 -o "$WORK/out.o" "$WORK/empty.tig")"
+printf "%-24s %12s\n" "empty program -O2" "$(measure "$KALEC" -O2 -o "$WORK/out.o" "$WORK/empty.tig")"
@@ -0,0 +1,11 @@
+# Writes the bytes of INPUT to OUTPUT as a C++ array named NAME, with its size in NAMESize.
+#
+# usage: cmake -DINPUT=file -DOUTPUT=file.cpp -DNAME=symbol -P embed.cmake
+file(READ ${INPUT} content HEX)
+string(LENGTH "${content}" length)
+math(EXPR size "${length} / 2")
+string(REGEX REPLACE "([0-9a-f][0-9a-f])" "0x\\1," bytes "${content}")
+file(WRITE ${OUTPUT}
+  "#include <cstddef>\n\n"
+  "alignas(16) extern const unsigned char ${NAME}[] = {${bytes}};\n"
+  "extern const std::size_t ${NAME}Size = ${size};\n")
@@ -13,6 +13,8 @@ namespace yy
   public:
     location loc;
 
+    TigerLexer(std::istream *in = nullptr) : yyFlexLexer(in) {}
+
     virtual yy::TigerParser::symbol_type _yylex();
     std::ostringstream str_o;
 
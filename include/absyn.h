@@ -1,7 +1,9 @@
 #pragma once
+#include <cstdint>
 #include <iostream>
-#include <memory>
-#include <vector>
+#include <string>
+#include "arena.h"
+#include "symbol.h"
 #include "location.hh"
 
 namespace cg
@@ -10,13 +12,28 @@ namespace cg
   class AbstractCodeGenerator;
 };
 
+namespace ty
+{
+  struct Type;
+};
+
+namespace sm
+{
+  struct Variable;
+  struct Function;
+};
+
 namespace absyn
 {
+  // Nodes are allocated from the mem::Arena of a compilation and refer to their children
+  // through plain pointers, child lists are contiguous arrays in the same arena.
   template <typename T>
-  using ptr = std::shared_ptr<T>;
+  using ptr = T *;
 
   template <typename T>
-  using ptrs = std::vector<std::shared_ptr<T>>;
+  using ptrs = mem::Slice<T *>;
+
+  using Arena = mem::Arena;
 
   using position = yy::position;
 
@@ -25,10 +42,12 @@ namespace absyn
 
   struct ID
   {
-    std::string id;
+    sym::Symbol id;
     position pos;
 
-    ID(std::string id, position pos);
+    ID(sym::Symbol id, position pos);
+    ID(const ID &) = delete;
+    ID &operator=(const ID &) = delete;
 
     virtual void accept(Visitor &visitor);
   };
@@ -38,11 +57,14 @@ namespace absyn
     ptr<ID> name;
     ptr<Exp> value;
     position pos;
+    int index = -1;
 
     Record(
         ptr<ID> name,
         ptr<Exp> value,
         position pos);
+    Record(const Record &) = delete;
+    Record &operator=(const Record &) = delete;
 
     virtual void accept(Visitor &visitor);
   };
@@ -50,8 +72,11 @@ namespace absyn
   struct Var
   {
     position pos;
+    ty::Type *type = nullptr;
 
     Var(position pos);
+    Var(const Var &) = delete;
+    Var &operator=(const Var &) = delete;
 
     friend Visitor;
     virtual void accept(Visitor &visitor) = 0;
@@ -61,6 +86,7 @@ namespace absyn
   struct SimpleVar : Var
   {
     ptr<ID> name;
+    sm::Variable *variable = nullptr;
 
     SimpleVar(ptr<ID> name, position pos);
 
@@ -72,6 +98,10 @@ namespace absyn
   {
     ptr<Var> var;
     ptr<ID> field;
+    int index = -1;
+    // under reference counting, a read of a field of the record a record being built
+    // reuses, which takes over the reference when the record is unique.
+    bool move = false;
 
     FieldVar(ptr<Var> var, ptr<ID> field, position pos);
 
@@ -95,12 +125,16 @@ namespace absyn
     ptr<ID> name;
     ptr<ID> type_id;
     position pos;
+    // for a parameter, its value may outlive the call, found by sm::Regions.
     bool escape = false;
+    sm::Variable *variable = nullptr;
 
     Field(
         ptr<ID> name,
         ptr<ID> type_id,
         position pos);
+    Field(const Field &) = delete;
+    Field &operator=(const Field &) = delete;
 
     virtual void accept(Visitor &visitor);
   };
@@ -110,6 +144,8 @@ namespace absyn
     position pos;
 
     Type(position pos);
+    Type(const Type &) = delete;
+    Type &operator=(const Type &) = delete;
 
     virtual void accept(Visitor &visitor) = 0;
   };
@@ -146,6 +182,8 @@ namespace absyn
     position pos;
 
     Dec(position pos);
+    Dec(const Dec &) = delete;
+    Dec &operator=(const Dec &) = delete;
 
     virtual void accept(Visitor &visitor) = 0;
     virtual cg::TyValue accept(cg::AbstractCodeGenerator &generator) = 0;
@@ -170,7 +208,9 @@ namespace absyn
     ptr<ID> var;
     ptr<ID> type_id;
     ptr<Exp> exp;
+    // the value of the variable may outlive its let, found by sm::Regions.
     bool escape = false;
+    sm::Variable *variable = nullptr;
 
     VarDec(
         ptr<ID> var,
@@ -188,6 +228,7 @@ namespace absyn
     ptrs<Field> parameters;
     ptr<ID> return_type;
     ptr<Exp> body;
+    sm::Function *function = nullptr;
 
     FunctionDec(
         ptr<ID> funcname,
@@ -221,8 +262,11 @@ namespace absyn
   struct Exp
   {
     position pos;
+    ty::Type *type = nullptr;
 
     Exp(position pos);
+    Exp(const Exp &) = delete;
+    Exp &operator=(const Exp &) = delete;
 
     friend Visitor;
     virtual void accept(Visitor &visitor) = 0;
@@ -260,6 +304,8 @@ namespace absyn
   struct VarExp : Exp
   {
     ptr<Var> var;
+    // under reference counting, the last use of a variable, which hands its reference on.
+    bool move = false;
 
     VarExp(ptr<Var> var, position pos);
 
@@ -295,6 +341,7 @@ namespace absyn
   {
     ptr<ID> func;
     ptrs<Exp> args;
+    sm::Function *function = nullptr;
 
     Call(
         ptr<ID> func,
@@ -325,6 +372,14 @@ namespace absyn
   {
     ptr<ID> type_id;
     ptrs<Record> records;
+    // allocated in the region of the let declaring the variable it initializes.
+    bool regional = false;
+    // allocated in the frame of the function, for a variable that only holds integers.
+    bool stack = false;
+    // under reference counting, a variable whose record dies as this one is built and
+    // gives it its memory, and the fields of it moved into this one, by index.
+    sm::Variable *reuse = nullptr;
+    uint64_t moved = 0;
 
     RecordExp(
         ptr<ID> type_id,
@@ -340,6 +395,12 @@ namespace absyn
     ptr<ID> type_id;
     ptr<Exp> capacity;
     ptr<Exp> element;
+    // allocated in the region of the let declaring the variable it initializes.
+    bool regional = false;
+    // allocated in the frame of the function with a length known at compile time, for a
+    // variable that only holds integers.
+    bool stack = false;
+    int64_t length = 0;
 
     Array(
         ptr<ID> type_id,
@@ -388,6 +449,7 @@ namespace absyn
     ptr<Exp> to;
     ptr<Exp> body;
     bool escape = false;
+    sm::Variable *variable = nullptr;
 
     For(
         ptr<ID> var,
@@ -412,6 +474,8 @@ namespace absyn
   {
     ptrs<Dec> decs;
     ptr<Exp> body;
+    // some of its variables are initialized with regional allocations, freed when it ends.
+    bool region = false;
 
     Let(
         ptrs<Dec> decs,
@@ -0,0 +1,84 @@
+#pragma once
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace mem
+{
+  // A contiguous, non-owning run of elements living in an Arena.
+  template <typename T>
+  class Slice
+  {
+  public:
+    Slice() = default;
+    Slice(T *data, size_t size) : data_(data), size_(size) {}
+
+    T *begin() const { return data_; }
+    T *end() const { return data_ + size_; }
+    size_t size() const { return size_; }
+    bool empty() const { return size_ == 0; }
+    T &operator[](size_t index) const { return data_[index]; }
+    T &front() const { return data_[0]; }
+    T &back() const { return data_[size_ - 1]; }
+
+  private:
+    T *data_ = nullptr;
+    size_t size_ = 0;
+  };
+
+  // Bump allocator for objects that share one lifetime, such as the nodes of a parsed
+  // program. Nothing is freed on its own: destructors of non-trivial objects run and all
+  // chunks are released together when the arena is destroyed.
+  class Arena
+  {
+  public:
+    Arena(size_t chunkSize = 64 * 1024);
+    ~Arena();
+
+    Arena(const Arena &) = delete;
+    Arena &operator=(const Arena &) = delete;
+
+    void *allocate(size_t size, size_t align);
+
+    template <typename T, typename... Args>
+    T *make(Args &&...args)
+    {
+      auto object = new (allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+      if constexpr (!std::is_trivially_destructible_v<T>)
+        destructors.push_back({[](void *p)
+                               { static_cast<T *>(p)->~T(); },
+                               object});
+      return object;
+    }
+
+    template <typename T>
+    Slice<T> slice(const std::vector<T> &elements)
+    {
+      static_assert(std::is_trivially_copyable_v<T>, "slices hold trivially copyable elements");
+      if (elements.empty())
+        return Slice<T>();
+      auto data = static_cast<T *>(allocate(sizeof(T) * elements.size(), alignof(T)));
+      std::uninitialized_copy(elements.begin(), elements.end(), data);
+      return Slice<T>(data, elements.size());
+    }
+
+    size_t bytesAllocated() const;
+
+  private:
+    struct Destructor
+    {
+      void (*destroy)(void *);
+      void *object;
+    };
+
+    size_t chunkSize;
+    std::vector<std::unique_ptr<char[]>> chunks;
+    char *cursor = nullptr;
+    char *limit = nullptr;
+    size_t allocated = 0;
+    std::vector<Destructor> destructors;
+  };
+}
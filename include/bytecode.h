@@ -0,0 +1,87 @@
+#pragma once
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+#include "absyn.h"
+#include "fold.h"
+#include "semant.h"
+#include "tbc.h"
+
+namespace bc
+{
+  // Lowers a program annotated by sm::Checker to a .tbc image.
+  class Compiler : public absyn::Visitor
+  {
+  public:
+    Compiler(const sm::Checker &checker);
+
+    std::vector<char> compile(absyn::Exp &exp);
+
+    void visit(absyn::Nil &n) override;
+    void visit(absyn::Int &i) override;
+    void visit(absyn::String &s) override;
+    void visit(absyn::VarExp &var) override;
+    void visit(absyn::Assign &assign) override;
+    void visit(absyn::Seq &seq) override;
+    void visit(absyn::Call &call) override;
+    void visit(absyn::BinOp &bin) override;
+    void visit(absyn::RecordExp &record) override;
+    void visit(absyn::Array &array) override;
+    void visit(absyn::If &iff) override;
+    void visit(absyn::While &whil) override;
+    void visit(absyn::For &forr) override;
+    void visit(absyn::Break &brk) override;
+    void visit(absyn::Let &let) override;
+    void visit(absyn::SimpleVar &var) override;
+    void visit(absyn::FieldVar &field) override;
+    void visit(absyn::SubscriptVar &subscript) override;
+    void visit(absyn::ID &id) override;
+    void visit(absyn::Record &record) override;
+    void visit(absyn::Field &field) override;
+    void visit(absyn::NamedType &named) override;
+    void visit(absyn::ArrayType &arrayType) override;
+    void visit(absyn::RecordType &recordType) override;
+    void visit(absyn::TypeDec &typeDec) override;
+    void visit(absyn::VarDec &varDec) override;
+    void visit(absyn::FunctionDec &funcDec) override;
+
+  private:
+    struct Frame
+    {
+      const sm::Function *function;
+      std::map<const sm::Variable *, uint32_t> registers;
+      uint32_t next = 0;
+      uint32_t size = 0;
+      std::vector<std::vector<size_t>> breaks;
+    };
+
+    const sm::Checker &checker;
+    std::vector<uint32_t> code;
+    std::string strings;
+    std::map<std::string, uint32_t> stringIndices;
+    std::vector<FunctionInfo> functions;
+    std::vector<absyn::FunctionDec *> pending;
+    Frame *frame = nullptr;
+    int64_t target = -1;
+
+    void compileFunction(const sm::Function *function, absyn::Exp &body);
+    void emit(Opcode op, std::initializer_list<uint32_t> operands = {});
+    size_t emitJump(Opcode op, std::initializer_list<uint32_t> operands = {});
+    void patch(size_t jump);
+    void patch(const std::vector<size_t> &jumps);
+    uint32_t allocate(uint32_t count = 1);
+    uint32_t destination();
+    uint32_t stringIndex(const std::string &value);
+    bool emitConstant(const sm::Constant &value);
+    uint32_t localRegister(const absyn::Exp &exp) const;
+    uint32_t pointerRegister(const sm::Variable *variable) const;
+    void emitInto(absyn::Exp &exp, int64_t reg);
+    void emitInto(absyn::Var &var, int64_t reg);
+    uint32_t operand(absyn::Exp &exp);
+    uint32_t operandBefore(absyn::Exp &exp, const absyn::Exp &later);
+    void branchIfFalse(absyn::Exp &condition, std::vector<size_t> &jumps);
+  };
+
+  void write(const std::vector<char> &image, const std::string &filename);
+}
@@ -0,0 +1,46 @@
+#pragma once
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace cache
+{
+  struct Stats
+  {
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t evictions = 0;
+    uint64_t entries = 0;
+    uint64_t bytes = 0;
+  };
+
+  // Hex digest of the source and everything else that decides what the compiler
+  // produces for it.
+  std::string key(const std::string &source, const std::vector<std::string> &configuration);
+
+  // On-disk store of compiler outputs, addressed by key. Several compilers may share a
+  // directory: entries are published by renaming, and eviction and statistics are
+  // serialized by a lock file. The modification time of an entry is its last use, and the
+  // least recently used entries are evicted once the store grows past its capacity. A store
+  // may be shared by threads.
+  class Store
+  {
+  public:
+    Store(std::string directory, uint64_t capacity);
+
+    // Places the cached output for key at output, as a hard link when possible.
+    bool fetch(const std::string &key, const std::string &output);
+    void insert(const std::string &key, const std::string &output);
+    Stats stats();
+
+  private:
+    std::string directory;
+    uint64_t capacity;
+    std::mutex guard;
+
+    std::string entryPath(const std::string &key) const;
+    void record(uint64_t hits, uint64_t misses, uint64_t evictions);
+    uint64_t evict();
+  };
+}
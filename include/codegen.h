@@ -1,49 +1,66 @@
 #pragma once
-#include <memory>
 #include <map>
-#include <functional>
+#include <memory>
+#include <set>
 #include <variant>
+#include <optional>
+#include <llvm/ADT/SmallString.h>
 #include <llvm/IR/Value.h>
 #include <llvm/IR/IRBuilder.h>
 #include <llvm/IR/LLVMContext.h>
 #include <llvm/IR/Module.h>
-#include <llvm/IR/PassManager.h>
-#include <llvm/IR/LegacyPassManager.h>
 #include <llvm/IR/Function.h>
+#include <llvm/Target/TargetMachine.h>
 #include "absyn.h"
+#include "cache.h"
 #include "types.h"
-#include "table.h"
+#include "semant.h"
+#include "fold.h"
 
 namespace cg
 {
-  struct TyValue
+  enum class OptLevel
   {
-    llvm::Value *value;
-    std::shared_ptr<ty::Type> type;
-
-    TyValue(std::shared_ptr<ty::Type> type = std::make_shared<ty::Undefined>(), llvm::Value *value = nullptr);
+    O0,
+    O1,
+    O2,
+    O3,
+    Os
   };
 
-  struct Enventry
+  struct CompileOptions
   {
-    virtual ~Enventry() = default;
+    OptLevel optLevel = OptLevel::O2;
+    // target triple, the host's when empty.
+    std::string triple;
+    std::string cpu = "generic";
+    std::string features;
+    bool hostFeatures = false;
+    llvm::Reloc::Model relocModel = llvm::Reloc::PIC_;
+    std::optional<llvm::CodeModel::Model> codeModel;
+    // threads optimizing and emitting object code, each on its own partition of the module.
+    unsigned jobs = 1;
+    // allocate from the collected heap of lib/gc.c and keep pointers in shadow stack roots,
+    // for programs that run on their own. Code that runs along the interpreter mallocs.
+    bool gc = false;
+    // bytes the old generation may grow to, unlimited when 0.
+    int64_t heapLimit = 0;
+    // free the allocations region inference keeps in a let when the let ends.
+    bool regions = false;
+    // count the references to records and arrays and free them at zero, instead of
+    // collecting them.
+    bool rc = false;
   };
 
-  struct VarEnventry : Enventry
-  {
-    llvm::AllocaInst *alloca;
-    std::shared_ptr<ty::Type> type;
+  llvm::CodeGenOpt::Level codeGenOptLevel(OptLevel level);
+  void resolveTarget(CompileOptions &options);
 
-    VarEnventry(std::shared_ptr<ty::Type> type, llvm::AllocaInst *alloca);
-  };
-
-  struct FuncEnventry : Enventry
+  struct TyValue
   {
-    std::string name;
-    std::shared_ptr<ty::Type> returnType;
-    std::vector<std::shared_ptr<ty::Type>> args;
+    llvm::Value *value;
+    const ty::Type *type;
 
-    FuncEnventry(std::string name, std::shared_ptr<ty::Type> returnType, std::vector<std::shared_ptr<ty::Type>> args);
+    TyValue(const ty::Type *type = nullptr, llvm::Value *value = nullptr);
   };
 
   class AbstractCodeGenerator
@@ -72,10 +89,11 @@ namespace cg
     virtual TyValue visit(absyn::FunctionDec &funcDec) = 0;
   };
 
+  // Translates a program annotated by sm::Checker. Every type, binding and field offset
+  // is read off the AST, so the generator neither checks nor looks anything up by name.
   class CodeGenerator : public AbstractCodeGenerator
   {
     int label_id = 0;
-    int func_id = 0;
     int unique_id = 0;
 
   public:
@@ -101,39 +119,137 @@ namespace cg
     virtual TyValue visit(absyn::VarDec &varDec) override;
     virtual TyValue visit(absyn::FunctionDec &funcDec) override;
 
+    void translate(absyn::Exp &exp, bool withModules = true);
+    void optimize(llvm::Module &module);
     void generate(absyn::Exp &exp);
+    void generateObject(absyn::Exp &exp, std::string filename);
+    void generateModule(absyn::Let &module, std::string filename);
+    void generateLinked(absyn::Exp &exp, std::string filename, const std::vector<std::string> &modules);
+    void generateIncremental(absyn::Exp &exp, std::string filename, cache::Store &store, const std::vector<std::string> &configuration);
+    void emit(std::string filename);
+    void emitIR(std::string filename);
+    std::unique_ptr<llvm::LLVMContext> takeContext();
+    const CompileOptions &compileOptions() const;
 
-    CodeGenerator();
+    CodeGenerator(const sm::Checker &checker, CompileOptions options = CompileOptions());
 
     std::string newLabel(std::string topic = "");
 
   protected:
+    CompileOptions options;
     std::unique_ptr<llvm::LLVMContext> context;
-    std::unique_ptr<llvm::legacy::FunctionPassManager> functionPassManager;
-    std::unique_ptr<llvm::FunctionAnalysisManager> functionAnalysisManager;
-    tb::Table<std::string, std::shared_ptr<Enventry>> namedValues;
-    tb::Table<std::string, std::shared_ptr<ty::Type>> namedTypes;
+    std::unique_ptr<llvm::TargetMachine> targetMachine;
+    const sm::Checker &checker;
+    // struct layouts of record types, indexed by type id.
+    std::vector<llvm::StructType *> recordLayouts;
+    // collector type descriptors of records and arrays, indexed by type id.
+    std::vector<llvm::GlobalVariable *> typeDescriptors;
+    // llvm functions, indexed by sm::Function::id and declared on first use.
+    std::vector<llvm::Function *> functions;
     std::vector<llvm::BasicBlock *> breaks;
-
-    void optimize();
-    void beginScope();
-    void endScope();
-    void reportError(std::string error, absyn::position pos);
-    [[noreturn]] void fatalError(std::string error, absyn::position pos);
+    // regions of the lets being generated, each with the loops it is in, which a break
+    // out of a loop entered after it leaves.
+    struct Region
+    {
+      llvm::Value *mark;
+      size_t loops;
+    };
+    std::vector<Region> regions;
+    // slots owning a reference under reference counting, dropped when their let or
+    // function ends, and by a break out of a loop entered after them.
+    struct Owned
+    {
+      llvm::Value *slot;
+      size_t loops;
+    };
+    std::vector<Owned> owned;
+    // whether the records of parameters being reused are unique.
+    std::map<const sm::Variable *, llvm::Value *> reusing;
+    // functions of the runtime linked into the module.
+    std::set<const llvm::GlobalValue *> runtimeDefinitions;
+
+    // Addresses of the variables of a function being generated. Its own variables live
+    // in slots, captured variables of enclosing functions are reached through extra
+    // pointer parameters.
+    struct Frame
+    {
+      const sm::Function *function;
+      std::vector<llvm::Value *> slots;
+      std::vector<llvm::Value *> captures;
+    };
+    std::vector<Frame> frames;
+
+    void createTargetMachine();
+    std::unique_ptr<llvm::TargetMachine> newTargetMachine();
+    void addTargetAttributes(llvm::Module &module);
+    void optimize(llvm::Module &module, llvm::TargetMachine &machine, bool thinLTOPreLink = false);
+    void emitObject(llvm::Module &module, llvm::TargetMachine &machine, llvm::raw_pwrite_stream &dest);
+    void emitParallel(std::string filename);
+    void compilePartitions(const std::vector<llvm::SmallString<0>> &bitcodes, std::vector<llvm::SmallString<0>> &objects);
+    void linkRuntime();
+    void writeThinLTO(llvm::Module &module, llvm::raw_ostream &dest);
+    void linkObjects(const std::vector<std::string> &paths, std::string filename);
 
   public:
     std::unique_ptr<llvm::Module> moduler;
     std::unique_ptr<llvm::IRBuilder<>> builder;
 
   private:
-    std::map<std::string, std::function<llvm::Function *()>> libraryFunctionCreator;
+    llvm::Function *mallocFunction = nullptr;
+    llvm::Function *arrayInitializeFunction = nullptr;
+    llvm::Function *stringCompareFunction = nullptr;
+    llvm::Function *stringEqualFunction = nullptr;
+    llvm::Function *concatNFunction = nullptr;
+    llvm::Function *gcInitFunction = nullptr;
+    llvm::Function *gcAllocFunction = nullptr;
+    llvm::Function *gcNewArrayFunction = nullptr;
+    llvm::Function *gcWriteFunction = nullptr;
+    llvm::Function *regionEnterFunction = nullptr;
+    llvm::Function *regionAllocFunction = nullptr;
+    llvm::Function *regionNewArrayFunction = nullptr;
+    llvm::Function *regionExitFunction = nullptr;
+    llvm::Function *rcInitFunction = nullptr;
+    llvm::Function *rcAllocFunction = nullptr;
+    llvm::Function *rcNewArrayFunction = nullptr;
+    llvm::Function *rcDupFunction = nullptr;
+    llvm::Function *rcDropFunction = nullptr;
+    llvm::Function *rcUniqueFunction = nullptr;
+    llvm::Function *rcReuseFunction = nullptr;
+
+    // A pointer that must stay valid while code that may collect runs, kept in a root
+    // slot when the collector could move what it points to.
+    struct Held
+    {
+      llvm::Value *value;
+      llvm::AllocaInst *slot;
+    };
+    // string objects of the literals in the module, by value.
+    std::map<std::string, llvm::Constant *> stringLiterals;
 
     TyValue mkVoid();
-    void preprocessTypeDecs(std::vector<absyn::TypeDec *> decs);
-    void preprocessFunctionDecs(std::vector<absyn::FunctionDec *> func_decs);
     llvm::Type *type2IRType(const ty::Type *type);
-    llvm::Function *createFunction(FuncEnventry &func);
-    llvm::Function *requestFunction(std::string funcname);
-    void registeLibraryFunction(std::string name, std::function<llvm::Function *()> factory);
+    llvm::StructType *recordLayout(const ty::Record *record);
+    llvm::AllocaInst *createEntryBlockAlloca(llvm::Type *type, std::string name = "");
+    llvm::AllocaInst *createRootAlloca(llvm::Type *type, std::string name = "");
+    llvm::Value *stackObject(const ty::Type *type, llvm::Type *layout);
+    Held hold(const TyValue &value, bool collects);
+    llvm::Value *release(const Held &held);
+    llvm::Value *objectOf(absyn::Var &var);
+    llvm::GlobalVariable *typeDescriptor(const ty::Type *type);
+    void writeBarrier(llvm::Value *object, const TyValue &value);
+    void analyzeMemory(absyn::Exp *program);
+    void exitRegion(llvm::Value *mark);
+    bool counted(const ty::Type *type);
+    void dup(llvm::Value *object);
+    void drop(llvm::Value *object);
+    void dropOwned(size_t from);
+    TyValue borrow(absyn::Exp &exp, bool &owns);
+    llvm::Value *variableAddress(const sm::Variable *variable);
+    llvm::Function *function(const sm::Function *function);
+    llvm::Function *runtimeFunction(llvm::Function *&cached, const char *name, llvm::FunctionType *type);
+    llvm::Constant *stringLiteral(const std::string &value);
+    TyValue constant(const ty::Type *type, const sm::Constant &value);
+    TyValue concatChain(absyn::Call &call);
+    llvm::Value *compareStrings(absyn::Oper op, llvm::Value *lhs, llvm::Value *rhs);
   };
 }
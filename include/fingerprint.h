@@ -0,0 +1,55 @@
+#pragma once
+#include <sstream>
+#include <string>
+#include "absyn.h"
+#include "semant.h"
+
+namespace sm
+{
+  // Describes everything that decides the code generated for one function: its signature,
+  // its body and the shape of the functions, variables and types the body uses. Two
+  // functions with the same description compile to the same code, so it can key a cache
+  // of compiled functions. Bodies of nested functions are left out, they are compiled on
+  // their own.
+  class Fingerprint : public absyn::Visitor
+  {
+  public:
+    std::string of(const Function *function, absyn::Exp &body);
+
+    void visit(absyn::Nil &n) override;
+    void visit(absyn::Int &i) override;
+    void visit(absyn::String &s) override;
+    void visit(absyn::VarExp &var) override;
+    void visit(absyn::Assign &assign) override;
+    void visit(absyn::Seq &seq) override;
+    void visit(absyn::Call &call) override;
+    void visit(absyn::BinOp &bin) override;
+    void visit(absyn::RecordExp &record) override;
+    void visit(absyn::Array &array) override;
+    void visit(absyn::If &iff) override;
+    void visit(absyn::While &whil) override;
+    void visit(absyn::For &forr) override;
+    void visit(absyn::Break &brk) override;
+    void visit(absyn::Let &let) override;
+    void visit(absyn::SimpleVar &var) override;
+    void visit(absyn::FieldVar &field) override;
+    void visit(absyn::SubscriptVar &subscript) override;
+    void visit(absyn::ID &id) override;
+    void visit(absyn::Record &record) override;
+    void visit(absyn::Field &field) override;
+    void visit(absyn::NamedType &named) override;
+    void visit(absyn::ArrayType &arrayType) override;
+    void visit(absyn::RecordType &recordType) override;
+    void visit(absyn::TypeDec &typeDec) override;
+    void visit(absyn::VarDec &varDec) override;
+    void visit(absyn::FunctionDec &funcDec) override;
+
+  private:
+    std::ostringstream out;
+    const Function *current = nullptr;
+
+    void type(const ty::Type *type);
+    void variable(const Variable *variable);
+    void signature(const Function *function);
+  };
+}
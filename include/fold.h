@@ -0,0 +1,17 @@
+#pragma once
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <variant>
+#include "absyn.h"
+
+namespace sm
+{
+  using Constant = std::variant<int64_t, std::string>;
+
+  // The value of an expression built only from literals and calls of builtins without
+  // side effects on them, such as ord("0"), size("abc") or concat("a", "b"), or nothing
+  // when it has to be computed at run time. Calls that would fail at run time, like chr
+  // out of range, are not folded so that they still fail there.
+  std::optional<Constant> fold(const absyn::Exp &exp);
+}
@@ -0,0 +1,123 @@
+#pragma once
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <llvm/ExecutionEngine/Orc/ThreadSafeModule.h>
+#include "absyn.h"
+#include "semant.h"
+#include "codegen.h"
+#include "jit.h"
+#include "runtime.h"
+
+extern "C" int64_t tiger_tier_call(int64_t id, const int64_t *args);
+
+namespace interp
+{
+  // A native entry point takes the packed arguments of a call, regular arguments first and
+  // the addresses of captured variables after them, and returns the result as a 64-bit value.
+  using Entry = int64_t (*)(const int64_t *args);
+
+  // Compiles hot functions of a checked program with the LLVM backend. Every function is
+  // reached through a stub that jumps through a patchable pointer, so compiled code and
+  // the interpreter call each other and a function can be swapped while it is running.
+  class Tier
+  {
+  public:
+    Tier(absyn::Exp &program, const sm::Checker &checker, cg::CompileOptions options);
+    ~Tier();
+
+    Entry compile(const sm::Function *function);
+
+    int compiledFunctions() const;
+    double compileMilliseconds() const;
+
+  private:
+    absyn::Exp &program;
+    const sm::Checker &checker;
+    cg::CompileOptions options;
+    std::unique_ptr<cg::JIT> jit;
+    llvm::orc::ThreadSafeContext context;
+    std::unique_ptr<llvm::Module> module;
+    std::unique_ptr<cg::CodeGenerator> generator;
+    int compiled = 0;
+    double milliseconds = 0;
+
+    void prepare();
+    std::unique_ptr<llvm::Module> createStubs();
+  };
+
+  struct Frame
+  {
+    const sm::Function *function;
+    int64_t *slots;
+    int64_t *const *captures;
+  };
+
+  class Interpreter : public absyn::Visitor
+  {
+  public:
+    Interpreter(const sm::Checker &checker, Tier *tier = nullptr, int64_t threshold = 1000);
+    ~Interpreter();
+
+    void run(absyn::Exp &exp);
+    int64_t call(const sm::Function *function, const int64_t *args);
+    const sm::Function *function(int64_t id) const;
+
+    void visit(absyn::Nil &n) override;
+    void visit(absyn::Int &i) override;
+    void visit(absyn::String &s) override;
+    void visit(absyn::VarExp &var) override;
+    void visit(absyn::Assign &assign) override;
+    void visit(absyn::Seq &seq) override;
+    void visit(absyn::Call &call) override;
+    void visit(absyn::BinOp &bin) override;
+    void visit(absyn::RecordExp &record) override;
+    void visit(absyn::Array &array) override;
+    void visit(absyn::If &iff) override;
+    void visit(absyn::While &whil) override;
+    void visit(absyn::For &forr) override;
+    void visit(absyn::Break &brk) override;
+    void visit(absyn::Let &let) override;
+    void visit(absyn::SimpleVar &var) override;
+    void visit(absyn::FieldVar &field) override;
+    void visit(absyn::SubscriptVar &subscript) override;
+    void visit(absyn::ID &id) override;
+    void visit(absyn::Record &record) override;
+    void visit(absyn::Field &field) override;
+    void visit(absyn::NamedType &named) override;
+    void visit(absyn::ArrayType &arrayType) override;
+    void visit(absyn::RecordType &recordType) override;
+    void visit(absyn::TypeDec &typeDec) override;
+    void visit(absyn::VarDec &varDec) override;
+    void visit(absyn::FunctionDec &funcDec) override;
+
+  private:
+    using Builtin = int64_t (*)(const int64_t *args);
+
+    struct State
+    {
+      int64_t counter = 0;
+      Entry entry = nullptr;
+      Builtin builtin = nullptr;
+      bool failed = false;
+    };
+
+    const sm::Checker &checker;
+    Tier *tier;
+    int64_t threshold;
+    std::vector<State> states;
+    Frame *frame = nullptr;
+    int64_t value = 0;
+    int64_t *address = nullptr;
+    // string objects of the literals evaluated so far, over the bytes held by the tree.
+    std::unordered_map<const absyn::String *, tiger_string> literals;
+
+    int64_t evaluate(absyn::Exp &exp);
+    int64_t *locate(absyn::Var &var);
+    int64_t *lookup(const sm::Variable *variable);
+    void countBackEdge();
+    void tierUp(const sm::Function *function);
+  };
+}
@@ -0,0 +1,28 @@
+#pragma once
+#include <memory>
+#include <string>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+#include <llvm/ExecutionEngine/Orc/LLJIT.h>
+#include <llvm/ExecutionEngine/Orc/ThreadSafeModule.h>
+#include "codegen.h"
+
+namespace cg
+{
+  class JIT
+  {
+  public:
+    JIT(const CompileOptions &options);
+
+    const llvm::DataLayout &getDataLayout() const;
+    void addModule(std::unique_ptr<llvm::Module> module, std::unique_ptr<llvm::LLVMContext> context);
+    void addModule(std::unique_ptr<llvm::Module> module, llvm::orc::ThreadSafeContext context);
+    void define(std::string name, void *address);
+    void *lookup(std::string name);
+
+  private:
+    std::unique_ptr<llvm::orc::LLJIT> jit;
+
+    void defineRuntime();
+  };
+}
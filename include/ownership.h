@@ -0,0 +1,19 @@
+#pragma once
+#include "absyn.h"
+#include "region.h"
+#include "semant.h"
+
+namespace sm
+{
+  // Ownership of records and arrays under reference counting, in the spirit of Perceus.
+  // A variable owns a reference to its value, but some increments and decrements cancel:
+  // - a parameter that does not escape and is never assigned is borrowed, the caller
+  //   keeps its reference for the call;
+  // - the last use of a parameter in the tail of its function moves the reference on;
+  // - a record built in the tail of a function reuses the memory of a parameter of its
+  //   type that dies there, when nothing else refers to it, and takes over the fields it
+  //   reads from it, so that rebuilding a list updates it in place.
+  // Marks parameters as borrowed, and the moving uses and reusing records of the functions
+  // declared in exp.
+  void inferOwnership(absyn::Exp &exp, const Checker &checker, const Regions &regions);
+}
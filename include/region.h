@@ -0,0 +1,95 @@
+#pragma once
+#include <optional>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include "absyn.h"
+#include "semant.h"
+
+namespace sm
+{
+  // Region inference. A record or array that initializes a variable of a let, as in
+  // `let var l := list{first=0, rest=nil} in ... end`, cannot outlive the let when the value
+  // of the variable never leaves it: the variable only has its fields or elements read and
+  // written, is compared, or is passed to parameters that keep to the same rule. Such
+  // allocations are marked regional and their lets as having a region, which frees them
+  // all when the let ends. Those of variables that are never assigned and only hold
+  // integers, records of them or arrays of a length known when compiling, go to the frame
+  // of the function instead.
+  class Regions : public absyn::Visitor
+  {
+  public:
+    // every expression whose functions are called, the program and its modules.
+    void add(absyn::Exp &exp);
+    // decides which variables escape once everything is added, and sets the escape flags
+    // of variables and parameters.
+    void solve();
+    // marks the allocations that go to the frame, and to regions when regions is set.
+    void mark(bool regions);
+    // whether the value of a variable or a parameter may outlive it.
+    bool escapes(const Variable *variable) const;
+
+    void visit(absyn::Nil &n) override;
+    void visit(absyn::Int &i) override;
+    void visit(absyn::String &s) override;
+    void visit(absyn::VarExp &var) override;
+    void visit(absyn::Assign &assign) override;
+    void visit(absyn::Seq &seq) override;
+    void visit(absyn::Call &call) override;
+    void visit(absyn::BinOp &bin) override;
+    void visit(absyn::RecordExp &record) override;
+    void visit(absyn::Array &array) override;
+    void visit(absyn::If &iff) override;
+    void visit(absyn::While &whil) override;
+    void visit(absyn::For &forr) override;
+    void visit(absyn::Break &brk) override;
+    void visit(absyn::Let &let) override;
+    void visit(absyn::SimpleVar &var) override;
+    void visit(absyn::FieldVar &field) override;
+    void visit(absyn::SubscriptVar &subscript) override;
+    void visit(absyn::ID &id) override;
+    void visit(absyn::Record &record) override;
+    void visit(absyn::Field &field) override;
+    void visit(absyn::NamedType &named) override;
+    void visit(absyn::ArrayType &arrayType) override;
+    void visit(absyn::RecordType &recordType) override;
+    void visit(absyn::TypeDec &typeDec) override;
+    void visit(absyn::VarDec &varDec) override;
+    void visit(absyn::FunctionDec &funcDec) override;
+
+  private:
+    struct Candidate
+    {
+      absyn::Let *let;
+      absyn::VarDec *dec;
+    };
+
+    // a variable passed as an argument escapes along with the parameter.
+    struct Pass
+    {
+      const Variable *arg;
+      const Function *callee;
+      size_t index;
+    };
+
+    std::vector<Candidate> candidates;
+    std::vector<Pass> passes;
+    std::unordered_set<const Variable *> escaped;
+    std::vector<absyn::VarDec *> vars;
+    std::vector<absyn::Field *> params;
+    std::unordered_set<const Variable *> assigned;
+    std::unordered_map<const Variable *, const absyn::Exp *> initializers;
+    // functions whose bodies were seen, the parameters of others escape.
+    std::unordered_set<const Function *> analyzed;
+    absyn::Let *let = nullptr;
+
+    // arrays in the frame hold at most this many elements.
+    static constexpr int64_t maxStackLength = 32;
+
+    bool stackable(const absyn::VarDec &varDec) const;
+    std::optional<int64_t> constant(const absyn::Exp &exp) const;
+    // visits the operand of something that does not keep the value of a variable.
+    void inspect(absyn::Var &var);
+    void inspect(absyn::Exp &exp);
+  };
+}
@@ -0,0 +1,115 @@
+#pragma once
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+  // A string is its length and a pointer to its bytes, which are not NUL-terminated. The
+  // bytes of literals, of short strings and of short concatenations follow the header in
+  // the same object, a long substring points into the bytes of its parent instead. A long
+  // concatenation is a rope whose data stays null until the runtime first reads its bytes,
+  // so only the runtime reads data. Strings never change their contents once built.
+  typedef struct tiger_string
+  {
+    int64_t length;
+    const char *data;
+  } tiger_string;
+
+  void tiger_print(const tiger_string *s);
+  void tiger_flush(void);
+  const tiger_string *tiger_getchar(void);
+  int64_t tiger_ord(const tiger_string *s);
+  const tiger_string *tiger_chr(int64_t i);
+  int64_t tiger_size(const tiger_string *s);
+  const tiger_string *tiger_substring(const tiger_string *s, int64_t first, int64_t n);
+  const tiger_string *tiger_concat(const tiger_string *a, const tiger_string *b);
+  // concatenates n strings into one allocation, for chains of concat calls.
+  const tiger_string *tiger_concat_n(int64_t n, const tiger_string **parts);
+  int64_t tiger_not(int64_t i);
+  void tiger_exit(int64_t code);
+  int64_t tiger_string_compare(const tiger_string *a, const tiger_string *b);
+  int64_t tiger_string_equal(const tiger_string *a, const tiger_string *b);
+  void tiger_array_initialize(void *array, const void *element, int64_t n, int64_t size);
+
+  // Compiled programs allocate from a collected heap. Every object there has a header in
+  // front of it that gives its size and its type, which says where its pointers are.
+  enum tiger_kind
+  {
+    TIGER_RECORD,
+    TIGER_ARRAY,
+    TIGER_STRING,
+    TIGER_ROPE,
+  };
+
+  typedef struct tiger_type
+  {
+    uint32_t kind;
+    // pointer fields of a record, nonzero for an array of pointers.
+    uint32_t count;
+    // byte offsets of the pointer fields of a record.
+    uint32_t offsets[];
+  } tiger_type;
+
+  // A rope, or a substring sharing the bytes of left. Once data is set it points into the
+  // bytes of left, and right is null.
+  typedef struct tiger_rope
+  {
+    tiger_string string;
+    const tiger_string *left;
+    const tiger_string *right;
+  } tiger_rope;
+
+  extern const tiger_type tiger_string_type;
+  extern const tiger_type tiger_rope_type;
+
+  void tiger_gc_init(int64_t heap_limit);
+  void *tiger_gc_alloc(const tiger_type *type, int64_t size);
+  void *tiger_gc_new_array(const tiger_type *type, int64_t n, const void *element);
+  // tells the collector that a pointer to value was stored in object.
+  void tiger_gc_write(const void *object, const void *value);
+  // the type of an object of the heap, null for anything else.
+  const tiger_type *tiger_gc_type(const void *object);
+  // the runtime keeps the strings it works on in slots the collector updates, while it
+  // allocates.
+  void tiger_gc_push_roots(void *slots, int64_t n);
+  void tiger_gc_pop_roots(void);
+
+  // Objects that cannot outlive the let declaring them live in a stack of regions. Entering
+  // a region returns a mark, and leaving it frees everything allocated since the mark.
+  void *tiger_region_enter(void);
+  void *tiger_region_alloc(const tiger_type *type, int64_t size);
+  void *tiger_region_new_array(const tiger_type *type, int64_t n, const void *element);
+  void tiger_region_exit(void *mark);
+
+  // Reference counted records, arrays and strings, under -memory=rc. A new object has one
+  // reference, dup adds one and drop removes one, freeing the object at zero. Literals and
+  // the strings of the runtime itself have a header too, with a negative count, and are
+  // never freed.
+  typedef struct tiger_rc_header
+  {
+    const tiger_type *type;
+    // references, and once the object is dead the next object waiting to be freed.
+    intptr_t count;
+    // bytes after the header.
+    int64_t size;
+  } tiger_rc_header;
+
+#define TIGER_RC_IMMORTAL (-1)
+
+  // set by tiger_rc_init, the runtime then counts the strings it makes.
+  extern int32_t tiger_rc_enabled;
+
+  void tiger_rc_init(void);
+  void *tiger_rc_alloc(const tiger_type *type, int64_t size);
+  void *tiger_rc_new_array(const tiger_type *type, int64_t n, const void *element);
+  void tiger_rc_dup(const void *object);
+  void tiger_rc_drop(const void *object);
+  int64_t tiger_rc_unique(const void *object);
+  const tiger_type *tiger_rc_type(const void *object);
+  void *tiger_rc_reuse(const tiger_type *type, int64_t size, void *old, int64_t unique, uint64_t moved);
+
+#ifdef __cplusplus
+}
+#endif
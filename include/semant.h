@@ -0,0 +1,128 @@
+#pragma once
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include "absyn.h"
+#include "types.h"
+#include "table.h"
+
+namespace sm
+{
+  struct Function;
+
+  struct Variable
+  {
+    sym::Symbol name;
+    ty::Type *type;
+    Function *owner;
+    int slot;
+    // under reference counting, a parameter whose reference stays with the caller.
+    bool borrowed = false;
+    // used by a nested function, which may change it during any call.
+    bool captured = false;
+
+    Variable(sym::Symbol name, ty::Type *type, Function *owner, int slot);
+  };
+
+  struct Function
+  {
+    int id;
+    std::string name;
+    absyn::FunctionDec *dec;
+    Function *parent;
+    ty::Type *returnType;
+    std::vector<ty::Type *> args;
+    // variables of enclosing functions used by this function or by the functions it calls,
+    // passed by address after the regular arguments.
+    std::vector<Variable *> captures;
+    std::vector<Function *> callees;
+    int frameSize = 0;
+    // declared at the top of a library module and linked under its module-qualified name.
+    bool exported = false;
+
+    Function(int id, std::string name, absyn::FunctionDec *dec, Function *parent, ty::Type *returnType, std::vector<ty::Type *> args);
+
+    bool isBuiltin() const;
+    bool isNestedIn(const Function *other) const;
+    int captureIndex(const Variable *variable) const;
+  };
+
+  struct Binding
+  {
+    Variable *variable = nullptr;
+    Function *function = nullptr;
+  };
+
+  class Checker : public absyn::Visitor
+  {
+  public:
+    Checker();
+
+    void check(absyn::Exp &exp);
+    void import(std::string module, absyn::Exp &exp);
+    const std::vector<absyn::Let *> &modules() const;
+    const std::vector<std::unique_ptr<Function>> &functions() const;
+    Function *mainFunction() const;
+    const ty::Context &typeContext() const;
+
+    void visit(absyn::Nil &n) override;
+    void visit(absyn::Int &i) override;
+    void visit(absyn::String &s) override;
+    void visit(absyn::VarExp &var) override;
+    void visit(absyn::Assign &assign) override;
+    void visit(absyn::Seq &seq) override;
+    void visit(absyn::Call &call) override;
+    void visit(absyn::BinOp &bin) override;
+    void visit(absyn::RecordExp &record) override;
+    void visit(absyn::Array &array) override;
+    void visit(absyn::If &iff) override;
+    void visit(absyn::While &whil) override;
+    void visit(absyn::For &forr) override;
+    void visit(absyn::Break &brk) override;
+    void visit(absyn::Let &let) override;
+    void visit(absyn::SimpleVar &var) override;
+    void visit(absyn::FieldVar &field) override;
+    void visit(absyn::SubscriptVar &subscript) override;
+    void visit(absyn::ID &id) override;
+    void visit(absyn::Record &record) override;
+    void visit(absyn::Field &field) override;
+    void visit(absyn::NamedType &named) override;
+    void visit(absyn::ArrayType &arrayType) override;
+    void visit(absyn::RecordType &recordType) override;
+    void visit(absyn::TypeDec &typeDec) override;
+    void visit(absyn::VarDec &varDec) override;
+    void visit(absyn::FunctionDec &funcDec) override;
+
+  private:
+    tb::Table<sym::Symbol, ty::Type *> namedTypes;
+    tb::Table<sym::Symbol, Binding> namedValues;
+    ty::Context types;
+    std::vector<std::unique_ptr<Variable>> variables;
+    std::vector<std::unique_ptr<Function>> functions_;
+    std::vector<absyn::Let *> modules_;
+    // the module whose top-level functions are being declared, if any.
+    std::string exporting;
+    ty::Type *intType;
+    ty::Type *stringType;
+    ty::Type *nilType;
+    ty::Type *voidType;
+    Function *current = nullptr;
+    // functions declared so far under each symbol path.
+    std::map<std::string, int> siblings;
+    int loops = 0;
+    ty::Type *result = nullptr;
+
+    ty::Type *typeOf(absyn::Exp &exp);
+    ty::Type *typeOf(absyn::Var &var);
+    ty::Type *lookupType(absyn::ID &id, std::string error);
+    Variable *newVariable(sym::Symbol name, ty::Type *type);
+    Function *newFunction(std::string name, absyn::FunctionDec *dec, ty::Type *returnType, std::vector<ty::Type *> args);
+    void preprocessTypeDecs(std::vector<absyn::TypeDec *> decs);
+    void preprocessFunctionDecs(std::vector<absyn::FunctionDec *> decs);
+    void resolveCaptures();
+    void beginScope();
+    void endScope();
+    [[noreturn]] void fatalError(std::string error, absyn::position pos);
+  };
+}
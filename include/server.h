@@ -0,0 +1,35 @@
+#pragma once
+#include <cstdint>
+#include <functional>
+#include <string>
+
+namespace server
+{
+  enum class Request : uint32_t
+  {
+    Compile,
+    Stats,
+    Stop,
+  };
+
+  // The socket of the daemon, $KALECD_SOCKET or one per user in /tmp.
+  std::string socketPath();
+
+  // Has a running daemon compile with these arguments, as kalec would in the working
+  // directory of the caller, and prints its diagnostics. False when no daemon listens.
+  bool forward(int argc, char *argv[], int &status);
+
+  // Sends a request without arguments to the daemon, false when no daemon listens.
+  bool query(const std::string &path, Request request, std::string &reply);
+
+  using Compile = std::function<int(int argc, char *argv[])>;
+
+  // Accepts requests on path until a stop request. Every compilation runs in a process
+  // forked from the daemon, and a compilation that fails only ends its own process. What
+  // is gained is the startup of a process: a worker inherits the targets registered and
+  // whatever LLVM set up on first use before the daemon started serving, but its context,
+  // target machine and everything else it builds end with it. The daemon itself is a
+  // single thread, so that it forks while nothing holds a lock. At most workers
+  // compilations run at once, later requests wait in a queue.
+  int serve(const std::string &path, unsigned workers, Compile compile);
+}
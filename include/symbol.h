@@ -0,0 +1,38 @@
+#pragma once
+#include <cstdint>
+#include <functional>
+#include <ostream>
+#include <string>
+#include <string_view>
+
+namespace sym
+{
+  // Handle of an identifier in the process-wide interner. Equal names always get the same
+  // handle, so comparing and hashing symbols never touches the characters.
+  class Symbol
+  {
+  public:
+    Symbol() = default;
+    explicit Symbol(uint32_t id) : id_(id) {}
+
+    uint32_t id() const { return id_; }
+    const std::string &name() const;
+
+    bool operator==(Symbol other) const { return id_ == other.id_; }
+    bool operator!=(Symbol other) const { return id_ != other.id_; }
+    bool operator<(Symbol other) const { return id_ < other.id_; }
+
+  private:
+    uint32_t id_ = 0;
+  };
+
+  Symbol intern(std::string_view name);
+
+  std::ostream &operator<<(std::ostream &out, Symbol symbol);
+}
+
+template <>
+struct std::hash<sym::Symbol>
+{
+  size_t operator()(sym::Symbol symbol) const noexcept { return symbol.id(); }
+};
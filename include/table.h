@@ -1,68 +1,154 @@
 #pragma once
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <utility>
 #include <vector>
-#include <map>
 
 namespace tb
 {
-  template <typename K, typename V>
+  // Scoped symbol table. Every key has one slot in an open-addressing hash table pointing
+  // at its innermost binding, and each binding remembers the one it shadows. Bindings are
+  // kept in an undo log, so leaving a scope pops exactly the bindings it added and
+  // restores what they shadowed. Lookups cost O(1) regardless of nesting depth.
+  template <typename K, typename V, typename Hash = std::hash<K>>
   class Table
   {
   private:
-    std::vector<std::map<K, V>> _map;
+    static constexpr uint32_t none = UINT32_MAX;
 
-  public:
-    Table() : _map(std::vector<std::map<K, V>>{std::map<K, V>()}){};
+    struct Slot
+    {
+      K key;
+      uint32_t head = none;
+      bool used = false;
+    };
 
-    void insert(K key, V value)
+    struct Shadow
     {
-      _map.back()[key] = value;
-    }
+      uint32_t depth;
+      uint32_t previous;
+    };
 
-    V *find(K key)
+    // the undo log, a deque so pointers handed out by find stay valid while it grows.
+    std::deque<std::pair<K, V>> _bindings;
+    std::vector<Shadow> _shadows;
+    std::vector<size_t> _scopes;
+    std::vector<Slot> _slots;
+    size_t _used = 0;
+
+    Slot &slot(const K &key)
     {
-      for (auto it = _map.rbegin(); it != _map.rend(); ++it)
+      if ((_used + 1) * 4 > _slots.size() * 3)
+        grow();
+
+      size_t mask = _slots.size() - 1;
+      for (size_t i = Hash()(key) & mask;; i = (i + 1) & mask)
       {
-        auto found = it->find(key);
-        if (found != it->end())
+        auto &s = _slots[i];
+        if (!s.used)
         {
-          return &found->second;
+          s.used = true;
+          s.key = key;
+          _used++;
+          return s;
         }
+        if (s.key == key)
+          return s;
       }
-      return nullptr;
     }
 
-    V *find_top(K key)
+    Slot *lookup(const K &key)
     {
-      auto top = _map.back();
-      auto found = top.find(key);
-      if (found != top.end())
+      size_t mask = _slots.size() - 1;
+      for (size_t i = Hash()(key) & mask;; i = (i + 1) & mask)
       {
-        return &found->second;
+        auto &s = _slots[i];
+        if (!s.used)
+          return nullptr;
+        if (s.key == key)
+          return &s;
       }
-      else
+    }
+
+    void grow()
+    {
+      std::vector<Slot> old(_slots.size() * 2);
+      old.swap(_slots);
+      size_t mask = _slots.size() - 1;
+      for (auto &s : old)
       {
-        return nullptr;
+        if (!s.used)
+          continue;
+        size_t i = Hash()(s.key) & mask;
+        while (_slots[i].used)
+          i = (i + 1) & mask;
+        _slots[i] = s;
       }
     }
 
+    uint32_t depth() const
+    {
+      return _scopes.size();
+    }
+
+  public:
+    Table() : _slots(16){};
+
+    void insert(K key, V value)
+    {
+      auto &s = slot(key);
+      if (s.head != none && _shadows[s.head].depth == depth())
+      {
+        _bindings[s.head].second = std::move(value);
+        return;
+      }
+      _bindings.emplace_back(key, std::move(value));
+      _shadows.push_back({depth(), s.head});
+      s.head = _bindings.size() - 1;
+    }
+
+    V *find(K key)
+    {
+      auto s = lookup(key);
+      if (!s || s->head == none)
+        return nullptr;
+      return &_bindings[s->head].second;
+    }
+
+    V *find_top(K key)
+    {
+      auto s = lookup(key);
+      if (!s || s->head == none || _shadows[s->head].depth != depth())
+        return nullptr;
+      return &_bindings[s->head].second;
+    }
+
     void enter()
     {
-      _map.push_back(std::map<K, V>());
+      _scopes.push_back(_bindings.size());
     }
 
     void exit()
     {
-      _map.pop_back();
+      auto mark = _scopes.back();
+      _scopes.pop_back();
+      while (_bindings.size() > mark)
+      {
+        lookup(_bindings.back().first)->head = _shadows.back().previous;
+        _bindings.pop_back();
+        _shadows.pop_back();
+      }
     }
 
     auto top_begin()
     {
-      return _map.back().begin();
+      return _bindings.begin() + (_scopes.empty() ? 0 : _scopes.back());
     }
 
     auto top_end()
     {
-      return _map.back().end();
+      return _bindings.end();
     }
   };
 }
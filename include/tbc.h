@@ -0,0 +1,112 @@
+#pragma once
+#include <cstdint>
+
+// .tbc files hold a register bytecode. Every instruction is an opcode word followed by its
+// operand words. The file is position independent so the VM can execute it straight from
+// a read-only mmap: header, function table, code, then the string pool. Each string in the
+// pool is its length as a uint64_t followed by its bytes, padded to 8 bytes.
+namespace bc
+{
+  // Operand kinds: r register, i immediate, s index into the string pool, j jump target,
+  // f function index, b builtin, k field index or count.
+#define TIGER_OPCODES(X)                                                            \
+  X(HALT, "")                                                                       \
+  X(MOVE, "rr")                                                                     \
+  X(LOADI, "ri")                                                                    \
+  X(LOADS, "rs")                                                                    \
+  X(ADD, "rrr")                                                                     \
+  X(SUB, "rrr")                                                                     \
+  X(MUL, "rrr")                                                                     \
+  X(DIV, "rrr")                                                                     \
+  X(ADDI, "rri")                                                                    \
+  X(EQ, "rrr")                                                                      \
+  X(NE, "rrr")                                                                      \
+  X(LT, "rrr")                                                                      \
+  X(LE, "rrr")                                                                      \
+  X(GT, "rrr")                                                                      \
+  X(GE, "rrr")                                                                      \
+  X(SCMP, "rrr")                                                                    \
+  X(JMP, "j")                                                                       \
+  X(JZ, "rj")                                                                       \
+  X(JNZ, "rj")                                                                      \
+  /* compare and jump unless the comparison holds */                                \
+  X(JFEQ, "rrj")                                                                    \
+  X(JFNE, "rrj")                                                                    \
+  X(JFLT, "rrj")                                                                    \
+  X(JFLE, "rrj")                                                                    \
+  X(JFGT, "rrj")                                                                    \
+  X(JFGE, "rrj")                                                                    \
+  /* array, index, value: jump unless array[index] compares to value */            \
+  X(JFEQX, "rrrj")                                                                  \
+  X(JFNEX, "rrrj")                                                                  \
+  /* counter, limit, body: increment the counter and jump back while <= limit */   \
+  X(FORLOOP, "rrj")                                                                 \
+  X(LOADX, "rrr")                                                                   \
+  X(STOREX, "rrr")                                                                  \
+  X(LOADF, "rrk")                                                                   \
+  X(STOREF, "rkr")                                                                  \
+  /* captured variables are passed and accessed by address */                       \
+  X(ADDR, "rr")                                                                     \
+  X(LOADP, "rr")                                                                    \
+  X(STOREP, "rr")                                                                   \
+  X(NEWREC, "rk")                                                                   \
+  X(NEWARR, "rrr")                                                                  \
+  /* the callee frame starts at the base register, which holds the arguments */     \
+  X(CALL, "frr")                                                                    \
+  X(CALLB, "brr")                                                                   \
+  X(RET, "r")                                                                       \
+  X(RETV, "")
+
+  enum Opcode : uint32_t
+  {
+#define TIGER_OPCODE_ENUM(name, kinds) name,
+    TIGER_OPCODES(TIGER_OPCODE_ENUM)
+#undef TIGER_OPCODE_ENUM
+        OPCODE_COUNT
+  };
+
+  extern const char *const opcodeNames[OPCODE_COUNT];
+  extern const char *const operandKinds[OPCODE_COUNT];
+
+  enum Builtin : uint32_t
+  {
+    PRINT,
+    FLUSH,
+    GETCHAR,
+    ORD,
+    CHR,
+    SIZE,
+    SUBSTRING,
+    CONCAT,
+    NOT,
+    EXIT,
+    STRING_COMPARE,
+    BUILTIN_COUNT
+  };
+
+  // runtime symbol of each builtin, as named by sm::Checker.
+  extern const char *const builtinNames[BUILTIN_COUNT];
+
+  const uint32_t magic = 0x31434254; // "TBC1"
+  const uint32_t version = 2;
+
+  struct Header
+  {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t functionCount;
+    uint32_t mainFunction;
+    uint64_t functionOffset;
+    uint64_t codeOffset;
+    uint64_t codeWords;
+    uint64_t stringOffset;
+    uint64_t stringBytes;
+    uint64_t stringCount;
+  };
+
+  struct FunctionInfo
+  {
+    uint32_t entry;
+    uint32_t frameSize;
+  };
+}
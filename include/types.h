@@ -1,69 +1,139 @@
 #pragma once
+#include <cstdint>
 #include <memory>
+#include <unordered_map>
+#include <utility>
 #include <vector>
-#include <string>
-#include <map>
+#include "symbol.h"
 
 namespace ty
 {
-  struct Type : std::enable_shared_from_this<Type>
+  enum class Kind : uint8_t
   {
-    virtual bool operator==(const Type &other) const;
-    virtual bool operator!=(const Type &other) const;
-    virtual bool match(const Type &other) const;
+    Void,
+    Nil,
+    Int,
+    String,
+    Named,
+    Array,
+    Record
   };
 
-  struct Undefined : Type
+  // Types are owned by a Context and live as long as it does. Records and arrays are
+  // nominal, so every declaration is its own type, and a Named alias points straight at
+  // the type it stands for once its declaration group is resolved. Two types are equal
+  // exactly when their actual types are the same object.
+  struct Type
   {
-    bool operator==(const Type &other) const override;
-  };
+    const Kind kind;
+    // dense index in the owning Context, usable as a key into per-type side tables.
+    const uint32_t id;
 
-  struct Void : Type
-  {
-    bool operator==(const Type &other) const override;
+    Type(Kind kind, uint32_t id);
+    Type(const Type &) = delete;
+    Type &operator=(const Type &) = delete;
+    virtual ~Type() = default;
+
+    bool is(Kind other) const { return kind == other; }
   };
 
-  struct Nil : Type
+  struct Named : Type
   {
-    bool operator==(const Type &other) const override;
+    sym::Symbol name;
+    Type *type = nullptr;
+
+    Named(uint32_t id, sym::Symbol name);
   };
 
-  struct Int : Type
+  struct Array : Type
   {
-    bool operator==(const Type &other) const override;
+    sym::Symbol name;
+    Type *type = nullptr;
+
+    Array(uint32_t id, sym::Symbol name);
   };
 
-  struct String : Type
+  struct Record : Type
   {
-    bool operator==(const Type &other) const override;
+    sym::Symbol name;
+    // fields in declaration order, which is also their layout.
+    std::vector<std::pair<sym::Symbol, Type *>> fields;
+
+    Record(uint32_t id, sym::Symbol name);
+
+    void addField(sym::Symbol name, Type *type);
+    int fieldIndex(sym::Symbol name) const;
+
+  private:
+    std::unordered_map<sym::Symbol, int> indices;
   };
 
-  struct Named : Type
+  class Context
   {
-    std::string name;
-    Type *type;
+  public:
+    Context();
 
-    Named(std::string name, Type *type);
+    Type *voidType() const { return void_; }
+    Type *nilType() const { return nil; }
+    Type *intType() const { return int_; }
+    Type *stringType() const { return string; }
 
-    bool operator==(const Type &other) const override;
+    Named *named(sym::Symbol name);
+    Array *array(sym::Symbol name);
+    Record *record(sym::Symbol name);
+
+    // Collapses every alias onto the non-alias type it finally names, and returns the
+    // first alias that is part of a cycle, or nullptr.
+    Named *resolve(const std::vector<Named *> &aliases);
+
+    size_t size() const;
+
+  private:
+    std::vector<std::unique_ptr<Type>> types;
+    Type *void_;
+    Type *nil;
+    Type *int_;
+    Type *string;
+
+    template <typename T, typename... Args>
+    T *make(Args &&...args);
   };
 
-  struct Array : Type
+  // The type behind an alias. Aliases are resolved when declared, so this is one step.
+  inline const Type *actualTy(const Type *type)
   {
-    Type *type;
+    return type->is(Kind::Named) ? static_cast<const Named *>(type)->type : type;
+  }
 
-    Array(Type *type);
+  inline const Array *asArray(const Type *type)
+  {
+    type = actualTy(type);
+    return type->is(Kind::Array) ? static_cast<const Array *>(type) : nullptr;
+  }
 
-    bool operator==(const Type &other) const override;
-  };
+  inline const Record *asRecord(const Type *type)
+  {
+    type = actualTy(type);
+    return type->is(Kind::Record) ? static_cast<const Record *>(type) : nullptr;
+  }
 
-  struct Record : Type
+  inline bool isA(const Type *type, Kind kind)
   {
-    std::string name;
-    std::map<std::string, Type *> records;
+    return actualTy(type)->is(kind);
+  }
 
-    Record(std::string name, std::map<std::string, Type *> records = {});
+  // nil is accepted wherever a record is expected.
+  inline bool match(const Type *lhs, const Type *rhs)
+  {
+    lhs = actualTy(lhs);
+    rhs = actualTy(rhs);
+    return lhs == rhs ||
+           (lhs->is(Kind::Record) && rhs->is(Kind::Nil)) ||
+           (lhs->is(Kind::Nil) && rhs->is(Kind::Record));
+  }
 
-    bool operator==(const Type &other) const override;
-  };
+  inline bool mismatch(const Type *lhs, const Type *rhs)
+  {
+    return !match(lhs, rhs);
+  }
 }
@@ -1,9 +1,17 @@
 #pragma once
 #include <string>
 #include <memory>
+#include <stdexcept>
 #define is_instance(T, ptr) (dynamic_cast<const T *>(ptr))
 
 namespace utils
 {
   std::string toUpper(std::string s);
+
+  // An input that does not compile. Whoever compiles it reports the failure, so that a
+  // batch goes on with its other inputs.
+  struct CompileError : std::runtime_error
+  {
+    using std::runtime_error::runtime_error;
+  };
 }
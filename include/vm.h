@@ -0,0 +1,35 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "tbc.h"
+#include "runtime.h"
+
+namespace bc
+{
+  // A .tbc file mapped read-only into memory and checked before it is executed.
+  class Image
+  {
+  public:
+    Image(const std::string &filename);
+    ~Image();
+    Image(const Image &) = delete;
+    Image &operator=(const Image &) = delete;
+
+    const Header &header() const;
+    const FunctionInfo *functions() const;
+    const uint32_t *code() const;
+    // string objects of the pool, over the bytes of the mapping.
+    const tiger_string *strings() const;
+
+  private:
+    const char *data = nullptr;
+    size_t size = 0;
+    std::vector<tiger_string> literals;
+
+    void verify(const std::string &filename);
+  };
+
+  int execute(const Image &image);
+}
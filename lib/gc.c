@@ -0,0 +1,471 @@
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/mman.h>
+#include "runtime.h"
+
+// A generational copying collector for compiled programs. Objects are bump allocated in
+// a nursery, and a minor collection copies the survivors into the old generation, which
+// is one half of a pair of semispaces. A major collection copies everything alive into
+// the other half. Roots are the frames generated code links into llvm_gc_root_chain, the
+// shadow stack of LLVM's shadow-stack strategy, the slots the runtime pushes while it
+// allocates, and old objects the write barrier remembered as pointing into the nursery.
+//
+// Until tiger_gc_init is called, as in the interpreter and the bytecode vm, allocation
+// falls back to malloc and nothing is collected.
+//
+// Objects of regions are bump allocated on a stack of their own and freed in bulk when
+// their let ends. Nothing points to them but variables, while they may point into the
+// heap, so every collection scans them as roots.
+
+typedef struct header
+{
+  // the type, with FORWARDED set once the object is copied and the rest of the word then
+  // its new address, and REMEMBERED while it is in the remembered set.
+  uintptr_t type;
+  // bytes after the header.
+  int64_t size;
+} header;
+
+#define FORWARDED 1
+#define REMEMBERED 2
+#define ALIGN(n) (((n) + 7) & ~(int64_t)7)
+
+// frames of the shadow stack, laid out as LLVM's ShadowStackGCLowering emits them.
+typedef struct frame_map
+{
+  int32_t roots;
+  int32_t meta;
+} frame_map;
+
+typedef struct stack_entry
+{
+  struct stack_entry *next;
+  const frame_map *map;
+  void *roots[];
+} stack_entry;
+
+stack_entry *llvm_gc_root_chain;
+
+const tiger_type tiger_string_type = {TIGER_STRING, 0};
+const tiger_type tiger_rope_type = {TIGER_ROPE, 0};
+
+typedef struct space
+{
+  char *start, *top, *end;
+} space;
+
+static struct
+{
+  int enabled;
+  space nursery;
+  space old, spare;
+  int64_t reserved;
+  // old generation size that starts a major collection.
+  int64_t threshold;
+  int64_t limit;
+
+  // slots pushed by the runtime.
+  struct
+  {
+    void **slots;
+    int64_t n;
+  } pushed[64];
+  int depth;
+
+  header **remembered;
+  int64_t rememberedCount, rememberedCapacity;
+
+  // statistics, reported at exit under TIGER_GC_STATS.
+  int64_t minors, majors;
+  int64_t allocated, promoted, copied, regions;
+  int64_t pause, maxPause;
+  int64_t started;
+} heap;
+
+static space region;
+
+static int64_t now(void)
+{
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec * 1000000000LL + t.tv_nsec;
+}
+
+static void gc_error(const char *message)
+{
+  fflush(stdout);
+  fprintf(stderr, "runtime error: %s\n", message);
+  exit(1);
+}
+
+static int within(const space *s, const void *p)
+{
+  return (const char *)p >= s->start && (const char *)p < s->top;
+}
+
+static header *header_of(const void *object)
+{
+  return (header *)object - 1;
+}
+
+// a size from the environment, in bytes with an optional K, M or G suffix.
+static int64_t size_from(const char *name, int64_t otherwise)
+{
+  const char *value = getenv(name);
+  if (!value || !*value)
+    return otherwise;
+  char *end;
+  int64_t size = strtoll(value, &end, 10);
+  switch (*end)
+  {
+  case 'g':
+  case 'G':
+    size <<= 10;
+    // fall through
+  case 'm':
+  case 'M':
+    size <<= 10;
+    // fall through
+  case 'k':
+  case 'K':
+    size <<= 10;
+  }
+  return size;
+}
+
+static void reserve(space *s, int64_t size)
+{
+  void *memory = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (memory == MAP_FAILED)
+    gc_error("could not reserve the heap");
+  s->start = s->top = memory;
+  s->end = s->start + size;
+}
+
+static void report(void)
+{
+  double total = (now() - heap.started) / 1e6, paused = heap.pause / 1e6;
+  fprintf(stderr,
+          "gc: %lld minor and %lld major collections, %.2f ms paused (longest %.2f ms), "
+          "%.1f%% of %.2f ms spent outside the collector\n"
+          "gc: %.2f MB allocated, %.2f MB promoted, %.2f MB copied by major collections, %.2f MB old, "
+          "%.2f MB in regions\n",
+          (long long)heap.minors, (long long)heap.majors, paused, heap.maxPause / 1e6,
+          total > 0 ? 100 * (1 - paused / total) : 100.0, total,
+          heap.allocated / 1048576.0, heap.promoted / 1048576.0, heap.copied / 1048576.0,
+          (heap.old.top - heap.old.start) / 1048576.0, heap.regions / 1048576.0);
+}
+
+// heap_limit caps the old generation in bytes, none when 0, and TIGER_HEAP_LIMIT
+// overrides it. TIGER_NURSERY sizes the nursery.
+void tiger_gc_init(int64_t heap_limit)
+{
+  if (heap.enabled)
+    return;
+  heap.limit = size_from("TIGER_HEAP_LIMIT", heap_limit);
+  int64_t nursery = ALIGN(size_from("TIGER_NURSERY", 4 << 20));
+  if (nursery < 64 << 10)
+    nursery = 64 << 10;
+
+  // semispaces are reserved at their largest and only touched pages are backed.
+  heap.reserved = heap.limit > 0 ? ALIGN(heap.limit) + nursery : (int64_t)1 << 36;
+  reserve(&heap.nursery, nursery);
+  reserve(&heap.old, heap.reserved);
+  reserve(&heap.spare, heap.reserved);
+  heap.threshold = 8 * nursery;
+  heap.enabled = 1;
+  heap.started = now();
+  if (getenv("TIGER_GC_STATS"))
+    atexit(report);
+}
+
+static void remember(header *h)
+{
+  if (h->type & REMEMBERED)
+    return;
+  h->type |= REMEMBERED;
+  if (heap.rememberedCount == heap.rememberedCapacity)
+  {
+    heap.rememberedCapacity = heap.rememberedCapacity ? 2 * heap.rememberedCapacity : 256;
+    heap.remembered = realloc(heap.remembered, heap.rememberedCapacity * sizeof(header *));
+  }
+  heap.remembered[heap.rememberedCount++] = h;
+}
+
+// the collection in progress: objects in from move to the top of to.
+static space *from_young, *from_old;
+static space *to;
+
+static void *forward(void *object)
+{
+  if (!object || !(within(from_young, object) || (from_old && within(from_old, object))))
+    return object;
+  header *h = header_of(object);
+  if (h->type & FORWARDED)
+    return (void *)(h->type & ~(uintptr_t)FORWARDED);
+
+  int64_t size = sizeof(header) + h->size;
+  header *copy = (header *)to->top;
+  to->top += size;
+  memcpy(copy, h, size);
+  copy->type &= ~(uintptr_t)REMEMBERED;
+  void *moved = copy + 1;
+  const tiger_type *type = (const tiger_type *)copy->type;
+  // the bytes of a flat string follow it, its data moves along.
+  if (type->kind == TIGER_STRING)
+    ((tiger_string *)moved)->data = (const char *)moved + sizeof(tiger_string);
+  h->type = (uintptr_t)moved | FORWARDED;
+  return moved;
+}
+
+// updates the pointers of an object that is at its final place.
+static void scan(header *h)
+{
+  const tiger_type *type = (const tiger_type *)(h->type & ~(uintptr_t)(FORWARDED | REMEMBERED));
+  void **fields = (void **)(h + 1);
+  switch (type->kind)
+  {
+  case TIGER_RECORD:
+    for (uint32_t i = 0; i < type->count; i++)
+    {
+      void **field = (void **)((char *)fields + type->offsets[i]);
+      *field = forward(*field);
+    }
+    break;
+  case TIGER_ARRAY:
+    if (type->count)
+      for (int64_t i = 0; i < h->size / 8; i++)
+        fields[i] = forward(fields[i]);
+    break;
+  case TIGER_STRING:
+    break;
+  case TIGER_ROPE:
+  {
+    // data of a flattened rope or of a substring points into the bytes of left.
+    tiger_rope *r = (tiger_rope *)fields;
+    const tiger_string *left = r->left;
+    r->left = forward((void *)left);
+    r->right = forward((void *)r->right);
+    if (r->string.data && left)
+      r->string.data += (const char *)r->left - (const char *)left;
+    break;
+  }
+  }
+}
+
+static void forward_roots(void)
+{
+  for (stack_entry *entry = llvm_gc_root_chain; entry; entry = entry->next)
+    for (int32_t i = 0; i < entry->map->roots; i++)
+      entry->roots[i] = forward(entry->roots[i]);
+  for (int i = 0; i < heap.depth; i++)
+    for (int64_t j = 0; j < heap.pushed[i].n; j++)
+      heap.pushed[i].slots[j] = forward(heap.pushed[i].slots[j]);
+}
+
+static void scan_regions(void)
+{
+  for (char *object = region.start; object < region.top; object += sizeof(header) + ((header *)object)->size)
+    scan((header *)object);
+}
+
+// copies what is reachable and not yet in to, breadth first from its old top.
+static void copy_reachable(char *scanned)
+{
+  while (scanned < to->top)
+  {
+    header *h = (header *)scanned;
+    scan(h);
+    scanned += sizeof(header) + h->size;
+  }
+}
+
+static void reset_nursery(void)
+{
+  memset(heap.nursery.start, 0, heap.nursery.top - heap.nursery.start);
+  heap.nursery.top = heap.nursery.start;
+}
+
+static void major(void)
+{
+  heap.majors++;
+  from_young = &heap.nursery;
+  from_old = &heap.old;
+  to = &heap.spare;
+  forward_roots();
+  scan_regions();
+  copy_reachable(to->start);
+  heap.copied += to->top - to->start;
+
+  for (int64_t i = 0; i < heap.rememberedCount; i++)
+    heap.remembered[i]->type &= ~(uintptr_t)REMEMBERED;
+  heap.rememberedCount = 0;
+  reset_nursery();
+  // the old semispace gives its pages back and reads as zeros when it is next used.
+  madvise(heap.old.start, heap.old.top - heap.old.start, MADV_DONTNEED);
+  heap.old.top = heap.old.start;
+  space old = heap.old;
+  heap.old = heap.spare;
+  heap.spare = old;
+
+  // the next major collection waits until the old generation has doubled.
+  int64_t live = heap.old.top - heap.old.start, least = 8 * (heap.nursery.end - heap.nursery.start);
+  heap.threshold = 2 * live > least ? 2 * live : least;
+}
+
+static void minor(void)
+{
+  heap.minors++;
+  from_young = &heap.nursery;
+  from_old = NULL;
+  to = &heap.old;
+  char *promoted = to->top;
+  forward_roots();
+  scan_regions();
+  for (int64_t i = 0; i < heap.rememberedCount; i++)
+  {
+    header *h = heap.remembered[i];
+    h->type &= ~(uintptr_t)REMEMBERED;
+    scan(h);
+  }
+  heap.rememberedCount = 0;
+  copy_reachable(promoted);
+  heap.promoted += to->top - promoted;
+  reset_nursery();
+}
+
+static int64_t old_room(void)
+{
+  int64_t end = heap.limit > 0 ? heap.limit : heap.reserved;
+  return end - (heap.old.top - heap.old.start);
+}
+
+// collects until there is room for needed more bytes in the old generation.
+static void collect(int64_t needed)
+{
+  int64_t started = now();
+  // a minor collection may promote the whole nursery.
+  int64_t nursery = heap.nursery.top - heap.nursery.start;
+  if (old_room() < nursery + needed || heap.old.top - heap.old.start + nursery > heap.threshold)
+    major();
+  else
+    minor();
+  if (old_room() < needed)
+    gc_error("heap limit exceeded");
+
+  int64_t paused = now() - started;
+  heap.pause += paused;
+  if (paused > heap.maxPause)
+    heap.maxPause = paused;
+}
+
+void *tiger_gc_alloc(const tiger_type *type, int64_t size)
+{
+  if (!heap.enabled)
+    return malloc(size);
+
+  int64_t bytes = sizeof(header) + ALIGN(size);
+  heap.allocated += bytes;
+  header *h;
+  if (bytes > (heap.nursery.end - heap.nursery.start) / 8)
+  {
+    // large objects start old, remembered in case they are filled with young pointers.
+    if (old_room() < bytes)
+      collect(bytes);
+    h = (header *)heap.old.top;
+    heap.old.top += bytes;
+    h->type = (uintptr_t)type;
+    h->size = ALIGN(size);
+    remember(h);
+    return h + 1;
+  }
+
+  if (heap.nursery.end - heap.nursery.top < bytes)
+    collect(0);
+  h = (header *)heap.nursery.top;
+  heap.nursery.top += bytes;
+  h->type = (uintptr_t)type;
+  h->size = ALIGN(size);
+  return h + 1;
+}
+
+static void *fill(int64_t *array, int64_t n, const void *element)
+{
+  int64_t value;
+  memcpy(&value, element, 8);
+  for (int64_t i = 0; i < n; i++)
+    array[i] = value;
+  return array;
+}
+
+void *tiger_gc_new_array(const tiger_type *type, int64_t n, const void *element)
+{
+  if (n < 0)
+    gc_error("negative array size");
+  // element is a root slot, read after the allocation may have moved what it points to.
+  return fill(tiger_gc_alloc(type, n * 8), n, element);
+}
+
+void tiger_gc_write(const void *object, const void *value)
+{
+  if (heap.enabled && within(&heap.nursery, value) && within(&heap.old, object))
+    remember(header_of(object));
+}
+
+const tiger_type *tiger_gc_type(const void *object)
+{
+  if (!heap.enabled || !(within(&heap.nursery, object) || within(&heap.old, object)))
+    return NULL;
+  return (const tiger_type *)(header_of(object)->type & ~(uintptr_t)REMEMBERED);
+}
+
+void tiger_gc_push_roots(void *slots, int64_t n)
+{
+  if (heap.depth == sizeof(heap.pushed) / sizeof(heap.pushed[0]))
+    gc_error("too many runtime roots");
+  heap.pushed[heap.depth].slots = slots;
+  heap.pushed[heap.depth++].n = n;
+}
+
+void tiger_gc_pop_roots(void)
+{
+  heap.depth--;
+}
+
+void *tiger_region_enter(void)
+{
+  // reserved like the semispaces, only pages used at once are backed.
+  if (!region.start)
+    reserve(&region, (int64_t)1 << 36);
+  return region.top;
+}
+
+void *tiger_region_alloc(const tiger_type *type, int64_t size)
+{
+  tiger_region_enter();
+  int64_t bytes = sizeof(header) + ALIGN(size);
+  if (region.end - region.top < bytes)
+    gc_error("regions exhausted");
+  header *h = (header *)region.top;
+  region.top += bytes;
+  h->type = (uintptr_t)type;
+  h->size = ALIGN(size);
+  heap.regions += bytes;
+  return h + 1;
+}
+
+void *tiger_region_new_array(const tiger_type *type, int64_t n, const void *element)
+{
+  if (n < 0)
+    gc_error("negative array size");
+  return fill(tiger_region_alloc(type, n * 8), n, element);
+}
+
+void tiger_region_exit(void *mark)
+{
+  region.top = mark;
+}
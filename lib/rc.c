@@ -0,0 +1,161 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "runtime.h"
+
+// Reference counting, the memory of programs compiled with -memory=rc. Records, arrays and
+// strings carry a count of the references to them in their header, and are freed when it
+// drops to zero after dropping what they point to. Type descriptors list only the fields
+// holding counted references, a rope holds its parts.
+
+typedef tiger_rc_header header;
+
+int32_t tiger_rc_enabled;
+
+static struct
+{
+  int64_t allocated, freed, reused, bytes;
+} rc;
+
+static header *header_of(const void *object)
+{
+  return (header *)object - 1;
+}
+
+static void report(void)
+{
+  fprintf(stderr, "rc: %lld objects allocated, %lld freed, %lld reused in place, %.2f MB allocated\n",
+          (long long)rc.allocated, (long long)rc.freed, (long long)rc.reused, rc.bytes / 1048576.0);
+}
+
+void tiger_rc_init(void)
+{
+  tiger_rc_enabled = 1;
+  if (getenv("TIGER_GC_STATS"))
+    atexit(report);
+}
+
+void *tiger_rc_alloc(const tiger_type *type, int64_t size)
+{
+  header *h = malloc(sizeof(header) + size);
+  if (!h)
+  {
+    fflush(stdout);
+    fprintf(stderr, "runtime error: out of memory\n");
+    exit(1);
+  }
+  h->type = type;
+  h->count = 1;
+  h->size = size;
+  rc.allocated++;
+  rc.bytes += sizeof(header) + size;
+  return h + 1;
+}
+
+// the element is owned by the caller and ends up in every slot.
+void *tiger_rc_new_array(const tiger_type *type, int64_t n, const void *element)
+{
+  if (n < 0)
+  {
+    fflush(stdout);
+    fprintf(stderr, "runtime error: negative array size\n");
+    exit(1);
+  }
+  int64_t *array = tiger_rc_alloc(type, n * 8);
+  int64_t value;
+  memcpy(&value, element, 8);
+  for (int64_t i = 0; i < n; i++)
+    array[i] = value;
+  if (type->count && value)
+  {
+    if (n && header_of((void *)value)->count != TIGER_RC_IMMORTAL)
+      header_of((void *)value)->count += n - 1;
+    else
+      tiger_rc_drop((void *)value);
+  }
+  return array;
+}
+
+void tiger_rc_dup(const void *object)
+{
+  if (object && header_of(object)->count != TIGER_RC_IMMORTAL)
+    header_of(object)->count++;
+}
+
+// drops a reference held by a dead object, queueing the object when it dies with it.
+static void release(const void *object, header **dead)
+{
+  if (!object || header_of(object)->count == TIGER_RC_IMMORTAL || --header_of(object)->count)
+    return;
+  header_of(object)->count = (intptr_t)*dead;
+  *dead = header_of(object);
+}
+
+// drops the references of a dead object, queueing the objects that die with them.
+static void drop_fields(header *h, header **dead, uint64_t kept)
+{
+  void **fields = (void **)(h + 1);
+  if (h->type->kind == TIGER_ROPE)
+  {
+    tiger_rope *r = (tiger_rope *)fields;
+    release(r->left, dead);
+    release(r->right, dead);
+    return;
+  }
+  int64_t n = h->type->kind == TIGER_ARRAY ? (h->type->count ? h->size / 8 : 0) : h->type->count;
+  for (int64_t i = 0; i < n; i++)
+  {
+    if (i < 64 && (kept >> i & 1))
+      continue;
+    release(h->type->kind == TIGER_ARRAY ? fields[i] : *(void **)((char *)fields + h->type->offsets[i]), dead);
+  }
+}
+
+// long lists die one object at a time instead of recursing.
+static void free_dead(header *dead)
+{
+  while (dead)
+  {
+    header *h = dead;
+    dead = (header *)h->count;
+    drop_fields(h, &dead, 0);
+    rc.freed++;
+    free(h);
+  }
+}
+
+void tiger_rc_drop(const void *object)
+{
+  header *dead = NULL;
+  release(object, &dead);
+  free_dead(dead);
+}
+
+int64_t tiger_rc_unique(const void *object)
+{
+  return object && header_of(object)->count == 1;
+}
+
+const tiger_type *tiger_rc_type(const void *object)
+{
+  return header_of(object)->type;
+}
+
+// A record the caller is done with gives its memory to a new record of its type when
+// nothing else refers to it. The fields set in moved were taken over by the caller,
+// the others are dropped. Otherwise the record loses a reference and a new one is
+// allocated.
+void *tiger_rc_reuse(const tiger_type *type, int64_t size, void *old, int64_t unique, uint64_t moved)
+{
+  if (unique)
+  {
+    header *dead = NULL;
+    drop_fields(header_of(old), &dead, moved);
+    free_dead(dead);
+    rc.reused++;
+    return old;
+  }
+  tiger_rc_drop(old);
+  return tiger_rc_alloc(type, size);
+}
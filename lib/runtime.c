@@ -1,6 +1,316 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "runtime.h"
 
-void print(char *str)
+// substrings up to this length are copied, longer ones share the bytes of their parent.
+#define SHORT_STRING 16
+// concatenations longer than this are ropes, copied once when their bytes are first read.
+#define ROPE_STRING 256
+
+// A rope is a string without bytes yet, the concatenation of its two parts. Flattening it
+// fills in its data once and drops the parts, so accumulating a string with concat in a
+// loop copies every byte a bounded number of times instead of once per iteration.
+//
+// Strings live in the collected heap of compiled programs, so a function that allocates
+// keeps the strings it still needs in slots pushed to the collector, and reads them from
+// there after allocating.
+//
+// Under -memory=rc strings are counted instead. A function borrows the strings it is
+// given and returns one with a reference of its own, a rope holds a reference to each of
+// its parts. The strings below have the header of a counted string that is never freed.
+
+static struct
+{
+  tiger_rc_header header;
+  tiger_string string;
+  char byte;
+} characters[256];
+
+static const struct
+{
+  tiger_rc_header header;
+  tiger_string string;
+} empty = {{&tiger_string_type, TIGER_RC_IMMORTAL, sizeof(tiger_string)}, {0, ""}};
+
+static const tiger_string *character(int c)
+{
+  characters[c].header.type = &tiger_string_type;
+  characters[c].header.count = TIGER_RC_IMMORTAL;
+  characters[c].header.size = sizeof(tiger_string) + 1;
+  characters[c].byte = (char)c;
+  characters[c].string.length = 1;
+  characters[c].string.data = &characters[c].byte;
+  return &characters[c].string;
+}
+
+static void runtime_error(const char *message)
+{
+  fflush(stdout);
+  fprintf(stderr, "runtime error: %s\n", message);
+  exit(1);
+}
+
+static void *new_object(const tiger_type *type, int64_t size)
+{
+  return tiger_rc_enabled ? tiger_rc_alloc(type, size) : tiger_gc_alloc(type, size);
+}
+
+// a string returned that the caller was given, or the part of a new rope.
+static const tiger_string *share(const tiger_string *s)
+{
+  if (tiger_rc_enabled)
+    tiger_rc_dup(s);
+  return s;
+}
+
+// a string whose bytes follow its header, for the caller to fill in.
+static tiger_string *allocate(int64_t length, char **bytes)
+{
+  tiger_string *s = new_object(&tiger_string_type, sizeof(tiger_string) + length);
+  *bytes = (char *)(s + 1);
+  s->length = length;
+  s->data = *bytes;
+  return s;
+}
+
+// copies the bytes of a string to dest, without recursing into parts that are themselves
+// ropes since accumulation loops build them thousands deep. Never allocates.
+static void copy_bytes(char *dest, const tiger_string *s)
+{
+  size_t capacity = 16, depth = 0;
+  struct
+  {
+    const tiger_string *s;
+    int64_t offset;
+  } *pending = malloc(capacity * sizeof(*pending));
+  pending[depth].s = s;
+  pending[depth++].offset = 0;
+  while (depth)
+  {
+    s = pending[--depth].s;
+    int64_t offset = pending[depth].offset;
+    while (!s->data)
+    {
+      const tiger_rope *part = (const tiger_rope *)s;
+      if (depth == capacity)
+        pending = realloc(pending, (capacity *= 2) * sizeof(*pending));
+      pending[depth].s = part->right;
+      pending[depth++].offset = offset + part->left->length;
+      s = part->left;
+    }
+    memcpy(dest + offset, s->data, s->length);
+  }
+  free(pending);
+}
+
+// the bytes of the string in *slot, flattening it first when it is a rope. The string
+// may move, *slot is updated.
+static const char *flatten(const tiger_string **slot)
+{
+  if ((*slot)->data)
+    return (*slot)->data;
+  tiger_gc_push_roots(slot, 1);
+  char *bytes;
+  tiger_string *flat = allocate((*slot)->length, &bytes);
+  tiger_rope *r = (tiger_rope *)*slot;
+  copy_bytes(bytes, &r->string);
+  const tiger_string *left = r->left, *right = r->right;
+  r->string.data = bytes;
+  r->left = flat;
+  r->right = NULL;
+  tiger_gc_write(r, flat);
+  tiger_gc_pop_roots();
+  if (tiger_rc_enabled)
+  {
+    tiger_rc_drop(left);
+    tiger_rc_drop(right);
+  }
+  return bytes;
+}
+
+// the string that holds the bytes of a flat string.
+static const tiger_string *owner(const tiger_string *s)
+{
+  const tiger_type *type = tiger_rc_enabled ? tiger_rc_type(s) : tiger_gc_type(s);
+  return type && type->kind == TIGER_ROPE ? ((const tiger_rope *)s)->left : s;
+}
+
+void tiger_print(const tiger_string *s)
+{
+  const char *data = flatten(&s);
+  fwrite(data, 1, s->length, stdout);
+}
+
+void tiger_flush(void)
+{
+  fflush(stdout);
+}
+
+const tiger_string *tiger_getchar(void)
+{
+  int c = getchar();
+  return c == EOF ? &empty.string : character(c);
+}
+
+int64_t tiger_ord(const tiger_string *s)
+{
+  return s->length ? (unsigned char)flatten(&s)[0] : -1;
+}
+
+const tiger_string *tiger_chr(int64_t i)
+{
+  if (i < 0 || i > 255)
+    runtime_error("chr out of range");
+  return character((int)i);
+}
+
+int64_t tiger_size(const tiger_string *s)
+{
+  return s->length;
+}
+
+const tiger_string *tiger_substring(const tiger_string *s, int64_t first, int64_t n)
+{
+  if (first < 0 || n < 0 || first > s->length - n)
+    runtime_error("substring out of range");
+  if (n == s->length)
+    return share(s);
+  if (n == 0)
+    return &empty.string;
+  if (n == 1)
+    return character((unsigned char)flatten(&s)[first]);
+
+  const tiger_string *roots[1] = {s};
+  tiger_gc_push_roots(roots, 1);
+  flatten(&roots[0]);
+  const tiger_string *result;
+  if (n <= SHORT_STRING)
+  {
+    char *bytes;
+    result = allocate(n, &bytes);
+    memcpy(bytes, roots[0]->data + first, n);
+  }
+  else
+  {
+    tiger_rope *slice = new_object(&tiger_rope_type, sizeof(tiger_rope));
+    slice->string.length = n;
+    slice->string.data = roots[0]->data + first;
+    slice->left = share(owner(roots[0]));
+    slice->right = NULL;
+    result = &slice->string;
+  }
+  tiger_gc_pop_roots();
+  return result;
+}
+
+const tiger_string *tiger_concat(const tiger_string *a, const tiger_string *b)
+{
+  if (a->length == 0)
+    return share(b);
+  if (b->length == 0)
+    return share(a);
+  int64_t length = a->length + b->length;
+  const tiger_string *roots[2] = {a, b};
+  tiger_gc_push_roots(roots, 2);
+  const tiger_string *result;
+  if (length > ROPE_STRING)
+  {
+    tiger_rope *r = new_object(&tiger_rope_type, sizeof(tiger_rope));
+    r->string.length = length;
+    r->string.data = NULL;
+    r->left = share(roots[0]);
+    r->right = share(roots[1]);
+    result = &r->string;
+  }
+  else
+  {
+    char *bytes;
+    result = allocate(length, &bytes);
+    copy_bytes(bytes, roots[0]);
+    copy_bytes(bytes + roots[0]->length, roots[1]);
+  }
+  tiger_gc_pop_roots();
+  return result;
+}
+
+// parts is a frame of the caller, where the collector updates the strings.
+const tiger_string *tiger_concat_n(int64_t n, const tiger_string **parts)
+{
+  int64_t length = 0, nonempty = 0;
+  const tiger_string *last = &empty.string;
+  for (int64_t i = 0; i < n; i++)
+    if (parts[i]->length)
+    {
+      length += parts[i]->length;
+      nonempty++;
+      last = parts[i];
+    }
+  if (nonempty <= 1)
+    return share(last);
+
+  tiger_gc_push_roots(parts, n);
+  char *bytes;
+  tiger_string *result = allocate(length, &bytes);
+  for (int64_t i = 0; i < n; i++)
+  {
+    copy_bytes(bytes, parts[i]);
+    bytes += parts[i]->length;
+  }
+  tiger_gc_pop_roots();
+  return result;
+}
+
+int64_t tiger_not(int64_t i)
+{
+  return i == 0;
+}
+
+void tiger_exit(int64_t code)
+{
+  fflush(stdout);
+  exit((int)code);
+}
+
+// flattens both strings, after which reading their bytes allocates nothing.
+static void flatten_both(const tiger_string **a, const tiger_string **b)
+{
+  const tiger_string *roots[2] = {*a, *b};
+  tiger_gc_push_roots(roots, 2);
+  flatten(&roots[0]);
+  flatten(&roots[1]);
+  tiger_gc_pop_roots();
+  *a = roots[0];
+  *b = roots[1];
+}
+
+int64_t tiger_string_compare(const tiger_string *a, const tiger_string *b)
+{
+  if (a == b)
+    return 0;
+  flatten_both(&a, &b);
+  const char *x = a->data, *y = b->data;
+  if (x == y && a->length == b->length)
+    return 0;
+  int64_t common = a->length < b->length ? a->length : b->length;
+  int order = memcmp(x, y, common);
+  if (order != 0)
+    return order < 0 ? -1 : 1;
+  return a->length < b->length ? -1 : a->length > b->length;
+}
+
+int64_t tiger_string_equal(const tiger_string *a, const tiger_string *b)
+{
+  if (a == b)
+    return 1;
+  if (a->length != b->length)
+    return 0;
+  flatten_both(&a, &b);
+  return a->data == b->data || memcmp(a->data, b->data, a->length) == 0;
+}
+
+void tiger_array_initialize(void *array, const void *element, int64_t n, int64_t size)
 {
-  printf("%s", str);
+  for (int64_t i = 0; i < n; i++)
+    memcpy((char *)array + i * size, element, size);
 }
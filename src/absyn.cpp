@@ -1,4 +1,3 @@
-#include <memory>
 #include <regex>
 #include "absyn.h"
 #include "utils.h"
@@ -7,7 +6,7 @@
 using namespace std;
 using namespace absyn;
 
-ID::ID(std::string id, position pos) : id(id), pos(pos) {}
+ID::ID(sym::Symbol id, position pos) : id(id), pos(pos) {}
 
 static string escape(string s)
 {
@@ -193,7 +192,7 @@ void Int::accept(Visitor &v)
     v.visit(*this);
 }
 
-String::String(std::string value, position pos) : Exp::Exp(pos), value(value) {}
+String::String(std::string value, position pos) : Exp::Exp(pos), value(std::move(value)) {}
 
 void String::accept(Visitor &v)
 {
@@ -0,0 +1,35 @@
+#include <cstdint>
+#include "arena.h"
+
+using namespace mem;
+using namespace std;
+
+Arena::Arena(size_t chunkSize) : chunkSize(chunkSize) {}
+
+Arena::~Arena()
+{
+  for (auto iter = destructors.rbegin(); iter != destructors.rend(); ++iter)
+    iter->destroy(iter->object);
+}
+
+void *Arena::allocate(size_t size, size_t align)
+{
+  auto aligned = reinterpret_cast<char *>((reinterpret_cast<uintptr_t>(cursor) + align - 1) & ~(uintptr_t)(align - 1));
+  if (!cursor || aligned + size > limit)
+  {
+    // oversized requests get a chunk of their own.
+    auto capacity = max(chunkSize, size + align);
+    chunks.push_back(make_unique<char[]>(capacity));
+    cursor = chunks.back().get();
+    limit = cursor + capacity;
+    aligned = reinterpret_cast<char *>((reinterpret_cast<uintptr_t>(cursor) + align - 1) & ~(uintptr_t)(align - 1));
+  }
+  cursor = aligned + size;
+  allocated += size;
+  return aligned;
+}
+
+size_t Arena::bytesAllocated() const
+{
+  return allocated;
+}
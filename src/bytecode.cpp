@@ -0,0 +1,532 @@
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include "bytecode.h"
+#include "utils.h"
+
+using namespace bc;
+using namespace absyn;
+using namespace std;
+
+static const uint32_t none = UINT32_MAX;
+
+// evaluating a simple expression never assigns a variable.
+static bool isSimple(const Exp &exp)
+{
+  if (dynamic_cast<const Int *>(&exp) || dynamic_cast<const String *>(&exp) || dynamic_cast<const Nil *>(&exp))
+    return true;
+  auto var = dynamic_cast<const VarExp *>(&exp);
+  return var && dynamic_cast<const SimpleVar *>(var->var);
+}
+
+Compiler::Compiler(const sm::Checker &checker) : checker(checker) {}
+
+std::vector<char> Compiler::compile(absyn::Exp &exp)
+{
+  functions.assign(checker.functions().size(), FunctionInfo{0, 0});
+  compileFunction(checker.mainFunction(), exp);
+  for (auto module : checker.modules())
+    for (auto dec : module->decs)
+      dec->accept(*this);
+  while (!pending.empty())
+  {
+    auto dec = pending.back();
+    pending.pop_back();
+    compileFunction(dec->function, *dec->body);
+  }
+
+  auto align = [](uint64_t offset)
+  { return (offset + 7) & ~uint64_t(7); };
+
+  Header header;
+  header.magic = magic;
+  header.version = version;
+  header.functionCount = functions.size();
+  header.mainFunction = checker.mainFunction()->id;
+  header.functionOffset = align(sizeof(Header));
+  header.codeOffset = align(header.functionOffset + functions.size() * sizeof(FunctionInfo));
+  header.codeWords = code.size();
+  header.stringOffset = align(header.codeOffset + code.size() * sizeof(uint32_t));
+  header.stringBytes = strings.size();
+  header.stringCount = stringIndices.size();
+
+  vector<char> image(header.stringOffset + strings.size());
+  memcpy(image.data(), &header, sizeof(header));
+  memcpy(image.data() + header.functionOffset, functions.data(), functions.size() * sizeof(FunctionInfo));
+  memcpy(image.data() + header.codeOffset, code.data(), code.size() * sizeof(uint32_t));
+  memcpy(image.data() + header.stringOffset, strings.data(), strings.size());
+  return image;
+}
+
+// Registers of a function: parameters, pointers to captured variables, then locals and
+// temporaries allocated in a stack discipline.
+void Compiler::compileFunction(const sm::Function *function, absyn::Exp &body)
+{
+  Frame current;
+  current.function = function;
+  uint32_t next = 0;
+  if (function->dec)
+    for (auto &param : function->dec->parameters)
+      current.registers[param->variable] = next++;
+  current.next = current.size = next + function->captures.size();
+  frame = &current;
+
+  functions[function->id].entry = code.size();
+  if (!function->dec)
+  {
+    emitInto(body, -1);
+    emit(HALT);
+  }
+  else if (function->returnType)
+  {
+    emit(RET, {operand(body)});
+  }
+  else
+  {
+    emitInto(body, -1);
+    emit(RETV);
+  }
+  functions[function->id].frameSize = max(current.size, 1u);
+  frame = nullptr;
+}
+
+void Compiler::emit(Opcode op, std::initializer_list<uint32_t> operands)
+{
+  assert(strlen(operandKinds[op]) == operands.size());
+  code.push_back(op);
+  code.insert(code.end(), operands);
+}
+
+size_t Compiler::emitJump(Opcode op, std::initializer_list<uint32_t> operands)
+{
+  emit(op, operands);
+  return code.size() - 1;
+}
+
+void Compiler::patch(size_t jump)
+{
+  code[jump] = code.size();
+}
+
+void Compiler::patch(const std::vector<size_t> &jumps)
+{
+  for (auto jump : jumps)
+    patch(jump);
+}
+
+uint32_t Compiler::allocate(uint32_t count)
+{
+  auto reg = frame->next;
+  frame->next += count;
+  frame->size = max(frame->size, frame->next);
+  return reg;
+}
+
+uint32_t Compiler::destination()
+{
+  return target >= 0 ? target : allocate();
+}
+
+uint32_t Compiler::stringIndex(const std::string &value)
+{
+  auto found = stringIndices.find(value);
+  if (found != stringIndices.end())
+    return found->second;
+  uint32_t index = stringIndices.size();
+  uint64_t length = value.size();
+  strings.append(reinterpret_cast<const char *>(&length), sizeof(length));
+  strings.append(value);
+  strings.resize((strings.size() + 7) & ~size_t(7), '\0');
+  stringIndices.insert({value, index});
+  return index;
+}
+
+uint32_t Compiler::localRegister(const absyn::Exp &exp) const
+{
+  auto var = dynamic_cast<const VarExp *>(&exp);
+  if (!var)
+    return none;
+  auto simple = dynamic_cast<const SimpleVar *>(var->var);
+  if (!simple || simple->variable->owner != frame->function)
+    return none;
+  return frame->registers.at(simple->variable);
+}
+
+uint32_t Compiler::pointerRegister(const sm::Variable *variable) const
+{
+  return frame->function->args.size() + frame->function->captureIndex(variable);
+}
+
+void Compiler::emitInto(absyn::Exp &exp, int64_t reg)
+{
+  auto saved = target;
+  target = reg;
+  exp.accept(*this);
+  target = saved;
+}
+
+void Compiler::emitInto(absyn::Var &var, int64_t reg)
+{
+  auto saved = target;
+  target = reg;
+  var.accept(*this);
+  target = saved;
+}
+
+// a register holding the value of exp.
+uint32_t Compiler::operand(absyn::Exp &exp)
+{
+  auto reg = localRegister(exp);
+  if (reg != none)
+    return reg;
+  reg = allocate();
+  emitInto(exp, reg);
+  return reg;
+}
+
+// a register holding the value of exp that later evaluating another expression cannot
+// change, which means a copy unless that expression is simple.
+uint32_t Compiler::operandBefore(absyn::Exp &exp, const absyn::Exp &later)
+{
+  if (isSimple(later))
+    return operand(exp);
+  auto reg = allocate();
+  emitInto(exp, reg);
+  return reg;
+}
+
+void Compiler::branchIfFalse(absyn::Exp &condition, std::vector<size_t> &jumps)
+{
+  auto bin = dynamic_cast<BinOp *>(&condition);
+  if (bin && isRelOp(bin->op) && !ty::isA(bin->lhs->type, ty::Kind::String))
+  {
+    auto var = dynamic_cast<VarExp *>(bin->lhs);
+    auto subscript = var ? dynamic_cast<SubscriptVar *>(var->var) : nullptr;
+    if (subscript && (bin->op == Oper::eqOp || bin->op == Oper::neqOp))
+    {
+      auto array = allocate();
+      emitInto(*subscript->var, array);
+      auto index = operandBefore(*subscript->subscript, *bin->rhs);
+      auto value = operand(*bin->rhs);
+      jumps.push_back(emitJump(bin->op == Oper::eqOp ? JFEQX : JFNEX, {array, index, value, 0}));
+      return;
+    }
+
+    auto lhs = operandBefore(*bin->lhs, *bin->rhs);
+    auto rhs = operand(*bin->rhs);
+    static const map<Oper, Opcode> jumpIfFalse = {
+        {Oper::eqOp, JFEQ}, {Oper::neqOp, JFNE}, {Oper::ltOp, JFLT}, {Oper::leOp, JFLE}, {Oper::gtOp, JFGT}, {Oper::geOp, JFGE}};
+    jumps.push_back(emitJump(jumpIfFalse.at(bin->op), {lhs, rhs, 0}));
+    return;
+  }
+
+  // a & b is parsed as if a then b else 0.
+  auto iff = dynamic_cast<If *>(&condition);
+  auto zero = iff && iff->els ? dynamic_cast<Int *>(iff->els) : nullptr;
+  if (zero && zero->value == 0)
+  {
+    branchIfFalse(*iff->condition, jumps);
+    branchIfFalse(*iff->then, jumps);
+    return;
+  }
+
+  jumps.push_back(emitJump(JZ, {operand(condition), 0}));
+}
+
+void Compiler::visit(Nil &n)
+{
+  emit(LOADI, {destination(), 0});
+}
+
+void Compiler::visit(Int &i)
+{
+  emit(LOADI, {destination(), static_cast<uint32_t>(i.value)});
+}
+
+void Compiler::visit(String &s)
+{
+  emit(LOADS, {destination(), stringIndex(s.value)});
+}
+
+void Compiler::visit(VarExp &var)
+{
+  var.var->accept(*this);
+}
+
+void Compiler::visit(Assign &assign)
+{
+  auto value = assign.exp;
+  if (auto simple = dynamic_cast<SimpleVar *>(assign.var))
+  {
+    auto variable = simple->variable;
+    if (variable->owner == frame->function)
+      emitInto(*value, frame->registers.at(variable));
+    else
+      emit(STOREP, {pointerRegister(variable), operand(*value)});
+  }
+  else if (auto field = dynamic_cast<FieldVar *>(assign.var))
+  {
+    auto record = allocate();
+    emitInto(*field->var, record);
+    emit(STOREF, {record, static_cast<uint32_t>(field->index), operand(*value)});
+  }
+  else if (auto subscript = dynamic_cast<SubscriptVar *>(assign.var))
+  {
+    auto array = allocate();
+    emitInto(*subscript->var, array);
+    auto index = allocate();
+    emitInto(*subscript->subscript, index);
+    emit(STOREX, {array, index, operand(*value)});
+  }
+}
+
+void Compiler::visit(Seq &seq)
+{
+  if (seq.seq.empty())
+  {
+    if (target >= 0)
+      emit(LOADI, {destination(), 0});
+    return;
+  }
+
+  for (auto iter = seq.seq.begin(); iter != seq.seq.end() - 1; ++iter)
+  {
+    auto mark = frame->next;
+    emitInto(**iter, -1);
+    frame->next = mark;
+  }
+  seq.seq.back()->accept(*this);
+}
+
+// loads a value folded at compile time, false when it does not fit an immediate.
+bool Compiler::emitConstant(const sm::Constant &value)
+{
+  if (auto s = get_if<string>(&value))
+  {
+    emit(LOADS, {destination(), stringIndex(*s)});
+    return true;
+  }
+  auto i = get<int64_t>(value);
+  if (i < INT32_MIN || i > INT32_MAX)
+    return false;
+  emit(LOADI, {destination(), static_cast<uint32_t>(i)});
+  return true;
+}
+
+void Compiler::visit(Call &call)
+{
+  auto function = call.function;
+  if (function->isBuiltin())
+    if (auto folded = sm::fold(call); folded && emitConstant(*folded))
+      return;
+  auto dst = destination();
+  auto base = allocate(max<size_t>(call.args.size() + function->captures.size(), 1));
+
+  auto reg = base;
+  for (auto &arg : call.args)
+    emitInto(*arg, reg++);
+  for (auto captured : function->captures)
+  {
+    if (captured->owner == frame->function)
+      emit(ADDR, {reg++, frame->registers.at(captured)});
+    else
+      emit(MOVE, {reg++, pointerRegister(captured)});
+  }
+
+  if (function->isBuiltin())
+  {
+    auto builtin = find_if(begin(builtinNames), end(builtinNames), [&](const char *name)
+                           { return function->name == name; });
+    emit(CALLB, {static_cast<uint32_t>(builtin - begin(builtinNames)), base, dst});
+  }
+  else
+  {
+    emit(CALL, {static_cast<uint32_t>(function->id), base, dst});
+  }
+}
+
+void Compiler::visit(BinOp &bin)
+{
+  if (auto folded = sm::fold(bin); folded && emitConstant(*folded))
+    return;
+  if (isArithOp(bin.op))
+  {
+    auto imm = dynamic_cast<Int *>(bin.rhs);
+    if (imm && (bin.op == Oper::plusOp || bin.op == Oper::minusOp))
+    {
+      auto lhs = operand(*bin.lhs);
+      auto value = bin.op == Oper::plusOp ? imm->value : -imm->value;
+      emit(ADDI, {destination(), lhs, static_cast<uint32_t>(value)});
+      return;
+    }
+  }
+
+  auto lhs = operandBefore(*bin.lhs, *bin.rhs);
+  auto rhs = operand(*bin.rhs);
+
+  if (isRelOp(bin.op) && ty::isA(bin.lhs->type, ty::Kind::String))
+  {
+    auto compared = allocate();
+    emit(SCMP, {compared, lhs, rhs});
+    lhs = compared;
+    rhs = allocate();
+    emit(LOADI, {rhs, 0});
+  }
+
+  static const map<Oper, Opcode> opcodes = {
+      {Oper::plusOp, ADD}, {Oper::minusOp, SUB}, {Oper::timesOp, MUL}, {Oper::divideOp, DIV},
+      {Oper::eqOp, EQ}, {Oper::neqOp, NE}, {Oper::ltOp, LT}, {Oper::leOp, LE}, {Oper::gtOp, GT}, {Oper::geOp, GE}};
+  emit(opcodes.at(bin.op), {destination(), lhs, rhs});
+}
+
+void Compiler::visit(RecordExp &record)
+{
+  auto record_ty = ty::asRecord(record.type);
+  auto fields = allocate();
+  emit(NEWREC, {fields, static_cast<uint32_t>(record_ty->fields.size())});
+  for (auto &rcd : record.records)
+    emit(STOREF, {fields, static_cast<uint32_t>(rcd->index), operand(*rcd->value)});
+  emit(MOVE, {destination(), fields});
+}
+
+void Compiler::visit(Array &array)
+{
+  auto size = allocate();
+  emitInto(*array.capacity, size);
+  auto init = operand(*array.element);
+  emit(NEWARR, {destination(), size, init});
+}
+
+void Compiler::visit(If &iff)
+{
+  vector<size_t> elseJumps;
+  branchIfFalse(*iff.condition, elseJumps);
+  if (!iff.els)
+  {
+    emitInto(*iff.then, -1);
+    patch(elseJumps);
+    return;
+  }
+
+  emitInto(*iff.then, target);
+  auto endJump = emitJump(JMP, {0});
+  patch(elseJumps);
+  emitInto(*iff.els, target);
+  patch(endJump);
+}
+
+void Compiler::visit(While &whil)
+{
+  auto mark = frame->next;
+  uint32_t top = code.size();
+  vector<size_t> exits;
+  branchIfFalse(*whil.condition, exits);
+  frame->breaks.emplace_back();
+  emitInto(*whil.body, -1);
+  emit(JMP, {top});
+  patch(exits);
+  patch(frame->breaks.back());
+  frame->breaks.pop_back();
+  frame->next = mark;
+}
+
+void Compiler::visit(For &forr)
+{
+  auto mark = frame->next;
+  auto counter = allocate();
+  frame->registers[forr.variable] = counter;
+  emitInto(*forr.from, counter);
+  auto limit = allocate();
+  emitInto(*forr.to, limit);
+
+  auto skip = emitJump(JFLE, {counter, limit, 0});
+  uint32_t body = code.size();
+  frame->breaks.emplace_back();
+  emitInto(*forr.body, -1);
+  emit(FORLOOP, {counter, limit, body});
+  patch(skip);
+  patch(frame->breaks.back());
+  frame->breaks.pop_back();
+  frame->next = mark;
+}
+
+void Compiler::visit(Break &brk)
+{
+  frame->breaks.back().push_back(emitJump(JMP, {0}));
+}
+
+void Compiler::visit(Let &let)
+{
+  auto mark = frame->next;
+  for (auto &dec : let.decs)
+    dec->accept(*this);
+  let.body->accept(*this);
+  frame->next = mark;
+}
+
+void Compiler::visit(SimpleVar &var)
+{
+  auto variable = var.variable;
+  if (variable->owner != frame->function)
+  {
+    emit(LOADP, {destination(), pointerRegister(variable)});
+    return;
+  }
+
+  auto reg = frame->registers.at(variable);
+  auto dst = destination();
+  if (dst != reg)
+    emit(MOVE, {dst, reg});
+}
+
+void Compiler::visit(FieldVar &field)
+{
+  auto record = allocate();
+  emitInto(*field.var, record);
+  emit(LOADF, {destination(), record, static_cast<uint32_t>(field.index)});
+}
+
+void Compiler::visit(SubscriptVar &subscript)
+{
+  auto array = allocate();
+  emitInto(*subscript.var, array);
+  auto index = operand(*subscript.subscript);
+  emit(LOADX, {destination(), array, index});
+}
+
+void Compiler::visit(ID &id) {}
+
+void Compiler::visit(Record &record) {}
+
+void Compiler::visit(Field &field) {}
+
+void Compiler::visit(NamedType &named) {}
+
+void Compiler::visit(ArrayType &arrayType) {}
+
+void Compiler::visit(RecordType &recordType) {}
+
+void Compiler::visit(TypeDec &typeDec) {}
+
+void Compiler::visit(VarDec &varDec)
+{
+  auto reg = allocate();
+  emitInto(*varDec.exp, reg);
+  frame->registers[varDec.variable] = reg;
+}
+
+void Compiler::visit(FunctionDec &funcDec)
+{
+  pending.push_back(&funcDec);
+}
+
+void bc::write(const std::vector<char> &image, const std::string &filename)
+{
+  ofstream out(filename, ios::binary);
+  if (!out.write(image.data(), image.size()))
+  {
+    throw utils::CompileError("could not write file " + filename);
+  }
+}
@@ -0,0 +1,171 @@
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <llvm/ADT/SmallString.h>
+#include <llvm/ADT/StringExtras.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/Path.h>
+#include <llvm/Support/Process.h>
+#include <llvm/Support/SHA256.h>
+#include "cache.h"
+
+using namespace cache;
+using namespace llvm;
+using namespace std;
+
+std::string cache::key(const std::string &source, const std::vector<std::string> &configuration)
+{
+  SHA256 hasher;
+  // terminators keep adjacent strings from running into each other.
+  for (auto &part : configuration)
+    hasher.update(StringRef(part.c_str(), part.size() + 1));
+  hasher.update(source);
+  return toHex(hasher.final(), true);
+}
+
+// The lock file serializes processes, the mutex the threads of this one, which share
+// the lock of their process.
+template <typename F>
+static void locked(const std::string &directory, mutex &guard, F f)
+{
+  lock_guard<mutex> held(guard);
+  int fd;
+  if (sys::fs::openFileForReadWrite(directory + "/lock", fd, sys::fs::CD_OpenAlways, sys::fs::OF_None))
+    return;
+  if (!sys::fs::lockFile(fd))
+  {
+    f();
+    sys::fs::unlockFile(fd);
+  }
+  sys::Process::SafelyCloseFileDescriptor(fd);
+}
+
+static bool isEntry(StringRef name)
+{
+  return name.size() == 64 && llvm::all_of(name, isHexDigit);
+}
+
+Store::Store(std::string directory, uint64_t capacity) : directory(directory), capacity(capacity)
+{
+  sys::fs::create_directories(directory);
+}
+
+std::string Store::entryPath(const std::string &key) const
+{
+  return directory + "/" + key;
+}
+
+bool Store::fetch(const std::string &key, const std::string &output)
+{
+  // the output may still be a hard link to an entry from an earlier hit, which a
+  // compiler writing it in place would corrupt.
+  sys::fs::remove(output);
+
+  auto entry = entryPath(key);
+  if (sys::fs::create_hard_link(entry, output) && sys::fs::copy_file(entry, output))
+  {
+    locked(directory, guard, [&]()
+           { record(0, 1, 0); });
+    return false;
+  }
+
+  int fd;
+  if (!sys::fs::openFileForWrite(entry, fd, sys::fs::CD_OpenExisting, sys::fs::OF_Append))
+  {
+    sys::fs::setLastAccessAndModificationTime(fd, chrono::system_clock::now());
+    sys::Process::SafelyCloseFileDescriptor(fd);
+  }
+  locked(directory, guard, [&]()
+         { record(1, 0, 0); });
+  return true;
+}
+
+// Entries are copied in under a temporary name and renamed into place, so a concurrent
+// fetch never sees a partial entry.
+void Store::insert(const std::string &key, const std::string &output)
+{
+  int fd;
+  SmallString<128> temp;
+  if (sys::fs::createUniqueFile(directory + "/tmp-%%%%%%%%", fd, temp))
+    return;
+  sys::Process::SafelyCloseFileDescriptor(fd);
+
+  if (sys::fs::copy_file(output, temp) || sys::fs::rename(temp, entryPath(key)))
+  {
+    sys::fs::remove(temp);
+    return;
+  }
+
+  locked(directory, guard, [&]()
+         { record(0, 0, evict()); });
+}
+
+// Expects the lock to be held, as does evict.
+void Store::record(uint64_t hits, uint64_t misses, uint64_t evictions)
+{
+  Stats stats;
+  ifstream in(directory + "/stats");
+  in >> stats.hits >> stats.misses >> stats.evictions;
+  in.close();
+  ofstream out(directory + "/stats", ios::trunc);
+  out << stats.hits + hits << " " << stats.misses + misses << " " << stats.evictions + evictions << "\n";
+}
+
+uint64_t Store::evict()
+{
+  struct Entry
+  {
+    std::string path;
+    uint64_t size;
+    sys::TimePoint<> used;
+  };
+
+  vector<Entry> entries;
+  uint64_t total = 0;
+  error_code error;
+  for (sys::fs::directory_iterator iter(directory, error), end; iter != end && !error; iter.increment(error))
+  {
+    sys::fs::file_status status;
+    if (!isEntry(sys::path::filename(iter->path())) || sys::fs::status(iter->path(), status))
+      continue;
+    entries.push_back({iter->path(), status.getSize(), status.getLastModificationTime()});
+    total += status.getSize();
+  }
+  if (total <= capacity)
+    return 0;
+
+  std::sort(entries.begin(), entries.end(), [](const Entry &lhs, const Entry &rhs)
+       { return lhs.used < rhs.used; });
+  uint64_t evicted = 0;
+  for (auto &entry : entries)
+  {
+    if (total <= capacity)
+      break;
+    if (!sys::fs::remove(entry.path))
+    {
+      total -= entry.size;
+      evicted++;
+    }
+  }
+  return evicted;
+}
+
+Stats Store::stats()
+{
+  Stats stats;
+  locked(directory, guard, [&]()
+         {
+           ifstream in(directory + "/stats");
+           in >> stats.hits >> stats.misses >> stats.evictions;
+
+           error_code error;
+           for (sys::fs::directory_iterator iter(directory, error), end; iter != end && !error; iter.increment(error))
+           {
+             sys::fs::file_status status;
+             if (!isEntry(sys::path::filename(iter->path())) || sys::fs::status(iter->path(), status))
+               continue;
+             stats.entries++;
+             stats.bytes += status.getSize();
+           } });
+  return stats;
+}
@@ -2,191 +2,307 @@
 #include <llvm/IR/Function.h>
 #include <llvm/IR/BasicBlock.h>
 #include <llvm/IR/Type.h>
-#include <llvm/Pass.h>
-#include <llvm/Analysis/LoopAnalysisManager.h>
-#include <llvm/Transforms/Utils.h>
+#include <llvm/IR/Verifier.h>
+#include <llvm/IR/BuiltinGCs.h>
+#include <llvm/IR/Intrinsics.h>
+#include <llvm/IR/LegacyPassManager.h>
+#include <llvm/Analysis/ModuleSummaryAnalysis.h>
+#include <llvm/Analysis/ProfileSummaryInfo.h>
+#include <llvm/Bitcode/BitcodeReader.h>
+#include <llvm/Bitcode/BitcodeWriter.h>
+#include <llvm/Linker/Linker.h>
+#include <llvm/LTO/LTO.h>
+#include <llvm/LTO/LTOBackend.h>
+#include <llvm/Passes/PassBuilder.h>
+#include <llvm/Passes/OptimizationLevel.h>
 #include <llvm/Support/TargetSelect.h>
 #include <llvm/Target/TargetMachine.h>
 #include <llvm/Target/TargetOptions.h>
 #include <llvm/TargetParser/Host.h>
+#include <llvm/TargetParser/Triple.h>
 #include <llvm/MC/TargetRegistry.h>
+#include <llvm/TargetParser/SubtargetFeature.h>
 #include <llvm/Support/raw_ostream.h>
 #include <llvm/Support/FileSystem.h>
 #include <llvm/Support/CodeGen.h>
+#include <llvm/Support/Caching.h>
+#include <llvm/Support/Process.h>
+#include <llvm/Support/Program.h>
+#include <llvm/Support/ThreadPool.h>
+#include <llvm/Transforms/Utils/Cloning.h>
+#include <llvm/Transforms/Utils/SplitModule.h>
+#include <exception>
 #include <memory>
-#include <sstream>
-#include <map>
-#include <set>
+#include <mutex>
 #include <algorithm>
 #include "codegen.h"
+#include "fingerprint.h"
 #include "absyn.h"
 #include "types.h"
-#define _String std::make_shared<ty::String>()
-#define _Int std::make_shared<ty::Int>()
-#define _Void std::make_shared<ty::Void>()
-#define _Func(n, rt, ...) std::make_shared<cg::FuncEnventry>(n, rt, std::vector<std::shared_ptr<ty::Type>>{__VA_ARGS__})
+#include "runtime.h"
+#include "region.h"
+#include "ownership.h"
+#include "utils.h"
 
 using namespace cg;
 using namespace llvm;
 using namespace absyn;
 using namespace std;
 
-TyValue::TyValue(std::shared_ptr<ty::Type> type, llvm::Value *value) : type(type), value(value) {}
+#ifdef KALEC_RUNTIME_BITCODE
+// lib/runtime.c compiled to bitcode, embedded by the build.
+extern const unsigned char tigerRuntimeBitcode[];
+extern const size_t tigerRuntimeBitcodeSize;
+#endif
 
-CodeGenerator::CodeGenerator()
-    : AbstractCodeGenerator::AbstractCodeGenerator(), namedValues(), namedTypes(), breaks(), libraryFunctionCreator()
+TyValue::TyValue(const ty::Type *type, llvm::Value *value) : type(type), value(value) {}
+
+CodeGenerator::CodeGenerator(const sm::Checker &checker, CompileOptions options)
+    : AbstractCodeGenerator::AbstractCodeGenerator(), options(options), checker(checker), breaks()
 {
   context = make_unique<LLVMContext>();
   builder = make_unique<IRBuilder<>>(*context);
   moduler = make_unique<Module>("main module", *context);
-  functionPassManager = make_unique<legacy::FunctionPassManager>(moduler.get());
-  functionPassManager->add(createPromoteMemoryToRegisterPass());
-  functionAnalysisManager = make_unique<FunctionAnalysisManager>();
-
-  auto mainFuncType = FunctionType::get(llvm::Type::getVoidTy(*context), false);
-  auto mainFunc = Function::Create(mainFuncType, GlobalValue::LinkageTypes::ExternalLinkage, "main", this->moduler.get());
-  auto entry = BasicBlock::Create(*context, "entry", mainFunc);
+  functions.resize(checker.functions().size(), nullptr);
+  recordLayouts.resize(checker.typeContext().size(), nullptr);
+  typeDescriptors.resize(checker.typeContext().size(), nullptr);
+  if (options.gc)
+    linkAllBuiltinGCs();
+
+  auto main = checker.mainFunction();
+  auto entry = BasicBlock::Create(*context, "entry", function(main));
   builder->SetInsertPoint(entry);
-
-  namedTypes.insert("int", make_shared<ty::Int>());
-  namedTypes.insert("string", make_shared<ty::String>());
-  namedTypes.insert("nil", make_shared<ty::Nil>());
-  namedTypes.insert("void", make_shared<ty::Void>());
-
-  InitializeAllTargetInfos();
-  InitializeAllTargets();
-  InitializeAllTargetMCs();
-  InitializeAllAsmParsers();
-  InitializeAllAsmPrinters();
-
-  namedValues.insert("print", _Func("print", _Void, _String));
-  namedValues.insert("flush", _Func("flush", _Void));
-  namedValues.insert("getchar", _Func("getchar", _String));
-  namedValues.insert("ord", _Func("ord", _Int, _String));
-  namedValues.insert("chr", _Func("chr", _String, _Int));
-  namedValues.insert("size", _Func("size", _Int, _String));
-  namedValues.insert("substring", _Func("substring", _String, _String, _Int, _Int));
-  namedValues.insert("concat", _Func("concat", _String, _String, _String));
-  namedValues.insert("not", _Func("not", _Int, _Int));
-  namedValues.insert("exit", _Func("exit", _Void, _Int));
-  namedValues.insert("string_compare", _Func("string_compare", _Int, _String, _String));
-
-  for (auto iter = namedValues.top_begin(); iter != namedValues.top_end(); iter++)
-  {
-    auto f_enventry = dynamic_cast<FuncEnventry *>(iter->second.get());
-    registeLibraryFunction(f_enventry->name, [this, f_enventry]()
-                           { return createFunction(*f_enventry); });
-  }
-
-  registeLibraryFunction(
-      "malloc",
-      [this]()
-      { return Function::Create(
-            FunctionType::get(builder->getPtrTy(), {builder->getInt64Ty()}, false),
-            Function::ExternalLinkage, "malloc", moduler.get()); });
-
-  registeLibraryFunction(
-      "array_initialize",
-      [this]()
-      {
-        return Function::Create(
-            FunctionType::get(
-                builder->getVoidTy(),
-                {builder->getPtrTy(), builder->getPtrTy(), builder->getInt64Ty(), builder->getInt64Ty()},
-                false),
-            Function::ExternalLinkage, "array_initialize", moduler.get());
-      });
+  frames.push_back({main, vector<llvm::Value *>(main->frameSize), {}});
 }
 
-void CodeGenerator::registeLibraryFunction(std::string name, std::function<llvm::Function *()> factory)
+// Only the target a compilation is for is initialized, on first use and once per process.
+// kalec links the native target alone unless it is built with KALEC_ALL_TARGETS.
+static const Target &lookupTarget(const std::string &triple)
 {
-  libraryFunctionCreator.insert({name, factory});
-}
-
-llvm::Function *CodeGenerator::requestFunction(std::string funcname)
-{
-  auto func = moduler->getFunction(funcname);
-  if (!func)
+  static std::once_flag native;
+  if (Triple(triple).getArch() == Triple(sys::getProcessTriple()).getArch())
   {
-    auto found = libraryFunctionCreator.find(funcname);
-    if (found != libraryFunctionCreator.end())
-    {
-      func = found->second();
-      libraryFunctionCreator.erase(funcname);
-    }
+    std::call_once(native, []()
+                   {
+                     InitializeNativeTarget();
+                     InitializeNativeTargetAsmPrinter();
+                     InitializeNativeTargetAsmParser(); });
+  }
+  else
+  {
+#ifdef KALEC_ALL_TARGETS
+    static std::once_flag all;
+    std::call_once(all, []()
+                   {
+                     InitializeAllTargetInfos();
+                     InitializeAllTargets();
+                     InitializeAllTargetMCs();
+                     InitializeAllAsmParsers();
+                     InitializeAllAsmPrinters(); });
+#endif
   }
 
-  return func;
-}
-
-static const ty::Type *actualTy(const ty::Type *ty_ptr)
-{
-  auto curr = ty_ptr;
-  while (auto named = dynamic_cast<const ty::Named *>(curr))
+  string error;
+  auto target = TargetRegistry::lookupTarget(triple, error);
+  if (!target)
   {
-    if (named->type == ty_ptr)
-      return ty_ptr;
-    else
-      curr = named->type;
+    throw utils::CompileError(error);
   }
-  return curr;
+  return *target;
 }
 
-namespace ty
+// Functions of the program are internal, builtins, main and the functions of library
+// modules are resolved by the linker.
+llvm::Function *CodeGenerator::function(const sm::Function *function)
 {
-  bool match(const ty::Type &lhs, const ty::Type &rhs)
-  {
-    auto ac_lhs = actualTy(&lhs);
-    auto ac_rhs = actualTy(&rhs);
-    if (dynamic_cast<const ty::Record *>(&lhs))
-    {
-      return ac_rhs->match(*ac_lhs) || ac_rhs->match(ty::Nil());
-    }
-    else
-    {
-      return ac_lhs->match(*ac_rhs);
-    }
-  }
+  auto &func = functions[function->id];
+  if (func)
+    return func;
+
+  vector<llvm::Type *> paramTypes;
+  for (auto ty : function->args)
+    paramTypes.push_back(type2IRType(ty));
+  paramTypes.insert(paramTypes.end(), function->captures.size(), builder->getPtrTy());
+
+  llvm::Type *returnType = builder->getVoidTy();
+  if (function->returnType)
+    returnType = type2IRType(function->returnType);
 
-  bool mismatch(const ty::Type &lhs, const ty::Type &rhs)
+  auto funcType = FunctionType::get(returnType, paramTypes, false);
+  auto linkage = function->dec && !function->exported ? Function::InternalLinkage : Function::ExternalLinkage;
+  func = Function::Create(funcType, linkage, function->name, moduler.get());
+  if (options.gc && !function->isBuiltin())
+    func->setGC("shadow-stack");
+
+  if (function->dec)
   {
-    return !match(lhs, rhs);
+    auto arg_iter = func->arg_begin();
+    for (auto param : function->dec->parameters)
+      (arg_iter++)->setName(param->name->id.name());
+    for (auto captured : function->captures)
+      (arg_iter++)->setName(captured->name.name() + ".addr");
   }
+  return func;
+}
+
+llvm::Function *CodeGenerator::runtimeFunction(llvm::Function *&cached, const char *name, llvm::FunctionType *type)
+{
+  if (!cached)
+    cached = Function::Create(type, Function::ExternalLinkage, name, moduler.get());
+  return cached;
 }
 
 TyValue CodeGenerator::visit(Nil &n)
 {
   auto value = ConstantPointerNull::get(builder->getPtrTy());
-  return TyValue(make_shared<ty::Nil>(), value);
+  return TyValue(n.type, value);
 }
 
 TyValue CodeGenerator::visit(Int &i)
 {
   auto value = builder->getInt64(i.value);
-  return TyValue(make_shared<ty::Int>(), value);
+  return TyValue(i.type, value);
+}
+
+// A literal is a constant tiger_string whose bytes follow its header, as the runtime
+// lays out strings it builds, so using one costs no call and no allocation. Under
+// reference counting it comes after the header of a counted string that is never freed.
+Constant *CodeGenerator::stringLiteral(const std::string &value)
+{
+  auto &literal = stringLiterals[value];
+  if (literal)
+    return literal;
+  auto bytes = ConstantDataArray::getString(*context, value, false);
+  vector<llvm::Type *> fields{builder->getInt64Ty(), builder->getPtrTy(), bytes->getType()};
+  if (options.rc)
+    fields.insert(fields.begin(), {builder->getPtrTy(), builder->getInt64Ty(), builder->getInt64Ty()});
+  auto type = StructType::get(*context, fields);
+  auto global = new GlobalVariable(*moduler, type, true, GlobalValue::PrivateLinkage, nullptr, "str");
+  global->setUnnamedAddr(GlobalValue::UnnamedAddr::Global);
+  global->setAlignment(Align(8));
+  auto stringIndex = options.rc ? 3 : 0;
+  auto data = ConstantExpr::getInBoundsGetElementPtr(
+      type, global, ArrayRef<Constant *>{builder->getInt32(0), builder->getInt32(stringIndex + 2)});
+  vector<Constant *> init{builder->getInt64(value.size()), data, bytes};
+  if (options.rc)
+  {
+    auto stringType = moduler->getOrInsertGlobal("tiger_string_type", builder->getInt8Ty());
+    init.insert(init.begin(), {stringType, builder->getInt64(TIGER_RC_IMMORTAL),
+                               builder->getInt64(sizeof(tiger_string) + value.size())});
+  }
+  global->setInitializer(ConstantStruct::get(type, init));
+  literal = global;
+  if (stringIndex)
+    literal = ConstantExpr::getInBoundsGetElementPtr(
+        type, global, ArrayRef<Constant *>{builder->getInt32(0), builder->getInt32(stringIndex)});
+  return literal;
 }
 
 TyValue CodeGenerator::visit(String &s)
 {
-  auto value = builder->CreateGlobalStringPtr(StringRef(s.value));
-  return TyValue(make_shared<ty::String>(), value);
+  return TyValue(s.type, stringLiteral(s.value));
 }
 
 TyValue CodeGenerator::visit(VarExp &var)
 {
   auto v = var.var->accept(*this);
-  return TyValue(v.type, builder->CreateLoad(type2IRType(v.type.get()), v.value));
+  auto value = builder->CreateLoad(type2IRType(var.type), v.value);
+  if (counted(var.type))
+  {
+    // a value is handed on with a reference of its own. The last use of a variable moves
+    // its reference, and so does the read of a field of a unique record being reused.
+    auto field = dynamic_cast<FieldVar *>(var.var);
+    auto null = ConstantPointerNull::get(builder->getPtrTy());
+    if (var.move)
+      builder->CreateStore(null, v.value);
+    else if (field && field->move)
+      dup(builder->CreateSelect(reusing[static_cast<SimpleVar *>(field->var)->variable], null, value));
+    else
+      dup(value);
+  }
+  return TyValue(var.type, value);
 }
 
-TyValue CodeGenerator::visit(Assign &assign)
+// Whether evaluating an expression may allocate, and so run the collector, which moves
+// objects. It also may call functions then, which drop references under reference
+// counting.
+static bool mayCollect(const Exp &exp);
+
+static bool mayCollect(const Var &var)
 {
-  auto var = assign.var->accept(*this);
-  auto exp = assign.exp->accept(*this);
+  if (auto field = dynamic_cast<const FieldVar *>(&var))
+    return mayCollect(*field->var);
+  if (auto subscript = dynamic_cast<const SubscriptVar *>(&var))
+    return mayCollect(*subscript->var) || mayCollect(*subscript->subscript);
+  return false;
+}
 
-  if (!match(*var.type, *exp.type))
-    fatalError("unmatched type assignment", assign.exp->pos);
+static bool mayCollect(const Exp &exp)
+{
+  if (dynamic_cast<const Int *>(&exp) || dynamic_cast<const String *>(&exp) || dynamic_cast<const Nil *>(&exp))
+    return false;
+  if (auto var = dynamic_cast<const VarExp *>(&exp))
+    return mayCollect(*var->var);
+  if (sm::fold(exp))
+    return false;
+  // comparing strings flattens ropes.
+  auto bin = dynamic_cast<const BinOp *>(&exp);
+  if (bin && !ty::isA(bin->lhs->type, ty::Kind::String))
+    return mayCollect(*bin->lhs) || mayCollect(*bin->rhs);
+  return true;
+}
 
-  builder->CreateStore(exp.value, var.value);
+TyValue CodeGenerator::visit(Assign &assign)
+{
+  auto counts = counted(assign.var->type);
+  if ((!options.gc && !options.rc) || dynamic_cast<SimpleVar *>(assign.var))
+  {
+    auto var = assign.var->accept(*this);
+    auto exp = assign.exp->accept(*this);
+    auto old = counts ? builder->CreateLoad(builder->getPtrTy(), var.value) : nullptr;
+    builder->CreateStore(exp.value, var.value);
+    if (old)
+      drop(old);
+    return mkVoid();
+  }
+
+  // a field or an element is stored through its object, which is held while the value
+  // is computed, and the store is told to the collector. Under reference counting the
+  // object keeps a reference of its own meanwhile, and the old value is dropped.
+  auto field = dynamic_cast<FieldVar *>(assign.var);
+  auto subscript = dynamic_cast<SubscriptVar *>(assign.var);
+  Held object;
+  Value *index = nullptr;
+  bool collects;
+  if (field)
+  {
+    collects = mayCollect(*assign.exp);
+    object = hold(TyValue(field->var->type, objectOf(*field->var)), collects);
+  }
+  else
+  {
+    collects = mayCollect(*subscript->subscript) || mayCollect(*assign.exp);
+    object = hold(TyValue(subscript->var->type, objectOf(*subscript->var)), collects);
+  }
+  auto keep = options.rc && collects;
+  if (keep)
+    dup(object.value);
+  if (subscript)
+    index = subscript->subscript->accept(*this).value;
+  auto exp = assign.exp->accept(*this);
+  auto base = release(object);
+  Value *address;
+  if (field)
+    address = builder->CreateStructGEP(recordLayout(ty::asRecord(field->var->type)), base, field->index);
+  else
+    address = builder->CreateInBoundsGEP(type2IRType(subscript->type), base, {index});
+  auto old = counts ? builder->CreateLoad(builder->getPtrTy(), address) : nullptr;
+  builder->CreateStore(exp.value, address);
+  writeBarrier(base, exp);
+  if (old)
+    drop(old);
+  if (keep)
+    drop(base);
   return mkVoid();
 }
 
@@ -197,50 +313,113 @@ TyValue CodeGenerator::visit(Seq &seq)
     auto tyValue = (*iter)->accept(*this);
     if (iter == seq.seq.end() - 1)
       return tyValue;
+    if (counted((*iter)->type))
+      drop(tyValue.value);
   }
   return mkVoid();
 }
 
-TyValue CodeGenerator::visit(Call &call)
+TyValue CodeGenerator::constant(const ty::Type *type, const sm::Constant &value)
 {
-  auto found = namedValues.find(call.func->id);
-  if (!found)
-    fatalError("function " + call.func->id + " not found", call.func->pos);
-
-  auto f_enventry = dynamic_cast<FuncEnventry *>(found->get());
-  if (!f_enventry)
-    fatalError(call.func->id + " is not a function", call.func->pos);
+  if (auto i = get_if<int64_t>(&value))
+    return TyValue(type, builder->getInt64(*i));
+  return TyValue(type, stringLiteral(get<string>(value)));
+}
 
-  auto func = requestFunction(f_enventry->name);
-  assert(func);
+static bool isConcat(const Exp &exp)
+{
+  auto call = dynamic_cast<const Call *>(&exp);
+  return call && call->function->isBuiltin() && call->function->name == "tiger_concat" && !sm::fold(*call);
+}
 
-  if (call.args.size() != f_enventry->args.size())
+// the operands of nested concat calls, in evaluation order.
+static void concatParts(Exp &exp, vector<Exp *> &parts)
+{
+  if (!isConcat(exp))
   {
-    ostringstream o;
-    o << "error number of parameters excepted " << f_enventry->args.size() << " actual" << call.args.size();
-    fatalError(o.str(), call.func->pos);
+    parts.push_back(&exp);
+    return;
   }
+  for (auto arg : static_cast<Call &>(exp).args)
+    concatParts(*arg, parts);
+}
 
-  auto iter = f_enventry->args.begin();
-  vector<llvm::Value *> params;
-  for (auto arg : call.args)
+// A chain such as concat(concat(a, b), c) allocates and copies its result once, instead
+// of once for every call.
+TyValue CodeGenerator::concatChain(Call &call)
+{
+  vector<Exp *> parts;
+  concatParts(call, parts);
+  vector<Held> held;
+  vector<llvm::Value *> lent;
+  for (size_t i = 0; i < parts.size(); i++)
   {
-    auto arg_tyvalue = arg->accept(*this);
-    if (mismatch(*iter->get(), *arg_tyvalue.type))
+    auto collects = any_of(parts.begin() + i + 1, parts.end(), [](Exp *part)
+                           { return mayCollect(*part); });
+    if (options.rc)
     {
-      fatalError("unmatched parameter type", arg->pos);
+      // the runtime borrows the parts.
+      bool owns = counted(parts[i]->type);
+      auto part = collects ? parts[i]->accept(*this) : borrow(*parts[i], owns);
+      if (owns)
+        lent.push_back(part.value);
+      held.push_back({part.value, nullptr});
+      continue;
     }
-    else
+    held.push_back(hold(parts[i]->accept(*this), collects));
+  }
+  // the runtime keeps the parts where the collector finds them while it allocates.
+  auto array = createEntryBlockAlloca(llvm::ArrayType::get(builder->getPtrTy(), parts.size()), "parts");
+  for (size_t i = 0; i < parts.size(); i++)
+    builder->CreateStore(release(held[i]), builder->CreateConstInBoundsGEP2_64(array->getAllocatedType(), array, 0, i));
+  auto concat = runtimeFunction(
+      concatNFunction, "tiger_concat_n",
+      FunctionType::get(builder->getPtrTy(), {builder->getInt64Ty(), builder->getPtrTy()}, false));
+  auto result = builder->CreateCall(concat, {builder->getInt64(parts.size()), array});
+  for (auto part : lent)
+    drop(part);
+  return TyValue(call.type, result);
+}
+
+TyValue CodeGenerator::visit(Call &call)
+{
+  auto callee = call.function;
+  if (callee->isBuiltin())
+    if (auto folded = sm::fold(call))
+      return constant(call.type, *folded);
+  if (isConcat(call) && (isConcat(*call.args[0]) || isConcat(*call.args[1])))
+    return concatChain(call);
+  vector<Held> held;
+  vector<llvm::Value *> lent;
+  for (size_t i = 0; i < call.args.size(); i++)
+  {
+    auto collects = any_of(call.args.begin() + i + 1, call.args.end(), [](Exp *arg)
+                           { return mayCollect(*arg); });
+    if (options.rc && (callee->isBuiltin() || (callee->dec && callee->dec->parameters[i]->variable->borrowed)))
     {
-      params.push_back(arg_tyvalue.value);
+      // the caller keeps the reference of a borrowed argument, which is read without one
+      // unless later arguments run code. Builtins borrow all of their arguments.
+      auto owns = counted(call.args[i]->type);
+      auto arg = collects ? call.args[i]->accept(*this) : borrow(*call.args[i], owns);
+      if (owns)
+        lent.push_back(arg.value);
+      held.push_back({arg.value, nullptr});
+      continue;
     }
-    iter++;
+    held.push_back(hold(call.args[i]->accept(*this), collects));
   }
-
-  auto result = builder->CreateCall(func, params);
-  if (f_enventry->returnType)
+  vector<llvm::Value *> params;
+  for (auto &arg : held)
+    params.push_back(release(arg));
+  for (auto captured : callee->captures)
+    params.push_back(variableAddress(captured));
+
+  auto result = builder->CreateCall(function(callee), params);
+  for (auto arg : lent)
+    drop(arg);
+  if (callee->returnType)
   {
-    return TyValue(f_enventry->returnType, result);
+    return TyValue(call.type, result);
   }
   else
   {
@@ -278,21 +457,41 @@ static CmpInst::Predicate op2icmp(Oper op)
 
 TyValue CodeGenerator::visit(BinOp &bin)
 {
-  if (isArithOp(bin.op))
-  {
-    auto LHS = bin.lhs->accept(*this);
+  if (auto folded = sm::fold(bin))
+    return constant(bin.type, *folded);
 
-    if (ty::mismatch(*LHS.type, ty::Int()))
+  if (counted(bin.lhs->type) || counted(bin.rhs->type))
+  {
+    // references compare without references of their own, the left one only when the
+    // right one runs no code.
+    auto ownsLHS = counted(bin.lhs->type), ownsRHS = false;
+    auto LHS = mayCollect(*bin.rhs) ? bin.lhs->accept(*this) : borrow(*bin.lhs, ownsLHS);
+    auto RHS = borrow(*bin.rhs, ownsRHS);
+    Value *b;
+    if (ty::isA(bin.lhs->type, ty::Kind::String))
     {
-      fatalError("bad type of lhs", bin.lhs->pos);
+      b = compareStrings(bin.op, LHS.value, RHS.value);
     }
-
-    auto RHS = bin.rhs->accept(*this);
-    if (ty::mismatch(*RHS.type, ty::Int()))
+    else
     {
-      fatalError("bad type of rhs", bin.rhs->pos);
+      auto li = builder->CreatePtrToInt(LHS.value, builder->getInt64Ty());
+      auto ri = builder->CreatePtrToInt(RHS.value, builder->getInt64Ty());
+      b = builder->CreateICmp(op2icmp(bin.op), li, ri);
     }
+    if (ownsLHS)
+      drop(LHS.value);
+    if (ownsRHS)
+      drop(RHS.value);
+    return TyValue(bin.type, builder->CreateIntCast(b, builder->getInt64Ty(), false));
+  }
 
+  auto LHS = bin.lhs->accept(*this);
+  auto heldLHS = hold(LHS, mayCollect(*bin.rhs));
+  auto RHS = bin.rhs->accept(*this);
+  LHS.value = release(heldLHS);
+
+  if (isArithOp(bin.op))
+  {
     Value *result = nullptr;
 
     switch (bin.op)
@@ -313,156 +512,194 @@ TyValue CodeGenerator::visit(BinOp &bin)
       assert(0 && "bad operator");
     }
 
-    return TyValue(make_shared<ty::Int>(), result);
+    return TyValue(bin.type, result);
+  }
+
+  assert(isRelOp(bin.op));
+  Value *b = nullptr;
+  if (ty::isA(bin.lhs->type, ty::Kind::String))
+  {
+    b = compareStrings(bin.op, LHS.value, RHS.value);
+  }
+  else if (ty::isA(bin.lhs->type, ty::Kind::Int))
+  {
+    b = builder->CreateICmp(op2icmp(bin.op), LHS.value, RHS.value);
   }
   else
   {
-    assert(isRelOp(bin.op));
-    auto LHS = bin.lhs->accept(*this);
-    if (match(*LHS.type, ty::String()))
-    {
-      auto RHS = bin.rhs->accept(*this);
-      if (match(*RHS.type, ty::String()))
-      {
-        auto func = requestFunction("string_compare");
-        auto cmp = builder->CreateCall(func, {LHS.value, RHS.value});
-        auto b = builder->CreateICmp(op2icmp(bin.op), cmp, builder->getInt64(0));
-        return TyValue(make_shared<ty::Int>(), builder->CreateIntCast(b, builder->getInt64Ty(), false));
-      }
-      else
-      {
-        // "textcontent compare to other type" >= 42
-        fatalError("unmatched type", bin.rhs->pos);
-      }
-    }
-    else if (match(*LHS.type, ty::Int()))
-    {
-      auto RHS = bin.rhs->accept(*this);
-      if (match(*RHS.type, ty::Int()))
-      {
-        auto b = builder->CreateICmp(op2icmp(bin.op), LHS.value, RHS.value);
-        return TyValue(make_shared<ty::Int>(), builder->CreateIntCast(b, builder->getInt64Ty(), false));
-      }
-      else
-      {
-        fatalError("unmatched type", bin.rhs->pos);
-      }
-    }
-    else if (dynamic_cast<const ty::Array *>(actualTy(LHS.type.get())) || dynamic_cast<const ty::Record *>(actualTy(LHS.type.get())))
-    {
-      if (bin.op == Oper::eqOp || bin.op == Oper::neqOp)
-      {
-        auto RHS = bin.rhs->accept(*this);
-        if (match(*LHS.type, *RHS.type))
-        {
-          auto li = builder->CreatePtrToInt(LHS.value, builder->getInt64Ty());
-          auto ri = builder->CreatePtrToInt(RHS.value, builder->getInt64Ty());
-          auto b = builder->CreateICmp(op2icmp(bin.op), li, ri);
-          return TyValue(make_shared<ty::Int>(), builder->CreateIntCast(b, builder->getInt64Ty(), false));
-        }
-        else
-        {
-          fatalError("unmatched type", bin.rhs->pos);
-        }
-      }
-      else
-      {
-        fatalError("bad operator for reference type", bin.pos);
-      }
-    }
-    else
-    {
-      fatalError("bad type to compare", bin.lhs->pos);
-    }
+    // records and arrays compare by reference.
+    auto li = builder->CreatePtrToInt(LHS.value, builder->getInt64Ty());
+    auto ri = builder->CreatePtrToInt(RHS.value, builder->getInt64Ty());
+    b = builder->CreateICmp(op2icmp(bin.op), li, ri);
   }
+  return TyValue(bin.type, builder->CreateIntCast(b, builder->getInt64Ty(), false));
 }
 
-TyValue CodeGenerator::visit(RecordExp &record)
+Value *CodeGenerator::compareStrings(Oper op, Value *lhs, Value *rhs)
 {
-  auto found_type = namedTypes.find(record.type_id->id);
-  if (!found_type)
-    fatalError("type " + record.type_id->id + " is undefined", record.pos);
+  auto type = FunctionType::get(builder->getInt64Ty(), {builder->getPtrTy(), builder->getPtrTy()}, false);
+  if (op == Oper::eqOp || op == Oper::neqOp)
+  {
+    // equality only needs the lengths and, when they match, the bytes.
+    auto equal = runtimeFunction(stringEqualFunction, "tiger_string_equal", type);
+    auto eq = builder->CreateCall(equal, {lhs, rhs});
+    return builder->CreateICmp(op == Oper::eqOp ? CmpInst::ICMP_NE : CmpInst::ICMP_EQ, eq, builder->getInt64(0));
+  }
+  auto compare = runtimeFunction(stringCompareFunction, "tiger_string_compare", type);
+  auto cmp = builder->CreateCall(compare, {lhs, rhs});
+  return builder->CreateICmp(op2icmp(op), cmp, builder->getInt64(0));
+}
 
-  auto ty = actualTy(found_type->get());
-  auto record_ty = dynamic_cast<const ty::Record *>(ty);
-  if (!record_ty)
-    fatalError("type " + record.type_id->id + " is not a record type", record.pos);
+TyValue CodeGenerator::visit(RecordExp &record)
+{
+  auto record_ty = ty::asRecord(record.type);
+  auto struct_ty = recordLayout(record_ty);
+  Value *old = nullptr, *unique = nullptr;
+  if (record.reuse)
+  {
+    // whether the record is unique decides if the fields read from it move.
+    old = builder->CreateLoad(builder->getPtrTy(), variableAddress(record.reuse));
+    auto isUnique = runtimeFunction(
+        rcUniqueFunction, "tiger_rc_unique",
+        FunctionType::get(builder->getInt64Ty(), {builder->getPtrTy()}, false));
+    unique = builder->CreateCall(isUnique, {old});
+    reusing[record.reuse] = builder->CreateICmpNE(unique, builder->getInt64(0));
+  }
+  // fields are computed before the record is allocated, which may collect unless it is
+  // in a region.
+  vector<Held> values;
+  for (size_t i = 0; i < record.records.size(); i++)
+  {
+    auto collects = (!record.regional && !record.stack) || any_of(record.records.begin() + i + 1, record.records.end(), [](absyn::Record *rcd)
+                                               { return mayCollect(*rcd->value); });
+    values.push_back(hold(record.records[i]->value->accept(*this), collects));
+  }
 
-  auto struct_ty = StructType::getTypeByName(*context, record.type_id->id);
-  assert(struct_ty);
-  auto _malloc = requestFunction("malloc");
-  assert(_malloc);
   auto sz = moduler->getDataLayout().getTypeAllocSize(struct_ty);
-  auto value = builder->CreateCall(_malloc, {builder->CreateTypeSize(builder->getInt64Ty(), sz)});
+  auto size = builder->CreateTypeSize(builder->getInt64Ty(), sz);
+  Value *value;
+  if (record.stack)
+  {
+    value = stackObject(record_ty, struct_ty);
+  }
+  else if (record.regional)
+  {
+    auto alloc = runtimeFunction(
+        regionAllocFunction, "tiger_region_alloc",
+        FunctionType::get(builder->getPtrTy(), {builder->getPtrTy(), builder->getInt64Ty()}, false));
+    value = builder->CreateCall(alloc, {typeDescriptor(record_ty), size});
+  }
+  else if (record.reuse)
+  {
+    // moved fields are numbered among the counted fields, as in the type descriptor.
+    uint64_t moved = 0;
+    unsigned counted_fields = 0;
+    for (size_t i = 0; i < record_ty->fields.size(); i++)
+      if (counted(record_ty->fields[i].second))
+      {
+        if (record.moved >> i & 1)
+          moved |= uint64_t(1) << counted_fields;
+        counted_fields++;
+      }
+    auto reuse = runtimeFunction(
+        rcReuseFunction, "tiger_rc_reuse",
+        FunctionType::get(
+            builder->getPtrTy(),
+            {builder->getPtrTy(), builder->getInt64Ty(), builder->getPtrTy(), builder->getInt64Ty(), builder->getInt64Ty()},
+            false));
+    value = builder->CreateCall(reuse, {typeDescriptor(record_ty), size, old, unique, builder->getInt64(moved)});
+    builder->CreateStore(ConstantPointerNull::get(builder->getPtrTy()), variableAddress(record.reuse));
+    reusing.erase(record.reuse);
+  }
+  else if (options.rc)
+  {
+    auto alloc = runtimeFunction(
+        rcAllocFunction, "tiger_rc_alloc",
+        FunctionType::get(builder->getPtrTy(), {builder->getPtrTy(), builder->getInt64Ty()}, false));
+    value = builder->CreateCall(alloc, {typeDescriptor(record_ty), size});
+  }
+  else if (options.gc)
+  {
+    auto alloc = runtimeFunction(
+        gcAllocFunction, "tiger_gc_alloc",
+        FunctionType::get(builder->getPtrTy(), {builder->getPtrTy(), builder->getInt64Ty()}, false));
+    value = builder->CreateCall(alloc, {typeDescriptor(record_ty), size});
+  }
+  else
+  {
+    auto _malloc = runtimeFunction(
+        mallocFunction, "malloc",
+        FunctionType::get(builder->getPtrTy(), {builder->getInt64Ty()}, false));
+    value = builder->CreateCall(_malloc, {size});
+  }
 
-  for (auto &rcd : record.records)
+  for (size_t i = 0; i < values.size(); i++)
   {
-    auto rcd_ty = record_ty->records.find(rcd->name->id);
-    if (rcd_ty == record_ty->records.end())
-    {
-      fatalError("field " + rcd->name->id + " is undefined", rcd->pos);
-    }
-    auto record_value = rcd->value->accept(*this);
-    if (match(*rcd_ty->second, *record_value.type))
-    {
-      auto offset = distance(record_ty->records.begin(), rcd_ty);
-      auto record_ptr = builder->CreateStructGEP(struct_ty, value, offset);
-      builder->CreateStore(record_value.value, record_ptr);
-    }
-    else
-    {
-      fatalError("type of field " + rcd->name->id + " is not matched", rcd->value->pos);
-    }
+    auto record_ptr = builder->CreateStructGEP(struct_ty, value, record.records[i]->index);
+    builder->CreateStore(release(values[i]), record_ptr);
   }
 
-  return TyValue(make_shared<ty::Record>(*record_ty), value);
+  return TyValue(record.type, value);
 }
 
 TyValue CodeGenerator::visit(Array &array)
 {
-  auto found_type = namedTypes.find(array.type_id->id);
-  if (!found_type)
-    fatalError("type " + array.type_id->id + " is undefined", array.pos);
-
-  auto ty = actualTy(found_type->get());
-  auto array_ty = dynamic_cast<const ty::Array *>(ty);
-  if (!array_ty)
-    fatalError("type " + array.type_id->id + " is not a array type", array.pos);
+  auto array_ty = ty::asArray(array.type);
+  auto elem_ir_ty = type2IRType(array_ty->type);
+  if (array.stack)
+  {
+    // the length is a constant, so the capacity has nothing to evaluate.
+    auto ELEMENT = array.element->accept(*this);
+    auto layout = llvm::ArrayType::get(elem_ir_ty, array.length);
+    auto array_ref = stackObject(array_ty, layout);
+    for (int64_t i = 0; i < array.length; i++)
+      builder->CreateStore(ELEMENT.value, builder->CreateConstInBoundsGEP2_64(layout, array_ref, 0, i));
+    return TyValue(array.type, array_ref);
+  }
 
   auto CAPACITY = array.capacity->accept(*this);
-  if (mismatch(*CAPACITY.type, ty::Int()))
-    fatalError("capacity of array must be int type", array.capacity->pos);
-
   auto ELEMENT = array.element->accept(*this);
-  if (mismatch(*array_ty->type, *ELEMENT.type))
-    fatalError("type of element is not matched", array.element->pos);
+  if (array.regional || options.gc || options.rc)
+  {
+    // the runtime reads the element from its root slot once the array is allocated.
+    auto e_ptr = array.regional ? createEntryBlockAlloca(elem_ir_ty) : createRootAlloca(elem_ir_ty);
+    builder->CreateStore(ELEMENT.value, e_ptr);
+    auto newArrayTy = FunctionType::get(builder->getPtrTy(), {builder->getPtrTy(), builder->getInt64Ty(), builder->getPtrTy()}, false);
+    Function *newArray;
+    if (array.regional)
+      newArray = runtimeFunction(regionNewArrayFunction, "tiger_region_new_array", newArrayTy);
+    else if (options.rc)
+      newArray = runtimeFunction(rcNewArrayFunction, "tiger_rc_new_array", newArrayTy);
+    else
+      newArray = runtimeFunction(gcNewArrayFunction, "tiger_gc_new_array", newArrayTy);
+    return TyValue(array.type, builder->CreateCall(newArray, {typeDescriptor(array_ty), CAPACITY.value, e_ptr}));
+  }
 
-  auto elem_ir_ty = type2IRType(array_ty->type);
   auto sz = moduler->getDataLayout().getTypeAllocSize(elem_ir_ty);
   auto array_size = builder->CreateMul(
       builder->CreateTypeSize(builder->getInt64Ty(), sz),
       CAPACITY.value);
 
-  auto _malloc = requestFunction("malloc");
-  assert(_malloc);
+  auto _malloc = runtimeFunction(
+      mallocFunction, "malloc",
+      FunctionType::get(builder->getPtrTy(), {builder->getInt64Ty()}, false));
   auto array_ref = builder->CreateCall(_malloc, {array_size});
-  auto _array_initialize = requestFunction("array_initialize");
-  auto e_ptr = builder->CreateAlloca(elem_ir_ty);
+  auto _array_initialize = runtimeFunction(
+      arrayInitializeFunction, "tiger_array_initialize",
+      FunctionType::get(
+          builder->getVoidTy(),
+          {builder->getPtrTy(), builder->getPtrTy(), builder->getInt64Ty(), builder->getInt64Ty()},
+          false));
+  auto e_ptr = createEntryBlockAlloca(elem_ir_ty);
   builder->CreateStore(ELEMENT.value, e_ptr);
   builder->CreateCall(_array_initialize, {array_ref, e_ptr, CAPACITY.value, builder->CreateTypeSize(builder->getInt64Ty(), sz)});
-  return TyValue(make_shared<ty::Array>(*array_ty), array_ref);
+  return TyValue(array.type, array_ref);
 }
 
 TyValue CodeGenerator::visit(If &iff)
 {
   auto COND = iff.condition->accept(*this);
 
-  if (!COND.value)
-    return TyValue();
-
-  if (ty::mismatch(*COND.type, ty::Int()))
-    fatalError("if condition must be int type", iff.condition->pos);
-
   auto func = builder->GetInsertBlock()->getParent();
   auto uid = to_string(unique_id++);
   auto thenB = BasicBlock::Create(*context, newLabel("then" + uid), func);
@@ -476,37 +713,25 @@ TyValue CodeGenerator::visit(If &iff)
 
     builder->SetInsertPoint(thenB);
     auto THEN = iff.then->accept(*this);
-    if (!THEN.value)
-      return TyValue();
     builder->CreateBr(mergeB);
     thenB = builder->GetInsertBlock();
 
     func->insert(func->end(), elseB);
     builder->SetInsertPoint(elseB);
     auto ELSE = iff.els->accept(*this);
-    if (!ELSE.value)
-      return TyValue();
     builder->CreateBr(mergeB);
     elseB = builder->GetInsertBlock();
 
     func->insert(func->end(), mergeB);
     builder->SetInsertPoint(mergeB);
 
-    if (match(*THEN.type, ty::Void()) && match(*ELSE.type, ty::Void()))
-    {
+    if (ty::isA(iff.type, ty::Kind::Void))
       return mkVoid();
-    }
-    else if (match(*THEN.type, *ELSE.type))
-    {
-      auto phi = builder->CreatePHI(type2IRType(THEN.type.get()), 2);
-      phi->addIncoming(THEN.value, thenB);
-      phi->addIncoming(ELSE.value, elseB);
-      return TyValue(THEN.type, phi);
-    }
-    else
-    {
-      fatalError("if else, then must have same type or both emit empty value", iff.pos);
-    }
+
+    auto phi = builder->CreatePHI(type2IRType(iff.type), 2);
+    phi->addIncoming(THEN.value, thenB);
+    phi->addIncoming(ELSE.value, elseB);
+    return TyValue(iff.type, phi);
   }
   else
   {
@@ -514,11 +739,8 @@ TyValue CodeGenerator::visit(If &iff)
     builder->CreateCondBr(cond, thenB, mergeB);
 
     builder->SetInsertPoint(thenB);
-    auto THEN = iff.then->accept(*this);
-    if (!THEN.value)
-      return TyValue();
+    iff.then->accept(*this);
     builder->CreateBr(mergeB);
-    thenB = builder->GetInsertBlock();
 
     func->insert(func->end(), mergeB);
     builder->SetInsertPoint(mergeB);
@@ -536,11 +758,6 @@ TyValue CodeGenerator::visit(While &whil)
   auto endB = BasicBlock::Create(*context, newLabel("end"));
   auto COND = whil.condition->accept(*this);
 
-  if (!COND.value)
-    return TyValue();
-  if (ty::mismatch(*COND.type, ty::Int()))
-    fatalError("while condition must be int type", whil.condition->pos);
-
   auto cond = builder->CreateIntCast(COND.value, builder->getInt1Ty(), false);
   builder->CreateCondBr(cond, bodyB, endB);
   func->insert(func->end(), bodyB);
@@ -557,20 +774,10 @@ TyValue CodeGenerator::visit(While &whil)
 TyValue CodeGenerator::visit(For &forr)
 {
   auto FROM = forr.from->accept(*this);
-  if (!FROM.value)
-    return TyValue();
-  if (ty::mismatch(*FROM.type, ty::Int()))
-    fatalError("lower of range must be int type", forr.from->pos);
-
   auto TO = forr.to->accept(*this);
-  if (!TO.value)
-    return TyValue();
-  if (ty::mismatch(*TO.type, ty::Int()))
-    fatalError("upper of range must be int type", forr.from->pos);
-
-  beginScope();
-  auto alloca = builder->CreateAlloca(builder->getInt64Ty(), nullptr, forr.var->id);
-  namedValues.insert(forr.var->id, make_shared<VarEnventry>(make_shared<ty::Int>(), alloca));
+
+  auto alloca = createEntryBlockAlloca(builder->getInt64Ty(), forr.var->id.name());
+  frames.back().slots[forr.variable->slot] = alloca;
   builder->CreateStore(FROM.value, alloca);
   auto func = builder->GetInsertBlock()->getParent();
   auto loopB = BasicBlock::Create(*context, newLabel("loop"), func);
@@ -579,8 +786,8 @@ TyValue CodeGenerator::visit(For &forr)
   builder->CreateBr(loopB);
 
   builder->SetInsertPoint(loopB);
-  auto var = builder->CreateLoad(alloca->getAllocatedType(), alloca, forr.var->id);
-  auto cmp = builder->CreateICmpSLT(var, TO.value, "loopcond");
+  auto var = builder->CreateLoad(alloca->getAllocatedType(), alloca, forr.var->id.name());
+  auto cmp = builder->CreateICmpSLE(var, TO.value, "loopcond");
   builder->CreateCondBr(cmp, bodyB, endB);
 
   func->insert(func->end(), bodyB);
@@ -592,7 +799,6 @@ TyValue CodeGenerator::visit(For &forr)
   auto nextVar = builder->CreateAdd(currVar, builder->getInt64(1), "nextvar");
   builder->CreateStore(nextVar, alloca);
   builder->CreateBr(loopB);
-  endScope();
 
   func->insert(func->end(), endB);
   builder->SetInsertPoint(endB);
@@ -602,335 +808,350 @@ TyValue CodeGenerator::visit(For &forr)
 
 TyValue CodeGenerator::visit(Break &brk)
 {
-  if (!breaks.empty())
+  assert(!breaks.empty() && "break outside of a loop");
+  // drops the references of the lets in the loop and leaves their regions.
+  for (auto &slot : owned)
+    if (slot.loops == breaks.size())
+      drop(builder->CreateLoad(builder->getPtrTy(), slot.slot));
+  for (auto &region : regions)
+    if (region.loops == breaks.size())
+    {
+      exitRegion(region.mark);
+      break;
+    }
+  auto br = builder->CreateBr(breaks.back());
+  // code after a break is unreachable but still needs a block to go into.
+  auto func = builder->GetInsertBlock()->getParent();
+  builder->SetInsertPoint(BasicBlock::Create(*context, newLabel("afterBreak"), func));
+  return TyValue(brk.type, br);
+}
+
+llvm::Type *CodeGenerator::type2IRType(const ty::Type *ty)
+{
+  switch (actualTy(ty)->kind)
   {
-    auto br = builder->CreateBr(breaks.back());
-    return TyValue(make_shared<ty::Void>(), br);
+  case ty::Kind::Int:
+    return builder->getInt64Ty();
+  case ty::Kind::Void:
+    return builder->getVoidTy();
+  default:
+    return builder->getPtrTy();
   }
-  else
+}
+
+// Field types are all pointers or integers, so a layout never needs the layouts of other
+// records and recursive records need no forward declaration.
+llvm::StructType *CodeGenerator::recordLayout(const ty::Record *record)
+{
+  auto &layout = recordLayouts[record->id];
+  if (!layout)
   {
-    fatalError("unexcepted break", brk.pos);
+    vector<llvm::Type *> elements;
+    for (auto &field : record->fields)
+      elements.push_back(type2IRType(field.second));
+    layout = StructType::create(*context, elements, record->name.name());
   }
+  return layout;
 }
 
-void CodeGenerator::preprocessTypeDecs(vector<TypeDec *> decs)
+AllocaInst *CodeGenerator::createEntryBlockAlloca(llvm::Type *type, std::string name)
 {
-  map<string, set<ty::Type **>> delayedInjections;
-
-  auto injectOrDelay = [&delayedInjections, this](string name, ty::Type **ptr)
-  {
-    if (auto ty = namedTypes.find(name))
-    {
-      *ptr = ty->get();
-    }
-    else
-    {
-      auto found = delayedInjections.find(name);
-      if (found != delayedInjections.end())
-        found->second.insert(ptr);
-      else
-        delayedInjections.insert({name, {ptr}});
-    }
-  };
+  auto &entry = builder->GetInsertBlock()->getParent()->getEntryBlock();
+  IRBuilder<> entryBuilder(&entry, entry.begin());
+  return entryBuilder.CreateAlloca(type, nullptr, name);
+}
 
-  for (auto dec : decs)
+// A slot of a pointer is a root of the collector. The shadow stack lowering links the
+// roots of a function into a frame the collector walks and updates, and they start null.
+AllocaInst *CodeGenerator::createRootAlloca(llvm::Type *type, std::string name)
+{
+  auto alloca = createEntryBlockAlloca(type, name);
+  if (options.gc && type->isPointerTy())
   {
-    auto tid = dec->type_id->id;
-    if (auto named = dynamic_cast<NamedType *>(dec->type.get()))
-    {
-      auto namedTy = make_shared<ty::Named>(tid, nullptr);
-      namedTypes.insert(tid, namedTy);
-      injectOrDelay(named->named->id, &namedTy->type);
-    }
-    else if (auto array = dynamic_cast<absyn::ArrayType *>(dec->type.get()))
-    {
-      auto arrayTy = make_shared<ty::Array>(nullptr);
-      namedTypes.insert(tid, arrayTy);
-      injectOrDelay(array->array->id, &arrayTy->type);
-    }
-    else if (auto record = dynamic_cast<RecordType *>(dec->type.get()))
-    {
-      auto recordTy = make_shared<ty::Record>(tid);
-      namedTypes.insert(tid, recordTy);
-      auto &records = recordTy->records;
-      for (auto field : record->fields)
-      {
-        records.insert({field->name->id, nullptr});
-        injectOrDelay(field->type_id->id, &records[field->name->id]);
-      }
-    }
-    else
-    {
-      assert(0 && "unrecognized type in AST");
-    }
+    IRBuilder<> entryBuilder(alloca->getParent(), std::next(alloca->getIterator()));
+    auto null = ConstantPointerNull::get(builder->getPtrTy());
+    entryBuilder.CreateStore(null, alloca);
+    entryBuilder.CreateCall(Intrinsic::getDeclaration(moduler.get(), Intrinsic::gcroot), {alloca, null});
   }
+  return alloca;
+}
 
-  for (auto pair : delayedInjections)
-    if (auto ty = namedTypes.find(pair.first))
-      for (auto ptr : pair.second)
-        *ptr = ty->get();
+// An object in the frame, where SROA can take it apart. Under reference counting it has the
+// header of the runtime, with a count that the variable holding it keeps above zero.
+llvm::Value *CodeGenerator::stackObject(const ty::Type *type, llvm::Type *layout)
+{
+  if (!options.rc)
+    return createEntryBlockAlloca(layout);
+  auto object_ty = StructType::get(*context, {builder->getPtrTy(), builder->getInt64Ty(), builder->getInt64Ty(), layout});
+  auto object = createEntryBlockAlloca(object_ty);
+  auto size = moduler->getDataLayout().getTypeAllocSize(layout);
+  builder->CreateStore(typeDescriptor(type), builder->CreateStructGEP(object_ty, object, 0));
+  builder->CreateStore(builder->getInt64(1), builder->CreateStructGEP(object_ty, object, 1));
+  builder->CreateStore(builder->CreateTypeSize(builder->getInt64Ty(), size), builder->CreateStructGEP(object_ty, object, 2));
+  return builder->CreateStructGEP(object_ty, object, 3);
 }
 
-llvm::Type *CodeGenerator::type2IRType(const ty::Type *ty)
+CodeGenerator::Held CodeGenerator::hold(const TyValue &value, bool collects)
 {
-  auto type = actualTy(ty);
+  if (!options.gc || !collects || !value.value || !value.value->getType()->isPointerTy() || isa<Constant>(value.value))
+    return {value.value, nullptr};
+  auto slot = createRootAlloca(builder->getPtrTy(), "held");
+  builder->CreateStore(value.value, slot);
+  return {value.value, slot};
+}
 
-  if (type->match(ty::Int()))
-  {
-    return builder->getInt64Ty();
-  }
-  else if (type->match(ty::String()))
-  {
-    return builder->getPtrTy();
-  }
-  else if (type->match(ty::Void()))
-  {
-    return builder->getVoidTy();
-  }
-  else if (type->match(ty::Nil()))
+llvm::Value *CodeGenerator::release(const Held &held)
+{
+  return held.slot ? builder->CreateLoad(builder->getPtrTy(), held.slot) : held.value;
+}
+
+// the record or array a variable holds.
+llvm::Value *CodeGenerator::objectOf(Var &var)
+{
+  return builder->CreateLoad(builder->getPtrTy(), var.accept(*this).value);
+}
+
+// Tells the collector which words of a record or an array are pointers, or reference
+// counting which are counted references.
+GlobalVariable *CodeGenerator::typeDescriptor(const ty::Type *type)
+{
+  type = ty::actualTy(type);
+  auto &descriptor = typeDescriptors[type->id];
+  if (descriptor)
+    return descriptor;
+
+  vector<Constant *> offsets;
+  uint32_t kind, count;
+  string name;
+  if (auto array = dynamic_cast<const ty::Array *>(type))
   {
-    return builder->getPtrTy();
+    kind = TIGER_ARRAY;
+    count = options.rc ? counted(array->type) : type2IRType(array->type)->isPointerTy();
+    name = array->name.name();
   }
   else
   {
-    return builder->getPtrTy();
+    auto record = ty::asRecord(type);
+    auto layout = moduler->getDataLayout().getStructLayout(recordLayout(record));
+    for (size_t i = 0; i < record->fields.size(); i++)
+      if (options.rc ? counted(record->fields[i].second) : type2IRType(record->fields[i].second)->isPointerTy())
+        offsets.push_back(builder->getInt32(layout->getElementOffset(i)));
+    kind = TIGER_RECORD;
+    count = offsets.size();
+    name = record->name.name();
   }
+
+  auto offsetsTy = llvm::ArrayType::get(builder->getInt32Ty(), offsets.size());
+  auto init = ConstantStruct::getAnon(
+      {builder->getInt32(kind), builder->getInt32(count), ConstantArray::get(offsetsTy, offsets)});
+  descriptor = new GlobalVariable(*moduler, init->getType(), true, GlobalValue::PrivateLinkage, init, "type." + name);
+  descriptor->setAlignment(Align(8));
+  return descriptor;
 }
 
-void CodeGenerator::preprocessFunctionDecs(vector<FunctionDec *> func_decs)
+void CodeGenerator::writeBarrier(llvm::Value *object, const TyValue &value)
 {
-  for (auto f_dec : func_decs)
-  {
-    if (namedValues.find_top(f_dec->funcname->id))
-      fatalError("redeclare function " + f_dec->funcname->id, f_dec->pos);
-
-    vector<shared_ptr<ty::Type>> args;
-    shared_ptr<ty::Type> returnType = nullptr;
-    ostringstream funcname_o;
-    funcname_o << f_dec->funcname->id << "_" << ++this->func_id;
-
-    for (auto field : f_dec->parameters)
-    {
-      if (auto ty = namedTypes.find(field->type_id->id))
-      {
-        args.push_back(*ty);
-      }
-      else
-      {
-        fatalError("undefined type " + field->type_id->id, field->pos);
-      }
-    }
+  if (!options.gc || !value.value->getType()->isPointerTy() || isa<ConstantPointerNull>(value.value))
+    return;
+  auto write = runtimeFunction(
+      gcWriteFunction, "tiger_gc_write",
+      FunctionType::get(builder->getVoidTy(), {builder->getPtrTy(), builder->getPtrTy()}, false));
+  builder->CreateCall(write, {object, value.value});
+}
 
-    if (f_dec->return_type)
-    {
-      if (auto rt = namedTypes.find(f_dec->return_type->id))
-      {
-        returnType = *rt;
-      }
-      else
-      {
-        fatalError("undefined type " + f_dec->return_type->id, f_dec->return_type->pos);
-      }
-    }
+llvm::Value *CodeGenerator::variableAddress(const sm::Variable *variable)
+{
+  auto &frame = frames.back();
+  if (variable->owner == frame.function)
+    return frame.slots[variable->slot];
+  return frame.captures[frame.function->captureIndex(variable)];
+}
 
-    auto f_enventry = make_shared<FuncEnventry>(funcname_o.str(), returnType, args);
-    namedValues.insert(f_dec->funcname->id, f_enventry);
-    auto func = createFunction(*f_enventry);
-    auto param_iter = f_dec->parameters.begin();
-    for (auto &arg : func->args())
-    {
-      arg.setName((*param_iter)->name->id);
-      param_iter++;
-    }
+TyValue CodeGenerator::visit(Let &let)
+{
+  Value *mark = nullptr;
+  if (let.region)
+  {
+    auto enter = runtimeFunction(
+        regionEnterFunction, "tiger_region_enter",
+        FunctionType::get(builder->getPtrTy(), false));
+    mark = builder->CreateCall(enter);
+    regions.push_back({mark, breaks.size()});
+  }
+  auto scope = owned.size();
+  for (auto &dec : let.decs)
+    dec->accept(*this);
+  auto body = let.body->accept(*this);
+  dropOwned(scope);
+  if (mark)
+  {
+    regions.pop_back();
+    exitRegion(mark);
   }
+  return body;
 }
 
-llvm::Function *CodeGenerator::createFunction(FuncEnventry &func)
+void CodeGenerator::exitRegion(llvm::Value *mark)
 {
-  vector<llvm::Type *> paramTypes;
-  for (auto ty : func.args)
-    paramTypes.push_back(type2IRType(ty.get()));
-
-  llvm::Type *returnType = builder->getVoidTy();
-  if (func.returnType)
-    returnType = type2IRType(func.returnType.get());
+  auto exit = runtimeFunction(
+      regionExitFunction, "tiger_region_exit",
+      FunctionType::get(builder->getVoidTy(), {builder->getPtrTy()}, false));
+  builder->CreateCall(exit, {mark});
+}
 
-  auto funcType = FunctionType::get(returnType, paramTypes, false);
-  return Function::Create(funcType, Function::ExternalLinkage, func.name, moduler.get());
+// Marks the allocations of the program, and of the modules it calls into, that go to the
+// frame of their function or that a let frees when it ends, or how references to them are
+// handed around when they are counted.
+void CodeGenerator::analyzeMemory(absyn::Exp *program)
+{
+  sm::Regions regions;
+  for (auto module : checker.modules())
+    regions.add(*module);
+  if (program)
+    regions.add(*program);
+  regions.solve();
+  regions.mark(options.regions);
+  if (options.rc)
+  {
+    for (auto module : checker.modules())
+      sm::inferOwnership(*module, checker, regions);
+    if (program)
+      sm::inferOwnership(*program, checker, regions);
+  }
 }
 
-TyValue CodeGenerator::visit(Let &let)
+bool CodeGenerator::counted(const ty::Type *type)
 {
-  beginScope();
+  auto kind = ty::actualTy(type)->kind;
+  return options.rc && (kind == ty::Kind::Record || kind == ty::Kind::Array || kind == ty::Kind::String);
+}
 
-  ptrs<Dec> decs;
-  vector<TypeDec *> ty_decs;
-  vector<FunctionDec *> func_decs;
-  copy_if(let.decs.begin(), let.decs.end(), back_inserter(decs), [](auto ptr)
-          { return dynamic_cast<TypeDec *>(ptr.get()); });
-  transform(decs.begin(), decs.end(), back_inserter(ty_decs), [](auto ptr)
-            { return dynamic_cast<TypeDec *>(ptr.get()); });
-  decs.clear();
-  copy_if(let.decs.begin(), let.decs.end(), back_inserter(decs), [](auto ptr)
-          { return dynamic_cast<FunctionDec *>(ptr.get()); });
-  transform(decs.begin(), decs.end(), back_inserter(func_decs), [](auto ptr)
-            { return dynamic_cast<FunctionDec *>(ptr.get()); });
+void CodeGenerator::dup(llvm::Value *object)
+{
+  auto dup = runtimeFunction(
+      rcDupFunction, "tiger_rc_dup",
+      FunctionType::get(builder->getVoidTy(), {builder->getPtrTy()}, false));
+  builder->CreateCall(dup, {object});
+}
 
-  preprocessTypeDecs(ty_decs);
-  preprocessFunctionDecs(func_decs);
+void CodeGenerator::drop(llvm::Value *object)
+{
+  auto drop = runtimeFunction(
+      rcDropFunction, "tiger_rc_drop",
+      FunctionType::get(builder->getVoidTy(), {builder->getPtrTy()}, false));
+  builder->CreateCall(drop, {object});
+}
 
-  for (auto &dec : let.decs)
-    dec->accept(*this);
-  auto BODY = let.body->accept(*this);
-  endScope();
+// drops the references of the slots owned since from, latest first.
+void CodeGenerator::dropOwned(size_t from)
+{
+  for (auto i = owned.size(); i > from; i--)
+    drop(builder->CreateLoad(builder->getPtrTy(), owned[i - 1].slot));
+  owned.resize(from);
+}
 
-  return BODY;
+// An operand only looked at while nothing else runs. A variable of this function that
+// keeps its reference is read without one, anything else owns one when it is counted.
+TyValue CodeGenerator::borrow(absyn::Exp &exp, bool &owns)
+{
+  auto var = dynamic_cast<VarExp *>(&exp);
+  auto simple = var ? dynamic_cast<SimpleVar *>(var->var) : nullptr;
+  if (simple && !var->move && !simple->variable->captured)
+  {
+    owns = false;
+    return TyValue(exp.type, builder->CreateLoad(type2IRType(exp.type), variableAddress(simple->variable)));
+  }
+  owns = counted(exp.type);
+  return exp.accept(*this);
 }
 
 TyValue CodeGenerator::visit(SimpleVar &var)
 {
-  auto found = namedValues.find(var.name->id);
-  if (!found)
-    fatalError("variable " + var.name->id + " is undefiend.", var.name->pos);
-
-  auto var_enventry = dynamic_cast<VarEnventry *>(found->get());
-  if (!var_enventry)
-    fatalError(var.name->id + " is not a name of variable", var.name->pos);
-
-  auto alloca = var_enventry->alloca;
-  return TyValue(var_enventry->type, alloca);
+  return TyValue(var.type, variableAddress(var.variable));
 }
 
 TyValue CodeGenerator::visit(FieldVar &field)
 {
-  auto var = field.var->accept(*this);
-  if (auto record = dynamic_cast<ty::Record *>(var.type.get()))
-  {
-    auto struct_ty = StructType::getTypeByName(*context, record->name);
-    assert(struct_ty);
-    auto found = record->records.find(field.field->id);
-    if (found == record->records.end())
-      fatalError("record type has no field " + field.field->id, field.field->pos);
-    auto index = distance(record->records.begin(), found);
-    auto base = builder->CreateLoad(type2IRType(var.type.get()), var.value);
-    return TyValue(found->second->shared_from_this(), builder->CreateStructGEP(struct_ty, base, index));
-  }
-  else
-  {
-    fatalError("bad field access on a not record type", field.pos);
-  }
+  auto struct_ty = recordLayout(ty::asRecord(field.var->type));
+  auto base = objectOf(*field.var);
+  return TyValue(field.type, builder->CreateStructGEP(struct_ty, base, field.index));
 }
 
 TyValue CodeGenerator::visit(SubscriptVar &subscript)
 {
-  auto var = subscript.var->accept(*this);
-  if (auto array = dynamic_cast<ty::Array *>(var.type.get()))
+  // the address of an element is only computed once the subscript is, and an array not
+  // in a variable of this function is held while a subscript that may collect runs.
+  if (options.gc && !dynamic_cast<SimpleVar *>(subscript.var) && mayCollect(*subscript.subscript))
   {
+    auto array = hold(TyValue(subscript.var->type, objectOf(*subscript.var)), true);
     auto subs = subscript.subscript->accept(*this);
-    if (!subs.type->match(ty::Int()))
-      fatalError("subscript of array is not int type", subscript.subscript->pos);
-
-    auto base = builder->CreateLoad(type2IRType(var.type.get()), var.value);
-    return TyValue(array->type->shared_from_this(), builder->CreateInBoundsGEP(type2IRType(array->type), base, {subs.value}));
-  }
-  else
-  {
-    fatalError("bad element access on a not array type", subscript.pos);
+    auto base = release(array);
+    return TyValue(subscript.type, builder->CreateInBoundsGEP(type2IRType(subscript.type), base, {subs.value}));
   }
+
+  auto var = subscript.var->accept(*this);
+  auto subs = subscript.subscript->accept(*this);
+  auto base = builder->CreateLoad(builder->getPtrTy(), var.value);
+  return TyValue(subscript.type, builder->CreateInBoundsGEP(type2IRType(subscript.type), base, {subs.value}));
 }
 
 TyValue CodeGenerator::visit(TypeDec &typeDec)
 {
-  if (auto _ = dynamic_cast<absyn::RecordType *>(typeDec.type.get()))
-  {
-    auto found = namedTypes.find(typeDec.type_id->id);
-    assert(found);
-    auto record_ty = dynamic_pointer_cast<ty::Record>(*found);
-    vector<llvm::Type *> elements;
-    for (auto record : record_ty->records)
-    {
-      auto ty = actualTy(record.second);
-      elements.push_back(type2IRType(ty));
-    }
-    auto struct_ty = StructType::create(*context, elements, typeDec.type_id->id);
-  }
+  // record layouts are created on first use by recordLayout.
   return mkVoid();
 }
 
 TyValue CodeGenerator::visit(VarDec &varDec)
 {
-  if (varDec.type_id)
-  {
-    if (auto found = namedTypes.find(varDec.type_id->id))
-    {
-      auto alloca = builder->CreateAlloca(type2IRType(found->get()), nullptr, varDec.var->id);
-      auto exp = varDec.exp->accept(*this);
-      if (match(**found, *exp.type))
-      {
-        auto var = make_shared<VarEnventry>(exp.type, alloca);
-        builder->CreateStore(exp.value, alloca);
-        namedValues.insert(varDec.var->id, var);
-      }
-      else
-      {
-        fatalError("unmatched type for var declare " + varDec.type_id->id, varDec.exp->pos);
-      }
-    }
-    else
-    {
-      fatalError("undeclared type " + varDec.type_id->id, varDec.type_id->pos);
-    }
-  }
-  else
-  {
-    auto exp = varDec.exp->accept(*this);
-    auto alloca = builder->CreateAlloca(type2IRType(exp.type.get()), nullptr, varDec.var->id);
-    auto var = make_shared<VarEnventry>(exp.type, alloca);
-    builder->CreateStore(exp.value, alloca);
-    namedValues.insert(varDec.var->id, var);
-  }
-
+  // a variable holding an object in the frame is no root, and keeps its reference.
+  auto variable = varDec.variable;
+  auto record = dynamic_cast<RecordExp *>(varDec.exp);
+  auto array = dynamic_cast<Array *>(varDec.exp);
+  auto stack = (record && record->stack) || (array && array->stack);
+  auto alloca = stack ? createEntryBlockAlloca(type2IRType(variable->type), varDec.var->id.name())
+                      : createRootAlloca(type2IRType(variable->type), varDec.var->id.name());
+  auto exp = varDec.exp->accept(*this);
+  builder->CreateStore(exp.value, alloca);
+  frames.back().slots[variable->slot] = alloca;
+  if (counted(variable->type) && !stack)
+    owned.push_back({alloca, breaks.size()});
   return mkVoid();
 }
 
 TyValue CodeGenerator::visit(FunctionDec &funcDec)
 {
-  auto found = namedValues.find(funcDec.funcname->id);
-  assert(found && "function declare not found");
-  auto f_enventry = dynamic_cast<FuncEnventry *>(found->get());
-  assert(f_enventry && "declare is not a function");
-  Function *func = moduler->getFunction(f_enventry->name);
-  assert(func && "function not found in ir");
+  auto f = funcDec.function;
+  auto func = function(f);
   auto func_entry = BasicBlock::Create(*context, "entry", func);
   auto saved = builder->GetInsertBlock();
   builder->SetInsertPoint(func_entry);
-  beginScope();
-  assert(func->arg_size() == f_enventry->args.size());
-  auto arg_iter = f_enventry->args.begin();
-  auto field_iter = funcDec.parameters.begin();
-  for (auto &arg : func->args())
-  {
-    auto alloca = builder->CreateAlloca(arg.getType(), nullptr, arg.getName());
-    builder->CreateStore(&arg, alloca);
-    namedValues.insert((*field_iter)->name->id, make_shared<VarEnventry>(*arg_iter, alloca));
+
+  Frame frame{f, vector<llvm::Value *>(f->frameSize), {}};
+  auto scope = owned.size();
+  auto arg_iter = func->arg_begin();
+  for (auto &param : funcDec.parameters)
+  {
+    auto alloca = createRootAlloca(arg_iter->getType(), arg_iter->getName().str());
+    builder->CreateStore(arg_iter, alloca);
+    frame.slots[param->variable->slot] = alloca;
+    if (counted(param->variable->type) && !param->variable->borrowed)
+      owned.push_back({alloca, breaks.size()});
     arg_iter++;
-    field_iter++;
   }
+  for (size_t i = 0; i < f->captures.size(); i++)
+    frame.captures.push_back(arg_iter++);
+
+  frames.push_back(std::move(frame));
   auto body = funcDec.body->accept(*this);
-  endScope();
-  if (f_enventry->returnType)
-  {
-    if (match(*f_enventry->returnType, *body.type))
-    {
-      builder->CreateRet(body.value);
-    }
-    else
-    {
-      fatalError("function " + funcDec.funcname->id + " mismatch return type", funcDec.body->pos);
-    }
-  }
+  dropOwned(scope);
+  frames.pop_back();
+
+  if (f->returnType)
+    builder->CreateRet(body.value);
   else
   {
+    if (counted(funcDec.body->type))
+      drop(body.value);
     builder->CreateRetVoid();
   }
   builder->SetInsertPoint(saved);
@@ -953,90 +1174,587 @@ string CodeGenerator::newLabel(string topic)
   return "L" + to_string(label_id++) + topic;
 }
 
-void CodeGenerator::optimize()
+static OptimizationLevel passBuilderLevel(OptLevel level)
 {
-  for (auto &func : moduler->getFunctionList())
+  switch (level)
   {
-    functionPassManager->run(func);
+  case OptLevel::O0:
+    return OptimizationLevel::O0;
+  case OptLevel::O1:
+    return OptimizationLevel::O1;
+  case OptLevel::O2:
+    return OptimizationLevel::O2;
+  case OptLevel::O3:
+    return OptimizationLevel::O3;
+  case OptLevel::Os:
+    return OptimizationLevel::Os;
   }
+  llvm_unreachable("bad optimization level");
 }
 
-void CodeGenerator::generate(absyn::Exp &exp)
+CodeGenOpt::Level cg::codeGenOptLevel(OptLevel level)
 {
-  auto target_triple = sys::getDefaultTargetTriple();
-  string error;
-  auto target = TargetRegistry::lookupTarget(target_triple, error);
-  if (!target)
+  switch (level)
   {
-    errs() << error;
-    exit(1);
+  case OptLevel::O0:
+    return CodeGenOpt::None;
+  case OptLevel::O1:
+    return CodeGenOpt::Less;
+  case OptLevel::O2:
+  case OptLevel::Os:
+    return CodeGenOpt::Default;
+  case OptLevel::O3:
+    return CodeGenOpt::Aggressive;
   }
-  auto cpu = "generic";
-  auto features = "";
+  llvm_unreachable("bad optimization level");
+}
+
+// Resolves -mcpu=native and the host features, so that generators created from the
+// resolved options configure the same target machine without asking the host again.
+void cg::resolveTarget(CompileOptions &options)
+{
+  if (options.triple.empty())
+    options.triple = sys::getDefaultTargetTriple();
+  if (options.cpu == "native")
+    options.cpu = sys::getHostCPUName().str();
+
+  SubtargetFeatures features;
+  StringMap<bool> host_features;
+  if (options.hostFeatures && sys::getHostCPUFeatures(host_features))
+    for (auto &feature : host_features)
+      features.AddFeature(feature.first(), feature.second);
+  SubtargetFeatures user_features(options.features);
+  for (auto &feature : user_features.getFeatures())
+    features.AddFeature(feature);
+  options.features = features.getString();
+  options.hostFeatures = false;
+}
+
+void CodeGenerator::createTargetMachine()
+{
+  resolveTarget(options);
+  targetMachine = newTargetMachine();
+  moduler->setDataLayout(targetMachine->createDataLayout());
+  moduler->setTargetTriple(targetMachine->getTargetTriple().str());
+}
+
+// A TargetMachine may only be used by one thread at a time, so every backend thread
+// creates its own from the options resolved by createTargetMachine.
+std::unique_ptr<llvm::TargetMachine> CodeGenerator::newTargetMachine()
+{
+  auto &target_triple = options.triple;
   TargetOptions opt;
-  auto target_machine = target->createTargetMachine(target_triple, cpu, features, opt, Reloc::PIC_);
-  moduler->setDataLayout(target_machine->createDataLayout());
-  moduler->setTargetTriple(target_triple);
+  unique_ptr<TargetMachine> machine(lookupTarget(target_triple).createTargetMachine(
+      target_triple, options.cpu, options.features, opt,
+      options.relocModel, options.codeModel, codeGenOptLevel(options.optLevel)));
+  if (!machine)
+  {
+    throw utils::CompileError("could not create target machine for " + target_triple);
+  }
+  if (options.optLevel == OptLevel::O0)
+    machine->setFastISel(true);
+  return machine;
+}
+
+// IR-level passes such as the vectorizers read the subtarget from function attributes.
+void CodeGenerator::addTargetAttributes(llvm::Module &module)
+{
+  for (auto &func : module.functions())
+  {
+    if (func.isDeclaration())
+      continue;
+    func.addFnAttr("target-cpu", options.cpu);
+    if (!options.features.empty())
+      func.addFnAttr("target-features", options.features);
+  }
+}
+
+void CodeGenerator::optimize(llvm::Module &module)
+{
+  optimize(module, *targetMachine);
+}
+
+// Before a ThinLTO link the pipeline stops short of the passes that are better run once
+// functions from other modules have been imported.
+void CodeGenerator::optimize(llvm::Module &module, llvm::TargetMachine &machine, bool thinLTOPreLink)
+{
+  auto level = options.optLevel;
+
+  // -O0 is tuned for compile speed: neither this pipeline nor the emitter verifies the module.
+  if (level != OptLevel::O0 && verifyModule(module, &errs()))
+  {
+    throw utils::CompileError("generated module is broken");
+  }
+
+  if (level == OptLevel::Os)
+    for (auto &func : module.functions())
+      if (!func.isDeclaration())
+        func.addFnAttr(Attribute::OptimizeForSize);
+
+  PipelineTuningOptions tuning;
+  auto aggressive = level == OptLevel::O2 || level == OptLevel::O3 || level == OptLevel::Os;
+  tuning.LoopUnrolling = aggressive;
+  tuning.LoopInterleaving = aggressive;
+  tuning.LoopVectorization = aggressive;
+  tuning.SLPVectorization = aggressive;
+  tuning.MergeFunctions = aggressive;
+
+  LoopAnalysisManager loopAnalysisManager;
+  FunctionAnalysisManager functionAnalysisManager;
+  CGSCCAnalysisManager cgsccAnalysisManager;
+  ModuleAnalysisManager moduleAnalysisManager;
+  PassBuilder passBuilder(&machine, tuning);
+  passBuilder.registerModuleAnalyses(moduleAnalysisManager);
+  passBuilder.registerCGSCCAnalyses(cgsccAnalysisManager);
+  passBuilder.registerFunctionAnalyses(functionAnalysisManager);
+  passBuilder.registerLoopAnalyses(loopAnalysisManager);
+  passBuilder.crossRegisterProxies(loopAnalysisManager, functionAnalysisManager, cgsccAnalysisManager, moduleAnalysisManager);
+
+  ModulePassManager pipeline;
+  if (level == OptLevel::O0)
+    pipeline = passBuilder.buildO0DefaultPipeline(OptimizationLevel::O0, thinLTOPreLink);
+  else if (thinLTOPreLink)
+    pipeline = passBuilder.buildThinLTOPreLinkDefaultPipeline(passBuilderLevel(level));
+  else
+    pipeline = passBuilder.buildPerModuleDefaultPipeline(passBuilderLevel(level));
+  pipeline.run(module, moduleAnalysisManager);
+}
 
-  exp.accept(*this);
+// Functions of imported modules are defined along with the program, unless the bitcode
+// of the modules is linked in afterwards.
+void CodeGenerator::translate(absyn::Exp &exp, bool withModules)
+{
+  createTargetMachine();
+  analyzeMemory(&exp);
+  if (options.gc)
+  {
+    auto init = runtimeFunction(
+        gcInitFunction, "tiger_gc_init",
+        FunctionType::get(builder->getVoidTy(), {builder->getInt64Ty()}, false));
+    builder->CreateCall(init, {builder->getInt64(options.heapLimit)});
+  }
+  else if (options.rc)
+  {
+    auto init = runtimeFunction(
+        rcInitFunction, "tiger_rc_init",
+        FunctionType::get(builder->getVoidTy(), {}, false));
+    builder->CreateCall(init, {});
+  }
+  if (withModules)
+    for (auto module : checker.modules())
+      module->accept(*this);
+  auto result = exp.accept(*this);
+  if (counted(exp.type))
+    drop(result.value);
   builder->CreateRetVoid();
-  optimize();
+  linkRuntime();
+  addTargetAttributes(*moduler);
+}
+
+// The runtime is linked into the module before it is optimized, and its functions become
+// internal, so that small builtins such as ord and size are inlined and folded where they
+// are called. They are compiled for the target of the module, and a module for another
+// target than the one the runtime was built for keeps calling into libruntime.
+void CodeGenerator::linkRuntime()
+{
+#ifdef KALEC_RUNTIME_BITCODE
+  auto bitcode = StringRef(reinterpret_cast<const char *>(tigerRuntimeBitcode), tigerRuntimeBitcodeSize);
+  auto parsed = parseBitcodeFile(MemoryBufferRef(bitcode, "runtime"), *context);
+  if (!parsed)
+  {
+    throw utils::CompileError("could not read the runtime: " + toString(parsed.takeError()));
+  }
+  auto runtime = std::move(*parsed);
+  Triple target(moduler->getTargetTriple()), built(runtime->getTargetTriple());
+  if (target.getArch() != built.getArch() || target.getOS() != built.getOS())
+    return;
+  runtime->setTargetTriple(moduler->getTargetTriple());
+  runtime->setDataLayout(moduler->getDataLayout());
+
+  vector<string> names;
+  for (auto &func : runtime->functions())
+    if (!func.isDeclaration())
+      names.push_back(func.getName().str());
+  if (Linker::linkModules(*moduler, std::move(runtime), Linker::LinkOnlyNeeded))
+  {
+    throw utils::CompileError("could not link the runtime");
+  }
+
+  for (auto &name : names)
+  {
+    auto func = moduler->getFunction(name);
+    if (!func || func->isDeclaration())
+      continue;
+    func->setLinkage(GlobalValue::InternalLinkage);
+    runtimeDefinitions.insert(func);
+  }
+#endif
+}
+
+void CodeGenerator::generate(absyn::Exp &exp)
+{
+  translate(exp);
+  optimize(*moduler);
+}
 
-  auto filename = "main.o";
+void CodeGenerator::generateObject(absyn::Exp &exp, std::string filename)
+{
+  translate(exp);
+  if (options.jobs > 1)
+  {
+    emitParallel(filename);
+  }
+  else
+  {
+    optimize(*moduler);
+    emit(filename);
+  }
+}
+
+void CodeGenerator::emit(std::string filename)
+{
   error_code error_code;
   auto dest = raw_fd_ostream(filename, error_code, sys::fs::OF_None);
   if (error_code)
   {
-    errs() << "could not open file " << filename << "\n";
-    exit(1);
+    throw utils::CompileError("could not open file " + filename);
   }
+  emitObject(*moduler, *targetMachine, dest);
+  dest.flush();
+}
 
+void CodeGenerator::emitObject(llvm::Module &module, llvm::TargetMachine &machine, llvm::raw_pwrite_stream &dest)
+{
   legacy::PassManager pass;
   auto file_type = CodeGenFileType::CGFT_ObjectFile;
-  if (target_machine->addPassesToEmitFile(pass, dest, nullptr, file_type))
+  auto disable_verify = options.optLevel == OptLevel::O0;
+  if (machine.addPassesToEmitFile(pass, dest, nullptr, file_type, disable_verify))
   {
-    errs() << "target machine can not emit file of this type.\n";
-    exit(1);
+    throw utils::CompileError("target machine can not emit file of this type");
   }
-  pass.run(*moduler);
-  dest.flush();
+  pass.run(module);
 }
 
-TyValue CodeGenerator::mkVoid()
+static std::string temporaryObject()
+{
+  int fd;
+  SmallString<128> path;
+  if (sys::fs::createTemporaryFile("kalec", "o", fd, path))
+  {
+    throw utils::CompileError("could not create a temporary file");
+  }
+  sys::Process::SafelyCloseFileDescriptor(fd);
+  return path.str().str();
+}
+
+static void writeObject(const SmallString<0> &object, const std::string &path)
+{
+  error_code error_code;
+  raw_fd_ostream dest(path, error_code, sys::fs::OF_None);
+  if (error_code)
+  {
+    throw utils::CompileError("could not open file " + path);
+  }
+  dest << object;
+}
+
+// The module is split into one partition per job. Partitions move into contexts of their
+// own through bitcode, are optimized and emitted on a thread pool, and their objects are
+// linked in partition order. Partitioning only depends on the module and the number of
+// jobs, so the object is the same on every run.
+void CodeGenerator::emitParallel(std::string filename)
+{
+  vector<SmallString<0>> bitcodes;
+  SplitModule(*moduler, options.jobs, [&](unique_ptr<Module> part)
+              {
+                bitcodes.emplace_back();
+                raw_svector_ostream dest(bitcodes.back());
+                WriteBitcodeToFile(*part, dest); });
+
+  vector<SmallString<0>> objects(bitcodes.size());
+  compilePartitions(bitcodes, objects);
+
+  vector<string> paths;
+  for (auto &object : objects)
+  {
+    paths.push_back(temporaryObject());
+    writeObject(object, paths.back());
+  }
+  linkObjects(paths, filename);
+  for (auto &path : paths)
+    sys::fs::remove(path);
+}
+
+// Every function is compiled to an object of its own, stored under its fingerprint, and
+// only functions missing from the store are optimized and emitted again. Functions call
+// each other across objects, so none of them stays internal, and each one is optimized
+// without the bodies of the others. Every object gets a copy of the runtime to inline.
+void CodeGenerator::generateIncremental(absyn::Exp &exp, std::string filename, cache::Store &store, const std::vector<std::string> &configuration)
+{
+  translate(exp);
+  for (auto &func : moduler->functions())
+  {
+    if (func.hasLocalLinkage() && !runtimeDefinitions.count(&func))
+    {
+      func.setLinkage(GlobalValue::ExternalLinkage);
+      func.setVisibility(GlobalValue::HiddenVisibility);
+    }
+  }
+
+  sm::Fingerprint fingerprint;
+  vector<string> paths;
+  vector<size_t> missing;
+  vector<string> keys;
+  vector<SmallString<0>> bitcodes;
+  for (auto &function : checker.functions())
+  {
+    auto func = functions[function->id];
+    if (!func || func->isDeclaration())
+      continue;
+
+    auto body = function->dec ? function->dec->body : &exp;
+    auto key = cache::key(fingerprint.of(function.get(), *body), configuration);
+    paths.push_back(temporaryObject());
+    if (store.fetch(key, paths.back()))
+      continue;
+
+    ValueToValueMapTy map;
+    auto part = CloneModule(*moduler, map, [this, func](const GlobalValue *value)
+                            { return !isa<Function>(value) || value == func || runtimeDefinitions.count(value); });
+    // constants only used by other functions. A string literal refers to itself.
+    for (auto iter = part->global_begin(); iter != part->global_end();)
+    {
+      auto &global = *iter++;
+      global.removeDeadConstantUsers();
+      auto selfUse = [&](const Use &use)
+      {
+        auto user = dyn_cast<ConstantExpr>(use.getUser());
+        return user && user->hasOneUse() && *user->user_begin() == global.getInitializer();
+      };
+      if (global.hasLocalLinkage() && all_of(global.uses(), selfUse))
+      {
+        global.setInitializer(nullptr);
+        global.removeDeadConstantUsers();
+        global.eraseFromParent();
+      }
+    }
+
+    missing.push_back(paths.size() - 1);
+    keys.push_back(key);
+    bitcodes.emplace_back();
+    raw_svector_ostream dest(bitcodes.back());
+    WriteBitcodeToFile(*part, dest);
+  }
+
+  // objects go into the store only once every one of them compiled, so a failed build
+  // leaves no empty object under the fingerprint of a function.
+  vector<SmallString<0>> objects(bitcodes.size());
+  try
+  {
+    compilePartitions(bitcodes, objects);
+  }
+  catch (...)
+  {
+    for (auto &path : paths)
+      sys::fs::remove(path);
+    throw;
+  }
+  for (size_t i = 0; i < objects.size(); i++)
+    writeObject(objects[i], paths[missing[i]]);
+  for (size_t i = 0; i < objects.size(); i++)
+    store.insert(keys[i], paths[missing[i]]);
+
+  linkObjects(paths, filename);
+  for (auto &path : paths)
+    sys::fs::remove(path);
+}
+
+// Optimizes a module for a ThinLTO link and writes it as bitcode, along with the summary
+// the link reads to decide which functions to import across modules.
+void CodeGenerator::writeThinLTO(llvm::Module &module, llvm::raw_ostream &dest)
 {
-  return TyValue(make_shared<ty::Void>(), UndefValue::get(builder->getVoidTy()));
+  optimize(module, *targetMachine, true);
+  ProfileSummaryInfo profile(module);
+  auto index = buildModuleSummaryIndex(module, nullptr, &profile);
+  WriteBitcodeToFile(module, dest, false, &index);
 }
 
-void CodeGenerator::beginScope()
+// A library module is compiled once, to bitcode that programs importing it link against.
+// Functions it imports from other modules stay declarations.
+void CodeGenerator::generateModule(absyn::Let &module, std::string filename)
 {
-  namedValues.enter();
-  namedTypes.enter();
+  createTargetMachine();
+  analyzeMemory(nullptr);
+  for (auto &dec : module.decs)
+    dec->accept(*this);
+  auto &main = functions[checker.mainFunction()->id];
+  main->eraseFromParent();
+  main = nullptr;
+  linkRuntime();
+  addTargetAttributes(*moduler);
+
+  error_code error_code;
+  raw_fd_ostream dest(filename, error_code, sys::fs::OF_None);
+  if (error_code)
+  {
+    throw utils::CompileError("could not open file " + filename);
+  }
+  writeThinLTO(*moduler, dest);
 }
 
-void CodeGenerator::endScope()
+// The program is linked with the bitcode of the modules it imports by ThinLTO: every
+// module imports the small functions it calls from the others before it is optimized,
+// so helpers from libraries are still inlined, and modules are optimized and emitted
+// on as many threads as there are jobs.
+void CodeGenerator::generateLinked(absyn::Exp &exp, std::string filename, const std::vector<std::string> &modules)
 {
-  namedTypes.exit();
-  namedValues.exit();
+  translate(exp, false);
+  SmallString<0> program;
+  raw_svector_ostream dest(program);
+  writeThinLTO(*moduler, dest);
+
+  lto::Config config;
+  config.CPU = options.cpu;
+  config.MAttrs = SubtargetFeatures(options.features).getFeatures();
+  config.RelocModel = options.relocModel;
+  config.CodeModel = options.codeModel;
+  config.CGOptLevel = codeGenOptLevel(options.optLevel);
+  config.OptLevel = options.optLevel == OptLevel::Os ? 2 : static_cast<unsigned>(options.optLevel);
+  lto::LTO lto(std::move(config), lto::createInProcessThinBackend(heavyweight_hardware_concurrency(options.jobs)));
+
+  // main is the only symbol the linked object is entered through.
+  auto add = [&](MemoryBufferRef buffer)
+  {
+    auto input = lto::InputFile::create(buffer);
+    if (!input)
+    {
+      throw utils::CompileError("could not read " + buffer.getBufferIdentifier().str() + ": " + toString(input.takeError()));
+    }
+    vector<lto::SymbolResolution> resolutions;
+    for (auto &symbol : (*input)->symbols())
+    {
+      lto::SymbolResolution resolution;
+      resolution.Prevailing = !symbol.isUndefined();
+      resolution.FinalDefinitionInLinkageUnit = resolution.Prevailing;
+      resolution.VisibleToRegularObj = symbol.getName() == "main";
+      resolutions.push_back(resolution);
+    }
+    if (auto error = lto.add(std::move(*input), resolutions))
+    {
+      throw utils::CompileError("could not link " + buffer.getBufferIdentifier().str() + ": " + toString(std::move(error)));
+    }
+  };
+
+  add(MemoryBufferRef(program, "main module"));
+  vector<unique_ptr<MemoryBuffer>> buffers;
+  for (auto &module : modules)
+  {
+    auto buffer = MemoryBuffer::getFile(module);
+    if (!buffer)
+    {
+      throw utils::CompileError("could not open file " + module);
+    }
+    buffers.push_back(std::move(*buffer));
+    add(buffers.back()->getMemBufferRef());
+  }
+
+  vector<SmallString<0>> objects(lto.getMaxTasks());
+  auto stream = [&](unsigned task, const Twine &name) -> Expected<unique_ptr<CachedFileStream>>
+  { return make_unique<CachedFileStream>(make_unique<raw_svector_ostream>(objects[task])); };
+  if (auto error = lto.run(stream))
+  {
+    throw utils::CompileError("could not link " + filename + ": " + toString(std::move(error)));
+  }
+
+  vector<string> paths;
+  for (auto &object : objects)
+  {
+    if (object.empty())
+      continue;
+    paths.push_back(temporaryObject());
+    writeObject(object, paths.back());
+  }
+  linkObjects(paths, filename);
+  for (auto &path : paths)
+    sys::fs::remove(path);
 }
 
-void CodeGenerator::reportError(std::string error, absyn::position pos)
+// Each module is read into a context of its own, so that modules can be optimized and
+// emitted on as many threads as there are jobs. A partition that fails keeps its error,
+// and the first one is thrown once every partition is done.
+void CodeGenerator::compilePartitions(const std::vector<llvm::SmallString<0>> &bitcodes, std::vector<llvm::SmallString<0>> &objects)
 {
-  errs() << error << " (row: " << pos.line
-         << ", column: " << pos.column << ").\n";
+  ThreadPool pool(hardware_concurrency(options.jobs));
+  vector<exception_ptr> errors(bitcodes.size());
+  for (size_t i = 0; i < bitcodes.size(); i++)
+  {
+    pool.async([this, &bitcodes, &objects, &errors, i]()
+               {
+                 try
+                 {
+                   LLVMContext context;
+                   auto part = parseBitcodeFile(MemoryBufferRef(bitcodes[i], "partition"), context);
+                   if (!part)
+                   {
+                     throw utils::CompileError("could not read partition: " + toString(part.takeError()));
+                   }
+                   auto machine = newTargetMachine();
+                   optimize(**part, *machine);
+                   raw_svector_ostream dest(objects[i]);
+                   emitObject(**part, *machine, dest);
+                 }
+                 catch (...)
+                 {
+                   errors[i] = current_exception();
+                 } });
+  }
+  pool.wait();
+  for (auto &error : errors)
+    if (error)
+      rethrow_exception(error);
 }
 
-void CodeGenerator::fatalError(std::string error, absyn::position pos)
+// Combines the objects into one relocatable object with the system linker.
+void CodeGenerator::linkObjects(const std::vector<std::string> &paths, std::string filename)
 {
-  reportError(error, pos);
-  exit(1);
+  auto ld = sys::findProgramByName("ld");
+  if (!ld)
+  {
+    throw utils::CompileError("could not find ld to link " + filename);
+  }
+
+  vector<StringRef> args = {*ld, "-r", "-o", filename};
+  for (auto &path : paths)
+    args.push_back(path);
+  string error;
+  if (sys::ExecuteAndWait(*ld, args, std::nullopt, {}, 0, 0, &error) != 0)
+  {
+    throw utils::CompileError("could not link " + filename + ": " + error);
+  }
+}
+
+void CodeGenerator::emitIR(std::string filename)
+{
+  error_code error_code;
+  auto dest = raw_fd_ostream(filename, error_code, sys::fs::OF_Text);
+  if (error_code)
+  {
+    throw utils::CompileError("could not open file " + filename);
+  }
+  moduler->print(dest, nullptr);
 }
 
-VarEnventry::VarEnventry(std::shared_ptr<ty::Type> type, llvm::AllocaInst *alloca)
-    : type(type) { this->alloca = alloca; }
+std::unique_ptr<LLVMContext> CodeGenerator::takeContext()
+{
+  return std::move(context);
+}
 
-FuncEnventry::FuncEnventry(
-    std::string name,
-    std::shared_ptr<ty::Type> returnType,
-    std::vector<std::shared_ptr<ty::Type>> args) : name(name), returnType(returnType), args(args)
+const CompileOptions &CodeGenerator::compileOptions() const
+{
+  return options;
+}
+
+TyValue CodeGenerator::mkVoid()
 {
+  return TyValue(checker.typeContext().voidType(), UndefValue::get(builder->getVoidTy()));
 }
@@ -0,0 +1,248 @@
+#include "fingerprint.h"
+
+using namespace sm;
+using namespace absyn;
+using namespace std;
+
+std::string Fingerprint::of(const Function *function, absyn::Exp &body)
+{
+  out.str("");
+  current = function;
+  out << "fn ";
+  signature(function);
+  if (function->dec)
+    for (auto param : function->dec->parameters)
+      variable(param->variable);
+  body.accept(*this);
+  return out.str();
+}
+
+// Only what the generated code sees: the representation of a type, and for records the
+// representation of each field in layout order.
+void Fingerprint::type(const ty::Type *type)
+{
+  type = ty::actualTy(type);
+  switch (type->kind)
+  {
+  case ty::Kind::Void:
+    out << "v ";
+    break;
+  case ty::Kind::Nil:
+    out << "n ";
+    break;
+  case ty::Kind::Int:
+    out << "i ";
+    break;
+  case ty::Kind::String:
+    out << "s ";
+    break;
+  case ty::Kind::Array:
+    out << "a ";
+    break;
+  case ty::Kind::Record:
+  {
+    auto record = static_cast<const ty::Record *>(type);
+    out << "r" << record->fields.size() << " ";
+    for (auto &field : record->fields)
+      out << (ty::isA(field.second, ty::Kind::Int) ? 'i' : 'p');
+    out << " ";
+    break;
+  }
+  case ty::Kind::Named:
+    break;
+  }
+}
+
+void Fingerprint::variable(const Variable *variable)
+{
+  if (variable->owner == current)
+    out << "l" << variable->slot << " ";
+  else
+    out << "c" << current->captureIndex(variable) << " ";
+  if (variable->borrowed)
+    out << "borrowed ";
+  if (variable->captured)
+    out << "captured ";
+  type(variable->type);
+}
+
+void Fingerprint::signature(const Function *function)
+{
+  out << function->name.size() << ":" << function->name << " ";
+  for (auto arg : function->args)
+    type(arg);
+  out << "-> ";
+  if (function->returnType)
+    type(function->returnType);
+  out << function->captures.size() << " ";
+  // callers keep the references of borrowed parameters.
+  if (function->dec)
+    for (auto param : function->dec->parameters)
+      out << (param->variable->borrowed ? "b" : "o");
+  out << " ";
+}
+
+void Fingerprint::visit(Nil &n)
+{
+  out << "nil ";
+}
+
+void Fingerprint::visit(Int &i)
+{
+  out << "int " << i.value << " ";
+}
+
+void Fingerprint::visit(String &s)
+{
+  out << "str " << s.value.size() << ":" << s.value << " ";
+}
+
+void Fingerprint::visit(VarExp &var)
+{
+  out << (var.move ? "load move " : "load ");
+  var.var->accept(*this);
+}
+
+void Fingerprint::visit(Assign &assign)
+{
+  out << "assign ";
+  assign.var->accept(*this);
+  assign.exp->accept(*this);
+}
+
+void Fingerprint::visit(Seq &seq)
+{
+  out << "seq " << seq.seq.size() << " ";
+  for (auto exp : seq.seq)
+    exp->accept(*this);
+}
+
+// a call passes the addresses of the callee's captures, as the caller sees them.
+void Fingerprint::visit(Call &call)
+{
+  out << "call ";
+  signature(call.function);
+  for (auto captured : call.function->captures)
+    variable(captured);
+  for (auto arg : call.args)
+    arg->accept(*this);
+}
+
+void Fingerprint::visit(BinOp &bin)
+{
+  out << "op" << static_cast<int>(bin.op) << " ";
+  type(bin.lhs->type);
+  bin.lhs->accept(*this);
+  bin.rhs->accept(*this);
+}
+
+void Fingerprint::visit(RecordExp &record)
+{
+  out << (record.regional ? "record region " : record.stack ? "record stack " : "record ");
+  if (record.reuse)
+  {
+    out << "reuse " << record.moved << " ";
+    variable(record.reuse);
+  }
+  type(record.type);
+  out << record.records.size() << " ";
+  for (auto rcd : record.records)
+  {
+    out << rcd->index << " ";
+    rcd->value->accept(*this);
+  }
+}
+
+void Fingerprint::visit(Array &array)
+{
+  out << (array.regional ? "array region " : array.stack ? "array stack " : "array ");
+  if (array.stack)
+    out << array.length << " ";
+  type(ty::asArray(array.type)->type);
+  array.capacity->accept(*this);
+  array.element->accept(*this);
+}
+
+void Fingerprint::visit(If &iff)
+{
+  out << (iff.els ? "ifelse " : "if ");
+  type(iff.type);
+  iff.condition->accept(*this);
+  iff.then->accept(*this);
+  if (iff.els)
+    iff.els->accept(*this);
+}
+
+void Fingerprint::visit(While &whil)
+{
+  out << "while ";
+  whil.condition->accept(*this);
+  whil.body->accept(*this);
+}
+
+void Fingerprint::visit(For &forr)
+{
+  out << "for ";
+  variable(forr.variable);
+  forr.from->accept(*this);
+  forr.to->accept(*this);
+  forr.body->accept(*this);
+}
+
+void Fingerprint::visit(Break &brk)
+{
+  out << "break ";
+}
+
+void Fingerprint::visit(Let &let)
+{
+  out << (let.region ? "let region " : "let ");
+  for (auto dec : let.decs)
+    dec->accept(*this);
+  out << "in ";
+  let.body->accept(*this);
+}
+
+void Fingerprint::visit(SimpleVar &var)
+{
+  out << "var ";
+  variable(var.variable);
+}
+
+void Fingerprint::visit(FieldVar &field)
+{
+  out << (field.move ? "field move " : "field ") << field.index << " ";
+  type(field.var->type);
+  field.var->accept(*this);
+}
+
+void Fingerprint::visit(SubscriptVar &subscript)
+{
+  out << "subscript ";
+  type(subscript.type);
+  subscript.var->accept(*this);
+  subscript.subscript->accept(*this);
+}
+
+void Fingerprint::visit(ID &id) {}
+
+void Fingerprint::visit(Record &record) {}
+
+void Fingerprint::visit(Field &field) {}
+
+void Fingerprint::visit(NamedType &named) {}
+
+void Fingerprint::visit(ArrayType &arrayType) {}
+
+void Fingerprint::visit(RecordType &recordType) {}
+
+void Fingerprint::visit(TypeDec &typeDec) {}
+
+void Fingerprint::visit(VarDec &varDec)
+{
+  out << "vardec ";
+  variable(varDec.variable);
+  varDec.exp->accept(*this);
+}
+
+void Fingerprint::visit(FunctionDec &funcDec) {}
@@ -0,0 +1,117 @@
+#include "fold.h"
+#include "semant.h"
+
+using namespace sm;
+using namespace absyn;
+using namespace std;
+
+namespace
+{
+  optional<int64_t> number(const Exp &exp)
+  {
+    auto value = fold(exp);
+    if (value && holds_alternative<int64_t>(*value))
+      return get<int64_t>(*value);
+    return nullopt;
+  }
+
+  optional<string> text(const Exp &exp)
+  {
+    auto value = fold(exp);
+    if (value && holds_alternative<string>(*value))
+      return get<string>(std::move(*value));
+    return nullopt;
+  }
+
+  // same results as the runtime, which orders strings as bytes and then by length.
+  int64_t compare(const string &a, const string &b)
+  {
+    auto order = a.compare(b);
+    return order < 0 ? -1 : order > 0;
+  }
+
+  optional<Constant> call(const Call &call)
+  {
+    auto &name = call.function->name;
+    auto &args = call.args;
+    if (name == "tiger_ord")
+    {
+      if (auto s = text(*args[0]))
+        return s->empty() ? -1 : static_cast<int64_t>(static_cast<unsigned char>((*s)[0]));
+    }
+    else if (name == "tiger_size")
+    {
+      if (auto s = text(*args[0]))
+        return static_cast<int64_t>(s->size());
+    }
+    else if (name == "tiger_chr")
+    {
+      auto i = number(*args[0]);
+      if (i && *i >= 0 && *i <= 255)
+        return string(1, static_cast<char>(*i));
+    }
+    else if (name == "tiger_substring")
+    {
+      auto s = text(*args[0]);
+      auto first = number(*args[1]), n = number(*args[2]);
+      if (s && first && n && *first >= 0 && *n >= 0 && *first <= static_cast<int64_t>(s->size()) - *n)
+        return s->substr(*first, *n);
+    }
+    else if (name == "tiger_concat")
+    {
+      auto a = text(*args[0]), b = text(*args[1]);
+      if (a && b)
+        return *a + *b;
+    }
+    else if (name == "tiger_not")
+    {
+      if (auto i = number(*args[0]))
+        return static_cast<int64_t>(*i == 0);
+    }
+    else if (name == "tiger_string_compare")
+    {
+      auto a = text(*args[0]), b = text(*args[1]);
+      if (a && b)
+        return compare(*a, *b);
+    }
+    return nullopt;
+  }
+}
+
+std::optional<Constant> sm::fold(const absyn::Exp &exp)
+{
+  if (auto i = dynamic_cast<const Int *>(&exp))
+    return static_cast<int64_t>(i->value);
+  if (auto s = dynamic_cast<const String *>(&exp))
+    return s->value;
+  if (auto c = dynamic_cast<const Call *>(&exp))
+  {
+    if (c->function->isBuiltin())
+      return call(*c);
+    return nullopt;
+  }
+
+  // comparisons of strings, the only operators the runtime evaluates.
+  auto bin = dynamic_cast<const BinOp *>(&exp);
+  if (!bin || !isRelOp(bin->op) || !ty::isA(bin->lhs->type, ty::Kind::String))
+    return nullopt;
+  auto a = text(*bin->lhs), b = text(*bin->rhs);
+  if (!a || !b)
+    return nullopt;
+  auto order = compare(*a, *b);
+  switch (bin->op)
+  {
+  case Oper::eqOp:
+    return static_cast<int64_t>(order == 0);
+  case Oper::neqOp:
+    return static_cast<int64_t>(order != 0);
+  case Oper::ltOp:
+    return static_cast<int64_t>(order < 0);
+  case Oper::leOp:
+    return static_cast<int64_t>(order <= 0);
+  case Oper::gtOp:
+    return static_cast<int64_t>(order > 0);
+  default:
+    return static_cast<int64_t>(order >= 0);
+  }
+}
@@ -0,0 +1,364 @@
+#include <cstdlib>
+#include <map>
+#include "interp.h"
+#include "runtime.h"
+
+using namespace interp;
+using namespace absyn;
+using namespace std;
+
+namespace
+{
+  struct BreakException
+  {
+  };
+
+  const tiger_string *str(int64_t value)
+  {
+    return reinterpret_cast<const tiger_string *>(value);
+  }
+
+  int64_t val(const void *pointer)
+  {
+    return reinterpret_cast<int64_t>(pointer);
+  }
+
+  const map<string, int64_t (*)(const int64_t *)> builtins = {
+      {"tiger_print", [](const int64_t *args) -> int64_t
+       { tiger_print(str(args[0])); return 0; }},
+      {"tiger_flush", [](const int64_t *args) -> int64_t
+       { tiger_flush(); return 0; }},
+      {"tiger_getchar", [](const int64_t *args) -> int64_t
+       { return val(tiger_getchar()); }},
+      {"tiger_ord", [](const int64_t *args) -> int64_t
+       { return tiger_ord(str(args[0])); }},
+      {"tiger_chr", [](const int64_t *args) -> int64_t
+       { return val(tiger_chr(args[0])); }},
+      {"tiger_size", [](const int64_t *args) -> int64_t
+       { return tiger_size(str(args[0])); }},
+      {"tiger_substring", [](const int64_t *args) -> int64_t
+       { return val(tiger_substring(str(args[0]), args[1], args[2])); }},
+      {"tiger_concat", [](const int64_t *args) -> int64_t
+       { return val(tiger_concat(str(args[0]), str(args[1]))); }},
+      {"tiger_not", [](const int64_t *args) -> int64_t
+       { return tiger_not(args[0]); }},
+      {"tiger_exit", [](const int64_t *args) -> int64_t
+       { tiger_exit(args[0]); return 0; }},
+      {"tiger_string_compare", [](const int64_t *args) -> int64_t
+       { return tiger_string_compare(str(args[0]), str(args[1])); }},
+  };
+
+  Interpreter *active = nullptr;
+}
+
+// Compiled code calls functions that are still interpreted through this bridge.
+extern "C" int64_t tiger_tier_call(int64_t id, const int64_t *args)
+{
+  return active->call(active->function(id), args);
+}
+
+Interpreter::Interpreter(const sm::Checker &checker, Tier *tier, int64_t threshold)
+    : checker(checker), tier(tier), threshold(threshold), states(checker.functions().size())
+{
+  for (auto &function : checker.functions())
+    if (function->isBuiltin())
+      states[function->id].builtin = builtins.at(function->name);
+  active = this;
+}
+
+Interpreter::~Interpreter()
+{
+  if (active == this)
+    active = nullptr;
+}
+
+void Interpreter::run(absyn::Exp &exp)
+{
+  auto main = checker.mainFunction();
+  vector<int64_t> slots(main->frameSize);
+  Frame main_frame{main, slots.data(), nullptr};
+  frame = &main_frame;
+  evaluate(exp);
+  frame = nullptr;
+}
+
+int64_t Interpreter::call(const sm::Function *function, const int64_t *args)
+{
+  auto &state = states[function->id];
+  if (state.builtin)
+    return state.builtin(args);
+  if (!state.entry && !state.failed && ++state.counter >= threshold)
+    tierUp(function);
+  if (state.entry)
+    return state.entry(args);
+
+  int64_t inline_slots[16];
+  vector<int64_t> heap_slots(function->frameSize > 16 ? function->frameSize : 0);
+  Frame callee{
+      function,
+      heap_slots.empty() ? inline_slots : heap_slots.data(),
+      reinterpret_cast<int64_t *const *>(args + function->args.size())};
+  copy(args, args + function->args.size(), callee.slots);
+
+  auto caller = frame;
+  frame = &callee;
+  auto result = evaluate(*function->dec->body);
+  frame = caller;
+  return result;
+}
+
+const sm::Function *Interpreter::function(int64_t id) const
+{
+  return checker.functions()[id].get();
+}
+
+int64_t Interpreter::evaluate(absyn::Exp &exp)
+{
+  exp.accept(*this);
+  return value;
+}
+
+int64_t *Interpreter::locate(absyn::Var &var)
+{
+  var.accept(*this);
+  return address;
+}
+
+int64_t *Interpreter::lookup(const sm::Variable *variable)
+{
+  if (variable->owner == frame->function)
+    return frame->slots + variable->slot;
+  return frame->captures[frame->function->captureIndex(variable)];
+}
+
+// Loops count towards the hotness of the function they run in, the current activation
+// keeps interpreting and the next call enters the compiled code.
+void Interpreter::countBackEdge()
+{
+  auto function = frame->function;
+  auto &state = states[function->id];
+  if (function->dec && !state.entry && !state.failed && ++state.counter >= threshold)
+    tierUp(function);
+}
+
+void Interpreter::tierUp(const sm::Function *function)
+{
+  auto &state = states[function->id];
+  state.entry = tier ? tier->compile(function) : nullptr;
+  state.failed = !state.entry;
+}
+
+void Interpreter::visit(Nil &n)
+{
+  value = 0;
+}
+
+void Interpreter::visit(Int &i)
+{
+  value = i.value;
+}
+
+void Interpreter::visit(String &s)
+{
+  auto &literal = literals[&s];
+  if (!literal.data)
+    literal = {static_cast<int64_t>(s.value.size()), s.value.data()};
+  value = val(&literal);
+}
+
+void Interpreter::visit(VarExp &var)
+{
+  value = *locate(*var.var);
+}
+
+void Interpreter::visit(Assign &assign)
+{
+  auto target = locate(*assign.var);
+  *target = evaluate(*assign.exp);
+  value = 0;
+}
+
+void Interpreter::visit(Seq &seq)
+{
+  value = 0;
+  for (auto &exp : seq.seq)
+    evaluate(*exp);
+}
+
+void Interpreter::visit(Call &call)
+{
+  auto function = call.function;
+  auto count = call.args.size() + function->captures.size();
+  int64_t inline_args[8];
+  vector<int64_t> heap_args(count > 8 ? count : 0);
+  auto args = heap_args.empty() ? inline_args : heap_args.data();
+
+  auto arg = args;
+  for (auto &exp : call.args)
+    *arg++ = evaluate(*exp);
+  for (auto captured : function->captures)
+    *arg++ = val(lookup(captured));
+
+  value = this->call(function, args);
+}
+
+void Interpreter::visit(BinOp &bin)
+{
+  auto lhs = evaluate(*bin.lhs);
+  auto rhs = evaluate(*bin.rhs);
+  if (isRelOp(bin.op) && ty::isA(bin.lhs->type, ty::Kind::String))
+  {
+    lhs = tiger_string_compare(str(lhs), str(rhs));
+    rhs = 0;
+  }
+
+  // wraps around on overflow like the compiled code.
+  auto ulhs = static_cast<uint64_t>(lhs), urhs = static_cast<uint64_t>(rhs);
+  switch (bin.op)
+  {
+  case Oper::plusOp:
+    value = static_cast<int64_t>(ulhs + urhs);
+    break;
+  case Oper::minusOp:
+    value = static_cast<int64_t>(ulhs - urhs);
+    break;
+  case Oper::timesOp:
+    value = static_cast<int64_t>(ulhs * urhs);
+    break;
+  case Oper::divideOp:
+    value = lhs / rhs;
+    break;
+  case Oper::eqOp:
+    value = lhs == rhs;
+    break;
+  case Oper::neqOp:
+    value = lhs != rhs;
+    break;
+  case Oper::ltOp:
+    value = lhs < rhs;
+    break;
+  case Oper::leOp:
+    value = lhs <= rhs;
+    break;
+  case Oper::gtOp:
+    value = lhs > rhs;
+    break;
+  case Oper::geOp:
+    value = lhs >= rhs;
+    break;
+  }
+}
+
+void Interpreter::visit(RecordExp &record)
+{
+  auto record_ty = ty::asRecord(record.type);
+  auto fields = static_cast<int64_t *>(malloc(sizeof(int64_t) * record_ty->fields.size()));
+  for (auto &rcd : record.records)
+    fields[rcd->index] = evaluate(*rcd->value);
+  value = val(fields);
+}
+
+void Interpreter::visit(Array &array)
+{
+  auto capacity = evaluate(*array.capacity);
+  auto element = evaluate(*array.element);
+  auto elements = malloc(sizeof(int64_t) * capacity);
+  tiger_array_initialize(elements, &element, capacity, sizeof(int64_t));
+  value = val(elements);
+}
+
+void Interpreter::visit(If &iff)
+{
+  if (evaluate(*iff.condition))
+    evaluate(*iff.then);
+  else if (iff.els)
+    evaluate(*iff.els);
+  else
+    value = 0;
+}
+
+void Interpreter::visit(While &whil)
+{
+  try
+  {
+    while (evaluate(*whil.condition))
+    {
+      evaluate(*whil.body);
+      countBackEdge();
+    }
+  }
+  catch (const BreakException &)
+  {
+  }
+  value = 0;
+}
+
+void Interpreter::visit(For &forr)
+{
+  auto from = evaluate(*forr.from);
+  auto to = evaluate(*forr.to);
+  auto counter = lookup(forr.variable);
+  try
+  {
+    for (*counter = from; *counter <= to; ++*counter)
+    {
+      evaluate(*forr.body);
+      countBackEdge();
+    }
+  }
+  catch (const BreakException &)
+  {
+  }
+  value = 0;
+}
+
+void Interpreter::visit(Break &brk)
+{
+  throw BreakException();
+}
+
+void Interpreter::visit(Let &let)
+{
+  for (auto &dec : let.decs)
+    dec->accept(*this);
+  evaluate(*let.body);
+}
+
+void Interpreter::visit(SimpleVar &var)
+{
+  address = lookup(var.variable);
+}
+
+void Interpreter::visit(FieldVar &field)
+{
+  auto record = reinterpret_cast<int64_t *>(*locate(*field.var));
+  address = record + field.index;
+}
+
+void Interpreter::visit(SubscriptVar &subscript)
+{
+  auto array = reinterpret_cast<int64_t *>(*locate(*subscript.var));
+  address = array + evaluate(*subscript.subscript);
+}
+
+void Interpreter::visit(ID &id) {}
+
+void Interpreter::visit(Record &record) {}
+
+void Interpreter::visit(Field &field) {}
+
+void Interpreter::visit(NamedType &named) {}
+
+void Interpreter::visit(ArrayType &arrayType) {}
+
+void Interpreter::visit(RecordType &recordType) {}
+
+void Interpreter::visit(TypeDec &typeDec) {}
+
+void Interpreter::visit(VarDec &varDec)
+{
+  auto slot = lookup(varDec.variable);
+  *slot = evaluate(*varDec.exp);
+}
+
+void Interpreter::visit(FunctionDec &funcDec) {}
@@ -0,0 +1,133 @@
+#include <llvm/ExecutionEngine/Orc/ExecutionUtils.h>
+#include <llvm/ExecutionEngine/Orc/JITTargetMachineBuilder.h>
+#include <llvm/ExecutionEngine/Orc/ThreadSafeModule.h>
+#include <llvm/Support/TargetSelect.h>
+#include <llvm/Support/raw_ostream.h>
+#include "jit.h"
+#include "runtime.h"
+
+// the head of the shadow stack, defined by the collector of the runtime.
+extern "C" void *llvm_gc_root_chain;
+
+using namespace cg;
+using namespace llvm;
+using namespace std;
+
+template <typename T>
+static T exitOnError(Expected<T> value)
+{
+  if (!value)
+  {
+    errs() << toString(value.takeError()) << "\n";
+    exit(1);
+  }
+  return std::move(*value);
+}
+
+static void exitOnError(Error error)
+{
+  if (error)
+  {
+    errs() << toString(std::move(error)) << "\n";
+    exit(1);
+  }
+}
+
+JIT::JIT(const CompileOptions &options)
+{
+  InitializeNativeTarget();
+  InitializeNativeTargetAsmPrinter();
+  auto machine = exitOnError(orc::JITTargetMachineBuilder::detectHost());
+  machine.setCodeGenOptLevel(codeGenOptLevel(options.optLevel));
+  jit = exitOnError(orc::LLJITBuilder().setJITTargetMachineBuilder(std::move(machine)).create());
+  defineRuntime();
+}
+
+void JIT::defineRuntime()
+{
+  auto &dylib = jit->getMainJITDylib();
+  orc::SymbolMap symbols;
+  auto define = [&](const char *name, auto *address)
+  {
+    symbols[jit->mangleAndIntern(name)] = orc::ExecutorSymbolDef(
+        orc::ExecutorAddr::fromPtr(address), JITSymbolFlags::Exported | JITSymbolFlags::Callable);
+  };
+
+  define("tiger_print", &tiger_print);
+  define("tiger_flush", &tiger_flush);
+  define("tiger_getchar", &tiger_getchar);
+  define("tiger_ord", &tiger_ord);
+  define("tiger_chr", &tiger_chr);
+  define("tiger_size", &tiger_size);
+  define("tiger_substring", &tiger_substring);
+  define("tiger_concat", &tiger_concat);
+  define("tiger_concat_n", &tiger_concat_n);
+  define("tiger_not", &tiger_not);
+  define("tiger_exit", &tiger_exit);
+  define("tiger_string_compare", &tiger_string_compare);
+  define("tiger_string_equal", &tiger_string_equal);
+  define("tiger_array_initialize", &tiger_array_initialize);
+  // the runtime linked into every module allocates through the memory managers, whether
+  // the module collects or not.
+  define("tiger_gc_init", &tiger_gc_init);
+  define("tiger_gc_alloc", &tiger_gc_alloc);
+  define("tiger_gc_new_array", &tiger_gc_new_array);
+  define("tiger_gc_write", &tiger_gc_write);
+  define("tiger_gc_type", &tiger_gc_type);
+  define("tiger_gc_push_roots", &tiger_gc_push_roots);
+  define("tiger_gc_pop_roots", &tiger_gc_pop_roots);
+  define("tiger_region_enter", &tiger_region_enter);
+  define("tiger_region_alloc", &tiger_region_alloc);
+  define("tiger_region_new_array", &tiger_region_new_array);
+  define("tiger_region_exit", &tiger_region_exit);
+  define("tiger_rc_init", &tiger_rc_init);
+  define("tiger_rc_alloc", &tiger_rc_alloc);
+  define("tiger_rc_new_array", &tiger_rc_new_array);
+  define("tiger_rc_dup", &tiger_rc_dup);
+  define("tiger_rc_drop", &tiger_rc_drop);
+  define("tiger_rc_unique", &tiger_rc_unique);
+  define("tiger_rc_reuse", &tiger_rc_reuse);
+  define("tiger_rc_type", &tiger_rc_type);
+  auto data = [&](const char *name, const void *address)
+  {
+    symbols[jit->mangleAndIntern(name)] = orc::ExecutorSymbolDef(
+        orc::ExecutorAddr::fromPtr(address), JITSymbolFlags::Exported);
+  };
+  data("tiger_string_type", &tiger_string_type);
+  data("tiger_rope_type", &tiger_rope_type);
+  data("tiger_rc_enabled", &tiger_rc_enabled);
+  data("llvm_gc_root_chain", &llvm_gc_root_chain);
+  exitOnError(dylib.define(orc::absoluteSymbols(std::move(symbols))));
+
+  // malloc and the rest of libc come from the host process.
+  auto prefix = jit->getDataLayout().getGlobalPrefix();
+  dylib.addGenerator(exitOnError(orc::DynamicLibrarySearchGenerator::GetForCurrentProcess(prefix)));
+}
+
+const DataLayout &JIT::getDataLayout() const
+{
+  return jit->getDataLayout();
+}
+
+void JIT::addModule(std::unique_ptr<Module> module, std::unique_ptr<LLVMContext> context)
+{
+  addModule(std::move(module), orc::ThreadSafeContext(std::move(context)));
+}
+
+void JIT::addModule(std::unique_ptr<Module> module, orc::ThreadSafeContext context)
+{
+  exitOnError(jit->addIRModule(orc::ThreadSafeModule(std::move(module), std::move(context))));
+}
+
+void JIT::define(std::string name, void *address)
+{
+  orc::SymbolMap symbols;
+  symbols[jit->mangleAndIntern(name)] = orc::ExecutorSymbolDef(
+      orc::ExecutorAddr::fromPtr(address), JITSymbolFlags::Exported | JITSymbolFlags::Callable);
+  exitOnError(jit->getMainJITDylib().define(orc::absoluteSymbols(std::move(symbols))));
+}
+
+void *JIT::lookup(std::string name)
+{
+  return exitOnError(jit->lookup(name)).toPtr<void *>();
+}
@@ -16,9 +16,8 @@
     using y = yy::TigerParser;
 
     void yy::TigerLexer::lexerError(string reason, yy::location loc) {
-        cerr << "lexer error reason: " << reason << " (row: "
-            << loc.begin.line << ", column: " << loc.begin.column << ")." << endl;
-        exit(1);
+        throw utils::CompileError("lexer error reason: " + reason + " (row: " + to_string(loc.begin.line) +
+                                  ", column: " + to_string(loc.begin.column) + ").");
     }
 %}
 
@@ -74,6 +73,7 @@ ID          [a-zA-Z_][a-zA-Z0-9_]*
 "do"                        { return y::make_DO(loc); }
 "of"                        { return y::make_OF(loc); }
 "nil"                       { return y::make_NIL(loc); }
+"import"                    { return y::make_IMPORT(loc); }
 ","                         { return y::make_COMMA(loc); }
 ":"                         { return y::make_COLON(loc); }
 ";"                         { return y::make_SEMICOLON(loc); }
@@ -98,7 +98,7 @@ ID          [a-zA-Z_][a-zA-Z0-9_]*
 "|"                         { return y::make_OR(loc); }
 ":="                        { return y::make_ASSIGN(loc); }
 {DIGIT}+                    { return y::make_INT(atoi(yytext), loc); }
-{ID}                        { return y::make_ID(yytext, loc); }
+{ID}                        { return y::make_ID(sym::intern(string_view(yytext, yyleng)), loc); }
 .                           { lexerError("unexcepted token " + string(yytext), loc); }
 <<EOF>>                     { return y::make_EOF(loc); }
 
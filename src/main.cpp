@@ -1,53 +1,889 @@
 #include <iostream>
+#include <fstream>
 #include <memory>
+#include <mutex>
+#include <atomic>
 #include <sstream>
+#include <map>
+#include <chrono>
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <algorithm>
+#include <thread>
 #include <argparse/argparse.hpp>
+#include <llvm/Config/llvm-config.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/Path.h>
+#include <llvm/Support/ThreadPool.h>
 #include "parser.tab.hpp"
 #include "TigerLexer.h"
 #include "absyn.h"
+#include "bytecode.h"
+#include "cache.h"
 #include "codegen.h"
+#include "jit.h"
+#include "interp.h"
+#include "semant.h"
+#include "server.h"
 #include "types.h"
+#include "utils.h"
 
 using namespace std;
 using namespace absyn;
 
-int main(int argc, char *argv[])
+static const pair<const char *, cg::OptLevel> optFlags[] = {
+    {"-O0", cg::OptLevel::O0},
+    {"-O1", cg::OptLevel::O1},
+    {"-O2", cg::OptLevel::O2},
+    {"-O3", cg::OptLevel::O3},
+    {"-Os", cg::OptLevel::Os},
+};
+
+static const map<string, llvm::Reloc::Model> relocModels = {
+    {"static", llvm::Reloc::Static},
+    {"pic", llvm::Reloc::PIC_},
+    {"dynamic-no-pic", llvm::Reloc::DynamicNoPIC},
+};
+
+static const map<string, llvm::CodeModel::Model> codeModels = {
+    {"tiny", llvm::CodeModel::Tiny},
+    {"small", llvm::CodeModel::Small},
+    {"kernel", llvm::CodeModel::Kernel},
+    {"medium", llvm::CodeModel::Medium},
+    {"large", llvm::CodeModel::Large},
+};
+
+static void addCodegenArguments(argparse::ArgumentParser &program)
+{
+  program.add_argument("-O0")
+      .help("no optimization, fast instruction selection and no verifier")
+      .implicit_value(true)
+      .default_value(false);
+
+  program.add_argument("-O1")
+      .help("light optimization")
+      .implicit_value(true)
+      .default_value(false);
+
+  program.add_argument("-O2")
+      .help("default optimization, with inlining, vectorization and function merging")
+      .implicit_value(true)
+      .default_value(false);
+
+  program.add_argument("-O3")
+      .help("aggressive optimization")
+      .implicit_value(true)
+      .default_value(false);
+
+  program.add_argument("-Os")
+      .help("optimize for code size")
+      .implicit_value(true)
+      .default_value(false);
+
+  program.add_argument("-target")
+      .help("target triple, defaults to the host; other targets need kalec built with KALEC_ALL_TARGETS")
+      .metavar("triple")
+      .default_value(string(""));
+
+  program.add_argument("-mcpu")
+      .help("target cpu, \"native\" for the host cpu")
+      .metavar("cpu")
+      .default_value(string("generic"));
+
+  program.add_argument("-mattr")
+      .help("target features, e.g. +avx2,-bmi")
+      .metavar("features")
+      .default_value(string(""));
+
+  program.add_argument("-march")
+      .help("\"native\" tunes for the host cpu and all of its features, anything else names a cpu")
+      .metavar("arch");
+
+  program.add_argument("-relocation-model")
+      .help("static, pic or dynamic-no-pic")
+      .metavar("model")
+      .default_value(string("pic"));
+
+  program.add_argument("-code-model")
+      .help("tiny, small, kernel, medium or large")
+      .metavar("model");
+}
+
+static cg::CompileOptions compileOptions(argparse::ArgumentParser &program)
+{
+  cg::CompileOptions options;
+  for (auto &[flag, level] : optFlags)
+    if (program.get<bool>(flag))
+      options.optLevel = level;
+
+  options.triple = program.get<string>("-target");
+  options.cpu = program.get<string>("-mcpu");
+  options.features = program.get<string>("-mattr");
+  if (auto arch = program.present("-march"))
+  {
+    options.cpu = *arch;
+    options.hostFeatures = *arch == "native";
+  }
+
+  auto reloc = relocModels.find(program.get<string>("-relocation-model"));
+  if (reloc == relocModels.end())
+  {
+    cerr << "unknown relocation model " << program.get<string>("-relocation-model") << endl;
+    exit(1);
+  }
+  options.relocModel = reloc->second;
+
+  if (auto model = program.present("-code-model"))
+  {
+    auto found = codeModels.find(*model);
+    if (found == codeModels.end())
+    {
+      cerr << "unknown code model " << *model << endl;
+      exit(1);
+    }
+    options.codeModel = found->second;
+  }
+
+  return options;
+}
+
+static void parseArgs(argparse::ArgumentParser &program, int argc, char *argv[])
+{
+  try
+  {
+    program.parse_args(argc, argv);
+  }
+  catch (const exception &error)
+  {
+    cerr << program;
+    exit(1);
+  }
+}
+
+static void addModuleArguments(argparse::ArgumentParser &program)
+{
+  program.add_argument("-I")
+      .help("search this directory for imported modules, after the directory of the importing file")
+      .metavar("dir")
+      .append();
+}
+
+static string inputFile(argparse::ArgumentParser &program)
+{
+  auto inputs = program.present<vector<string>>("input");
+  return inputs && !inputs->empty() ? inputs->front() : "";
+}
+
+// Parses a file, or stdin when filename is empty.
+static Exp *parse(const string &filename, Arena &arena, vector<string> &imports)
+{
+  ifstream file;
+  if (!filename.empty())
+  {
+    file.open(filename);
+    if (!file)
+      throw utils::CompileError("could not open file " + filename);
+  }
+
+  yy::TigerLexer x(file.is_open() ? &file : nullptr);
+  Exp *exp = nullptr;
+  yy::TigerParser y(x, arena, exp, imports);
+
+  if (y.parse() != 0)
+    throw utils::CompileError("could not parse " + (filename.empty() ? string("stdin") : filename));
+  return exp;
+}
+
+// A library module, imported by name. Its source is name.tig, and name.bc next to it is
+// the module compiled with -emit-module, which is used while it is newer than the source.
+struct Module
+{
+  string name;
+  string path;
+  string bitcode;
+  Exp *exp;
+};
+
+static string moduleBitcode(const string &path)
+{
+  llvm::SmallString<128> bitcode(path);
+  llvm::sys::path::replace_extension(bitcode, "bc");
+  llvm::sys::fs::file_status source, compiled;
+  if (llvm::sys::fs::status(path, source) || llvm::sys::fs::status(bitcode, compiled) ||
+      compiled.getLastModificationTime() < source.getLastModificationTime())
+    return "";
+  return bitcode.str().str();
+}
+
+// the source of a module, looked up next to the importing file first, empty when there is
+// none.
+static string findModule(const string &name, const string &importer, const vector<string> &searchPath)
+{
+  auto directories = searchPath;
+  auto parent = llvm::sys::path::parent_path(importer);
+  directories.insert(directories.begin(), parent.empty() ? "." : parent.str());
+  for (auto &directory : directories)
+  {
+    auto candidate = directory + "/" + name + ".tig";
+    if (llvm::sys::fs::exists(candidate))
+      return candidate;
+  }
+  return "";
+}
+
+static void loadModule(const string &name, const string &importer, const vector<string> &searchPath,
+                       Arena &arena, vector<Module> &modules, vector<string> &loading)
+{
+  for (auto &module : modules)
+    if (module.name == name)
+      return;
+  if (find(loading.begin(), loading.end(), name) != loading.end())
+    throw utils::CompileError("module " + name + " imports itself");
+
+  auto path = findModule(name, importer, searchPath);
+  if (path.empty())
+    throw utils::CompileError("could not find module " + name);
+
+  loading.push_back(name);
+  vector<string> imports;
+  auto exp = parse(path, arena, imports);
+  for (auto &import : imports)
+    loadModule(import, path, searchPath, arena, modules, loading);
+  loading.pop_back();
+  modules.push_back({name, path, moduleBitcode(path), exp});
+}
+
+// Parses the input and the modules it imports, and declares the modules to the checker,
+// every module after the modules it imports.
+static Exp *load(argparse::ArgumentParser &program, const string &input, Arena &arena, sm::Checker &checker,
+                 vector<Module> &modules)
+{
+  vector<string> imports;
+  auto exp = parse(input, arena, imports);
+
+  auto searchPath = program.present<vector<string>>("-I").value_or(vector<string>());
+  vector<string> loading;
+  for (auto &import : imports)
+    loadModule(import, input, searchPath, arena, modules, loading);
+  for (auto &module : modules)
+    checker.import(module.name, *module.exp);
+  return exp;
+}
+
+// One input of a compilation and the file it is compiled to.
+struct Job
+{
+  string input;
+  string output;
+};
+
+static void translate(argparse::ArgumentParser &program, const cg::CompileOptions &options, const Job &job,
+                      Exp *exp, sm::Checker &checker, const vector<Module> &modules,
+                      cache::Store *store = nullptr, const vector<string> &configuration = {})
+{
+  // nothing of llvm is set up before the program has been checked.
+  if (program.get<bool>("-emit-module"))
+  {
+    auto name = llvm::sys::path::stem(job.input).str();
+    if (name.empty())
+      throw utils::CompileError("a module is compiled from its file");
+    checker.import(name, *exp);
+    cg::CodeGenerator generator(checker, options);
+    generator.generateModule(*static_cast<Let *>(exp), job.output);
+    return;
+  }
+
+  checker.check(*exp);
+  if (program.get<bool>("-emit-bytecode"))
+  {
+    bc::Compiler compiler(checker);
+    bc::write(compiler.compile(*exp), job.output);
+    return;
+  }
+
+  // imported modules are linked from their bitcode when all of them have been compiled,
+  // and compiled along with the program otherwise.
+  vector<string> bitcodes;
+  for (auto &module : modules)
+    if (!module.bitcode.empty())
+      bitcodes.push_back(module.bitcode);
+  auto linked = !modules.empty() && bitcodes.size() == modules.size();
+
+  cg::CodeGenerator generator(checker, options);
+  if (program.get<bool>("-emit-ir"))
+  {
+    generator.generate(*exp);
+    generator.emitIR(job.output);
+  }
+  else if (store && program.get<bool>("-incremental"))
+  {
+    generator.generateIncremental(*exp, job.output, *store, configuration);
+  }
+  else if (linked)
+  {
+    generator.generateLinked(*exp, job.output, bitcodes);
+  }
+  else
+  {
+    generator.generateObject(*exp, job.output);
+  }
+}
+
+// The cache is used when it has a directory, for programs that come from a file.
+static unique_ptr<cache::Store> openCache(argparse::ArgumentParser &program)
+{
+  string directory;
+  if (auto dir = program.present("-cache-dir"))
+    directory = *dir;
+  else if (auto env = getenv("KALEC_CACHE_DIR"))
+    directory = env;
+  if (directory.empty())
+    return nullptr;
+
+  uint64_t capacity = program.get<int>("-cache-size");
+  return make_unique<cache::Store>(directory, capacity << 20);
+}
+
+// Everything besides the source that changes the output, from options resolved by
+// cg::resolveTarget. The compiler is identified by its version and by the size and
+// modification time of its executable.
+static vector<string> cacheConfiguration(argparse::ArgumentParser &program, const cg::CompileOptions &options, const char *argv0)
+{
+  string compiler = "kalec 1.0 llvm " LLVM_VERSION_STRING;
+  llvm::sys::fs::file_status status;
+  auto executable = llvm::sys::fs::getMainExecutable(argv0, reinterpret_cast<void *>(&openCache));
+  if (!llvm::sys::fs::status(executable, status))
+    compiler += " " + to_string(status.getSize()) + " " + to_string(status.getLastModificationTime().time_since_epoch().count());
+
+  string mode = "object";
+  if (program.get<bool>("-emit-module"))
+    mode = "module";
+  else if (program.get<bool>("-emit-bytecode"))
+    mode = "bytecode";
+  else if (program.get<bool>("-emit-ir"))
+    mode = "ir";
+  return {
+      compiler,
+      mode,
+      options.triple,
+      options.cpu,
+      options.features,
+      to_string(static_cast<int>(options.optLevel)),
+      to_string(static_cast<int>(options.relocModel)),
+      options.codeModel ? to_string(static_cast<int>(*options.codeModel)) : "",
+      to_string(options.gc) + " " + to_string(options.heapLimit) + " " + to_string(options.regions) + " " + to_string(options.rc),
+  };
+}
+
+// The imports at the start of a source, read without the lexer. Only names written as
+// plain strings are understood, anything else leaves it to the parser.
+static bool scanImports(llvm::StringRef source, vector<string> &imports)
+{
+  while (true)
+  {
+    source = source.ltrim(" \t\n");
+    if (source.starts_with("//"))
+    {
+      auto end = source.find('\n');
+      if (end == llvm::StringRef::npos)
+        return true;
+      source = source.drop_front(end + 1);
+      continue;
+    }
+    if (source.starts_with("/*"))
+    {
+      int depth = 0;
+      do
+      {
+        if (source.empty())
+          return false;
+        if (source.starts_with("/*") || source.starts_with("*/"))
+        {
+          depth += source[0] == '/' ? 1 : -1;
+          source = source.drop_front(2);
+        }
+        else
+        {
+          source = source.drop_front(1);
+        }
+      } while (depth);
+      continue;
+    }
+    if (!source.starts_with("import") || (source.size() > 6 && (isalnum(static_cast<unsigned char>(source[6])) || source[6] == '_')))
+      return true;
+    source = source.drop_front(6).ltrim(" \t\n");
+    if (!source.consume_front("\""))
+      return false;
+    auto end = source.find_first_of("\"\\\t\n");
+    if (end == llvm::StringRef::npos || source[end] != '"')
+      return false;
+    imports.push_back(source.take_front(end).str());
+    source = source.drop_front(end + 1);
+  }
+}
+
+// Adds the bytes of a module and of the modules it imports to a key, every module after
+// the modules it imports, as load declares them. Fails where loading the module would.
+static bool keyModule(const string &name, const string &importer, const vector<string> &searchPath,
+                      vector<string> &done, vector<string> &loading, vector<string> &key)
+{
+  if (find(done.begin(), done.end(), name) != done.end())
+    return true;
+  if (find(loading.begin(), loading.end(), name) != loading.end())
+    return false;
+  auto path = findModule(name, importer, searchPath);
+  auto source = llvm::MemoryBuffer::getFile(path);
+  vector<string> imports;
+  if (path.empty() || !source || !scanImports((*source)->getBuffer(), imports))
+    return false;
+
+  loading.push_back(name);
+  for (auto &import : imports)
+    if (!keyModule(import, path, searchPath, done, loading, key))
+      return false;
+  loading.pop_back();
+  done.push_back(name);
+
+  auto contents = (*source)->getBuffer().str() + '\0';
+  auto bitcode = moduleBitcode(path);
+  if (auto buffer = llvm::MemoryBuffer::getFile(bitcode); !bitcode.empty() && buffer)
+    contents += (*buffer)->getBuffer().str() + '\0';
+  key.push_back("module " + name + " " + cache::key(contents, {}));
+  return true;
+}
+
+// The key of a job comes from the bytes of its input and of the modules it imports, so a
+// hit neither lexes nor parses anything. It is empty when the imports cannot be scanned.
+static string jobKey(argparse::ArgumentParser &program, const cg::CompileOptions &options, const Job &job,
+                     const vector<string> &configuration)
+{
+  auto buffer = llvm::MemoryBuffer::getFile(job.input);
+  vector<string> imports;
+  if (!buffer || !scanImports((*buffer)->getBuffer(), imports))
+    return "";
+
+  // the linked object depends on how the program was split, its functions do not. The
+  // object of a program also depends on the modules it imports.
+  auto whole = configuration;
+  whole.push_back(program.get<bool>("-incremental") ? "incremental" : "jobs " + to_string(options.jobs));
+  auto searchPath = program.present<vector<string>>("-I").value_or(vector<string>());
+  vector<string> done, loading;
+  for (auto &import : imports)
+    if (!keyModule(import, job.input, searchPath, done, loading, whole))
+      return "";
+  return cache::key((*buffer)->getBuffer().str(), whole);
+}
+
+static void compileJob(argparse::ArgumentParser &program, const cg::CompileOptions &options, const Job &job,
+                       cache::Store *store, const vector<string> &configuration)
+{
+  // the program is freed along with its arena once compilation is done.
+  Arena arena;
+  sm::Checker checker;
+  vector<Module> modules;
+  auto key = store && !job.input.empty() ? jobKey(program, options, job, configuration) : "";
+  if (key.empty())
+  {
+    auto exp = load(program, job.input, arena, checker, modules);
+    translate(program, options, job, exp, checker, modules);
+    return;
+  }
+
+  if (!store->fetch(key, job.output))
+  {
+    auto exp = load(program, job.input, arena, checker, modules);
+    translate(program, options, job, exp, checker, modules, store, configuration);
+    store->insert(key, job.output);
+  }
+}
+
+// Compiles a job, or reports why it does not and removes what it left of its output, so
+// that the other inputs of a batch go on.
+static bool tryCompileJob(argparse::ArgumentParser &program, const cg::CompileOptions &options, const Job &job,
+                          cache::Store *store, const vector<string> &configuration)
+{
+  try
+  {
+    compileJob(program, options, job, store, configuration);
+    return true;
+  }
+  catch (const utils::CompileError &error)
+  {
+    static mutex reporting;
+    lock_guard<mutex> lock(reporting);
+    cerr << (job.input.empty() ? "stdin" : job.input) << ": " << error.what() << endl;
+    llvm::sys::fs::remove(job.output);
+    return false;
+  }
+}
+
+// A manifest lists one input per line, optionally followed by its output. Blank lines and
+// lines starting with # are skipped.
+static void readManifest(const string &manifest, vector<Job> &jobs)
+{
+  ifstream file(manifest);
+  if (!file)
+  {
+    cerr << "could not open file " << manifest << endl;
+    exit(1);
+  }
+  string line;
+  while (getline(file, line))
+  {
+    istringstream fields(line);
+    Job job;
+    if (!(fields >> job.input) || job.input[0] == '#')
+      continue;
+    fields >> job.output;
+    jobs.push_back(job);
+  }
+}
+
+// In a batch, -o names the directory outputs are written to, next to their inputs by
+// default.
+static string batchOutput(argparse::ArgumentParser &program, const string &input)
+{
+  auto extension = "o";
+  if (program.get<bool>("-emit-module"))
+    extension = "bc";
+  else if (program.get<bool>("-emit-bytecode"))
+    extension = "tbc";
+  else if (program.get<bool>("-emit-ir"))
+    extension = "ll";
+
+  llvm::SmallString<128> output;
+  if (auto directory = program.present("-o"))
+  {
+    output = *directory;
+    llvm::sys::path::append(output, llvm::sys::path::filename(input));
+  }
+  else
+  {
+    output = input;
+  }
+  llvm::sys::path::replace_extension(output, extension);
+  return output.str().str();
+}
+
+static void addCompileArguments(argparse::ArgumentParser &program)
 {
-  argparse::ArgumentParser program("kalec", "1.0");
   program.add_description("a tiger language compiler");
 
   program.add_argument("input")
       .remaining();
 
   program.add_argument("-o", "--output")
-      .help("ouput filename")
-      .metavar("output")
-      .required();
+      .help("ouput filename, or the directory of the outputs of a batch")
+      .metavar("output");
+
+  program.add_argument("-batch", "--batch")
+      .help("compile every input to an output of its own, -j of them at once")
+      .implicit_value(true)
+      .default_value(false);
+
+  program.add_argument("-manifest", "--manifest")
+      .help("compile the inputs listed in this file as a batch, one input and optional output per line")
+      .metavar("file");
 
   program.add_argument("-emit-ir")
       .help("emit llvm-ir")
       .implicit_value(true)
       .default_value(false);
 
+  program.add_argument("-emit-bytecode")
+      .help("emit a .tbc bytecode file for tigervm")
+      .implicit_value(true)
+      .default_value(false);
+
+  program.add_argument("-emit-module")
+      .help("compile a library module to bitcode for programs that import it")
+      .implicit_value(true)
+      .default_value(false);
+
+  program.add_argument("-j")
+      .help("threads used to optimize and emit object code, or inputs compiled at once in a batch, 0 for one per core")
+      .metavar("jobs")
+      .default_value(1)
+      .scan<'i', int>();
+
+  program.add_argument("-cache-dir")
+      .help("reuse outputs of earlier compilations stored in this directory, defaults to $KALEC_CACHE_DIR")
+      .metavar("dir");
+
+  program.add_argument("-cache-size")
+      .help("size of the cache in MiB, least recently used outputs are evicted beyond it")
+      .metavar("size")
+      .default_value(1024)
+      .scan<'i', int>();
+
+  program.add_argument("-incremental")
+      .help("cache the code of every function and only recompile functions that changed, needs a cache")
+      .implicit_value(true)
+      .default_value(false);
+
+  program.add_argument("-cache-stats")
+      .help("print cache statistics")
+      .implicit_value(true)
+      .default_value(false);
+
+  program.add_argument("-heap-limit")
+      .help("heap of the compiled program in MiB, 0 for $TIGER_HEAP_LIMIT or no limit")
+      .metavar("size")
+      .default_value(0)
+      .scan<'i', int>();
+
+  program.add_argument("-memory")
+      .help("how the compiled program frees memory: gc, a collected heap with regions, or rc, reference counting; modules and their programs must agree")
+      .metavar("mode")
+      .default_value(string("gc"));
+
+  addModuleArguments(program);
+  addCodegenArguments(program);
+}
+
+// the source of a compilation without inputs is the stdin of the process.
+static bool readsStdin(int argc, char *argv[])
+{
+  argparse::ArgumentParser program("kalec", "1.0");
+  addCompileArguments(program);
+  parseArgs(program, argc, argv);
+  auto inputs = program.present<vector<string>>("input");
+  return (!inputs || inputs->empty()) && !program.present("-manifest");
+}
+
+static int compile(int argc, char *argv[])
+{
+  argparse::ArgumentParser program("kalec", "1.0");
+  addCompileArguments(program);
+  parseArgs(program, argc, argv);
+
+  auto options = compileOptions(program);
+  // compiled programs allocate from the collected heap of the runtime, or count references.
+  auto memory = program.get<string>("-memory");
+  if (memory != "gc" && memory != "rc")
+  {
+    cerr << "unknown memory mode " << memory << endl;
+    exit(1);
+  }
+  options.gc = memory == "gc";
+  options.regions = options.gc;
+  options.rc = memory == "rc";
+  options.heapLimit = int64_t(program.get<int>("-heap-limit")) << 20;
+  auto threads = program.get<int>("-j");
+  options.jobs = threads > 0 ? threads : max(thread::hardware_concurrency(), 1u);
+
+  vector<Job> jobs;
+  auto batch = program.get<bool>("-batch") || program.present("-manifest");
+  if (batch)
+  {
+    for (auto &input : program.present<vector<string>>("input").value_or(vector<string>()))
+      jobs.push_back({input, ""});
+    if (auto manifest = program.present("-manifest"))
+      readManifest(*manifest, jobs);
+    if (auto directory = program.present("-o"))
+      llvm::sys::fs::create_directories(*directory);
+    for (auto &job : jobs)
+      if (job.output.empty())
+        job.output = batchOutput(program, job.input);
+  }
+  else if (auto output = program.present("-o"))
+  {
+    jobs.push_back({inputFile(program), *output});
+  }
+  else
+  {
+    cerr << "an output is required" << endl
+         << program;
+    return 1;
+  }
+
+  // the target is resolved once for all inputs, and every input of a batch is compiled
+  // on a thread of its own.
   try
   {
-    program.parse_args(argc, argv);
+    cg::resolveTarget(options);
   }
-  catch (const exception &error)
+  catch (const utils::CompileError &error)
   {
-    cerr << program;
-    exit(1);
+    cerr << error.what() << endl;
+    return 1;
   }
+  auto store = openCache(program);
+  vector<string> configuration;
+  if (store)
+    configuration = cacheConfiguration(program, options, argv[0]);
 
-  yy::TigerLexer x;
-  shared_ptr<Exp> exp;
-  yy::TigerParser y(x, exp);
+  atomic<int> failures{0};
+  if (!batch)
+  {
+    failures += !tryCompileJob(program, options, jobs.front(), store.get(), configuration);
+  }
+  else
+  {
+    llvm::ThreadPool pool(llvm::hardware_concurrency(options.jobs));
+    auto single = options;
+    single.jobs = 1;
+    for (auto &job : jobs)
+      pool.async([&, job]()
+                 { failures += !tryCompileJob(program, single, job, store.get(), configuration); });
+    pool.wait();
+  }
 
-  if (y.parse() == 0)
+  if (store && program.get<bool>("-cache-stats"))
   {
-    cg::CodeGenerator generator;
-    generator.generate(*exp);
+    auto stats = store->stats();
+    cerr << "cache: " << stats.hits << " hits, " << stats.misses << " misses, " << stats.evictions << " evictions, "
+         << stats.entries << " entries, " << stats.bytes << " bytes" << endl;
+  }
+  return failures ? 1 : 0;
+}
+
+static int run(int argc, char *argv[])
+{
+  argparse::ArgumentParser program("kalec run", "1.0");
+  program.add_description("compile a tiger program in memory and run it");
+
+  program.add_argument("input")
+      .remaining();
+
+  program.add_argument("-tiered")
+      .help("start in the interpreter and compile functions once they are hot")
+      .implicit_value(true)
+      .default_value(false);
+
+  program.add_argument("-tier-threshold")
+      .help("calls plus loop iterations after which a function is compiled")
+      .metavar("count")
+      .default_value(1000)
+      .scan<'i', int>();
+
+  addModuleArguments(program);
+  addCodegenArguments(program);
+  parseArgs(program, argc, argv);
+
+  using clock = chrono::steady_clock;
+  auto ms = [](clock::duration d)
+  { return chrono::duration<double, milli>(d).count(); };
+  auto start = clock::now();
+
+  auto options = compileOptions(program);
+  Arena arena;
+  sm::Checker checker;
+  vector<Module> modules;
+  auto exp = load(program, inputFile(program), arena, checker, modules);
+  checker.check(*exp);
+
+  if (program.get<bool>("-tiered"))
+  {
+    interp::Tier tier(*exp, checker, options);
+    interp::Interpreter interpreter(checker, &tier, program.get<int>("-tier-threshold"));
+    auto checked = clock::now();
+    interpreter.run(*exp);
+    fflush(stdout);
+    auto finished = clock::now();
+
+    cerr << "compile: " << ms(checked - start) << " ms, run: " << ms(finished - checked) << " ms ("
+         << tier.compiledFunctions() << " functions compiled in " << tier.compileMilliseconds() << " ms)" << endl;
+    return 0;
+  }
+
+  cg::CodeGenerator generator(checker, options);
+  generator.generate(*exp);
+  cg::JIT jit(generator.compileOptions());
+  jit.addModule(std::move(generator.moduler), generator.takeContext());
+  auto entry = reinterpret_cast<void (*)()>(jit.lookup("main"));
+
+  auto compiled = clock::now();
+  entry();
+  fflush(stdout);
+  auto finished = clock::now();
+
+  cerr << "compile: " << ms(compiled - start) << " ms, run: " << ms(finished - compiled) << " ms" << endl;
+  return 0;
+}
+
+// Compiles a tiny program, so that what LLVM sets up on first use is ready before the
+// daemon forks its first worker. It runs on one job, so no thread pool is left running.
+static void warmUp()
+{
+  Arena arena;
+  sm::Checker checker;
+  auto exp = arena.make<Int>(0, position());
+  checker.check(*exp);
+  cg::CodeGenerator generator(checker);
+  generator.generateObject(*exp, "/dev/null");
+}
+
+static int serve(int argc, char *argv[])
+{
+  argparse::ArgumentParser program("kalecd", "1.0");
+  program.add_description("compile for kalec clients in a process that keeps llvm initialized");
+
+  program.add_argument("-socket")
+      .help("listen on this socket, defaults to $KALECD_SOCKET or /tmp/kalecd-<uid>.sock")
+      .metavar("path");
+
+  program.add_argument("-j")
+      .help("compilations run at once, later requests are queued, 0 for one per core")
+      .metavar("jobs")
+      .default_value(0)
+      .scan<'i', int>();
+
+  program.add_argument("-stats")
+      .help("print the requests, queue depth and latencies of the running daemon")
+      .implicit_value(true)
+      .default_value(false);
+
+  program.add_argument("-stop")
+      .help("stop the running daemon once its requests are served")
+      .implicit_value(true)
+      .default_value(false);
+
+  parseArgs(program, argc, argv);
+
+  auto path = program.present("-socket").value_or(server::socketPath());
+  if (program.get<bool>("-stats") || program.get<bool>("-stop"))
+  {
+    auto request = program.get<bool>("-stop") ? server::Request::Stop : server::Request::Stats;
+    string reply;
+    if (!server::query(path, request, reply))
+    {
+      cerr << "no daemon listens on " << path << endl;
+      return 1;
+    }
+    cerr << reply;
+    return 0;
   }
 
-  exit(0);
+  warmUp();
+  auto threads = program.get<int>("-j");
+  return server::serve(path, threads > 0 ? threads : max(thread::hardware_concurrency(), 1u), compile);
+}
+
+// kalec hands compilations to a running kalecd unless $KALEC_NO_DAEMON is set, or the
+// program comes from stdin, which kalecd does not see. Failures of compile are reported
+// per input, those of run here.
+int main(int argc, char *argv[])
+{
+  try
+  {
+    if (llvm::sys::path::filename(argv[0]) == "kalecd")
+      return serve(argc, argv);
+    if (argc > 1 && string(argv[1]) == "daemon")
+      return serve(argc - 1, argv + 1);
+    if (argc > 1 && string(argv[1]) == "run")
+      return run(argc - 1, argv + 1);
+
+    int status;
+    if (!getenv("KALEC_NO_DAEMON") && !readsStdin(argc, argv) && server::forward(argc, argv, status))
+      return status;
+    return compile(argc, argv);
+  }
+  catch (const utils::CompileError &error)
+  {
+    cerr << error.what() << endl;
+    return 1;
+  }
 }
@@ -0,0 +1,346 @@
+#include <functional>
+#include <set>
+#include "ownership.h"
+#include "types.h"
+
+using namespace sm;
+using namespace absyn;
+using namespace std;
+
+namespace
+{
+  bool counted(const ty::Type *type)
+  {
+    auto kind = ty::actualTy(type)->kind;
+    return kind == ty::Kind::Record || kind == ty::Kind::Array || kind == ty::Kind::String;
+  }
+
+  // A reference to a variable by an expression.
+  struct Use
+  {
+    const Variable *variable;
+    // set when the use is the value of the variable.
+    VarExp *value;
+    // set when the use reads a field of the record in the variable.
+    FieldVar *field;
+    bool loop;
+  };
+
+  void uses(Exp &exp, bool loop, vector<Use> &out);
+
+  void uses(Var &var, VarExp *whole, bool loop, vector<Use> &out)
+  {
+    if (auto simple = dynamic_cast<SimpleVar *>(&var))
+    {
+      out.push_back({simple->variable, whole, nullptr, loop});
+    }
+    else if (auto field = dynamic_cast<FieldVar *>(&var))
+    {
+      auto base = dynamic_cast<SimpleVar *>(field->var);
+      if (whole && base)
+        out.push_back({base->variable, nullptr, field, loop});
+      else
+        uses(*field->var, nullptr, loop, out);
+    }
+    else
+    {
+      auto subscript = static_cast<SubscriptVar *>(&var);
+      uses(*subscript->var, nullptr, loop, out);
+      uses(*subscript->subscript, loop, out);
+    }
+  }
+
+  // The uses of variables by an expression, in the order they are evaluated. Bodies of
+  // functions declared in it are left out.
+  void uses(Exp &exp, bool loop, vector<Use> &out)
+  {
+    if (auto var = dynamic_cast<VarExp *>(&exp))
+    {
+      uses(*var->var, var, loop, out);
+    }
+    else if (auto assign = dynamic_cast<Assign *>(&exp))
+    {
+      uses(*assign->var, nullptr, loop, out);
+      uses(*assign->exp, loop, out);
+    }
+    else if (auto seq = dynamic_cast<Seq *>(&exp))
+    {
+      for (auto e : seq->seq)
+        uses(*e, loop, out);
+    }
+    else if (auto call = dynamic_cast<Call *>(&exp))
+    {
+      for (auto arg : call->args)
+        uses(*arg, loop, out);
+    }
+    else if (auto bin = dynamic_cast<BinOp *>(&exp))
+    {
+      uses(*bin->lhs, loop, out);
+      uses(*bin->rhs, loop, out);
+    }
+    else if (auto record = dynamic_cast<RecordExp *>(&exp))
+    {
+      for (auto rcd : record->records)
+        uses(*rcd->value, loop, out);
+    }
+    else if (auto array = dynamic_cast<Array *>(&exp))
+    {
+      uses(*array->capacity, loop, out);
+      uses(*array->element, loop, out);
+    }
+    else if (auto iff = dynamic_cast<If *>(&exp))
+    {
+      uses(*iff->condition, loop, out);
+      uses(*iff->then, loop, out);
+      if (iff->els)
+        uses(*iff->els, loop, out);
+    }
+    else if (auto whil = dynamic_cast<While *>(&exp))
+    {
+      uses(*whil->condition, true, out);
+      uses(*whil->body, true, out);
+    }
+    else if (auto forr = dynamic_cast<For *>(&exp))
+    {
+      uses(*forr->from, loop, out);
+      uses(*forr->to, loop, out);
+      uses(*forr->body, true, out);
+    }
+    else if (auto let = dynamic_cast<Let *>(&exp))
+    {
+      for (auto dec : let->decs)
+        if (auto var = dynamic_cast<VarDec *>(dec))
+          uses(*var->exp, loop, out);
+      uses(*let->body, loop, out);
+    }
+  }
+
+  void walk(Exp &exp, const function<void(Exp &)> &visit);
+
+  void walk(Var &var, const function<void(Exp &)> &visit)
+  {
+    if (auto field = dynamic_cast<FieldVar *>(&var))
+    {
+      walk(*field->var, visit);
+    }
+    else if (auto subscript = dynamic_cast<SubscriptVar *>(&var))
+    {
+      walk(*subscript->var, visit);
+      walk(*subscript->subscript, visit);
+    }
+  }
+
+  // every expression in exp, with the bodies of the functions declared in it.
+  void walk(Exp &exp, const function<void(Exp &)> &visit)
+  {
+    visit(exp);
+    auto each = [&](Exp *e)
+    {
+      if (e)
+        walk(*e, visit);
+    };
+    if (auto var = dynamic_cast<VarExp *>(&exp))
+    {
+      walk(*var->var, visit);
+    }
+    else if (auto assign = dynamic_cast<Assign *>(&exp))
+    {
+      walk(*assign->var, visit);
+      each(assign->exp);
+    }
+    else if (auto seq = dynamic_cast<Seq *>(&exp))
+    {
+      for (auto e : seq->seq)
+        each(e);
+    }
+    else if (auto call = dynamic_cast<Call *>(&exp))
+    {
+      for (auto arg : call->args)
+        each(arg);
+    }
+    else if (auto bin = dynamic_cast<BinOp *>(&exp))
+    {
+      each(bin->lhs);
+      each(bin->rhs);
+    }
+    else if (auto record = dynamic_cast<RecordExp *>(&exp))
+    {
+      for (auto rcd : record->records)
+        each(rcd->value);
+    }
+    else if (auto array = dynamic_cast<Array *>(&exp))
+    {
+      each(array->capacity);
+      each(array->element);
+    }
+    else if (auto iff = dynamic_cast<If *>(&exp))
+    {
+      each(iff->condition);
+      each(iff->then);
+      each(iff->els);
+    }
+    else if (auto whil = dynamic_cast<While *>(&exp))
+    {
+      each(whil->condition);
+      each(whil->body);
+    }
+    else if (auto forr = dynamic_cast<For *>(&exp))
+    {
+      each(forr->from);
+      each(forr->to);
+      each(forr->body);
+    }
+    else if (auto let = dynamic_cast<Let *>(&exp))
+    {
+      for (auto dec : let->decs)
+        if (auto var = dynamic_cast<VarDec *>(dec))
+          each(var->exp);
+        else if (auto function = dynamic_cast<FunctionDec *>(dec))
+          each(function->body);
+      each(let->body);
+    }
+  }
+
+  // The last use of an owned variable among before, if nothing after uses it, moves its
+  // reference when it is the value of the variable, outside of a loop.
+  void moveLast(const vector<Use> &before, const vector<Use> &after, const vector<const Variable *> &owned)
+  {
+    for (auto variable : owned)
+    {
+      auto used = [variable](const Use &use)
+      { return use.variable == variable; };
+      if (any_of(after.begin(), after.end(), used))
+        continue;
+      auto last = find_if(before.rbegin(), before.rend(), used);
+      if (last != before.rend() && last->value && !last->loop)
+        last->value->move = true;
+    }
+  }
+
+  // a record built last in a function can take the memory of a parameter of its type
+  // that it only reads fields of, each field of a record or array at most once.
+  void reuse(RecordExp &record, const vector<Use> &all, const vector<const Variable *> &owned)
+  {
+    for (auto variable : owned)
+    {
+      if (ty::actualTy(variable->type) != ty::actualTy(record.type))
+        continue;
+      uint64_t moved = 0;
+      vector<FieldVar *> reads;
+      auto reusable = true;
+      for (auto &use : all)
+      {
+        if (use.variable != variable)
+          continue;
+        if (!use.field || use.loop)
+        {
+          reusable = false;
+          break;
+        }
+        if (!counted(use.field->type))
+          continue;
+        auto index = use.field->index;
+        if (index >= 64 || (moved >> index & 1))
+        {
+          reusable = false;
+          break;
+        }
+        moved |= uint64_t(1) << index;
+        reads.push_back(use.field);
+      }
+      if (!reusable)
+        continue;
+      record.reuse = const_cast<Variable *>(variable);
+      record.moved = moved;
+      for (auto field : reads)
+        field->move = true;
+      return;
+    }
+  }
+
+  // an expression whose value the function returns, nothing runs after it but the ends
+  // of the lets around it.
+  void tail(Exp &exp, const vector<const Variable *> &owned)
+  {
+    vector<Use> before, after;
+    if (auto iff = dynamic_cast<If *>(&exp); iff && iff->els)
+    {
+      uses(*iff->condition, false, before);
+      uses(*iff->then, false, after);
+      uses(*iff->els, false, after);
+      moveLast(before, after, owned);
+      tail(*iff->then, owned);
+      tail(*iff->els, owned);
+    }
+    else if (auto let = dynamic_cast<Let *>(&exp))
+    {
+      for (auto dec : let->decs)
+        if (auto var = dynamic_cast<VarDec *>(dec))
+          uses(*var->exp, false, before);
+      uses(*let->body, false, after);
+      moveLast(before, after, owned);
+      tail(*let->body, owned);
+    }
+    else if (auto seq = dynamic_cast<Seq *>(&exp); seq && seq->seq.size())
+    {
+      auto last = seq->seq[seq->seq.size() - 1];
+      for (auto e : seq->seq)
+        if (e != last)
+          uses(*e, false, before);
+      uses(*last, false, after);
+      moveLast(before, after, owned);
+      tail(*last, owned);
+    }
+    else
+    {
+      uses(exp, false, before);
+      if (auto record = dynamic_cast<RecordExp *>(&exp))
+        reuse(*record, before, owned);
+      moveLast(before, after, owned);
+    }
+  }
+}
+
+void sm::inferOwnership(Exp &exp, const Checker &checker, const Regions &regions)
+{
+  // a variable a nested function uses may be read after what looks like its last use.
+  for (auto &function : checker.functions())
+    for (auto variable : function->captures)
+      variable->captured = true;
+
+  vector<FunctionDec *> decs;
+  set<const Variable *> assigned;
+  walk(exp, [&](Exp &e)
+       {
+         if (auto assign = dynamic_cast<Assign *>(&e))
+         {
+           if (auto simple = dynamic_cast<SimpleVar *>(assign->var))
+             assigned.insert(simple->variable);
+         }
+         else if (auto let = dynamic_cast<Let *>(&e))
+         {
+           for (auto dec : let->decs)
+             if (auto function = dynamic_cast<FunctionDec *>(dec))
+               decs.push_back(function);
+         } });
+
+  for (auto dec : decs)
+    for (auto param : dec->parameters)
+    {
+      auto variable = param->variable;
+      variable->borrowed = counted(variable->type) && !regions.escapes(variable) && !assigned.count(variable);
+    }
+
+  for (auto dec : decs)
+  {
+    vector<const Variable *> owned;
+    for (auto param : dec->parameters)
+    {
+      auto variable = param->variable;
+      if (counted(variable->type) && !variable->borrowed && !variable->captured)
+        owned.push_back(variable);
+    }
+    if (!owned.empty())
+      tail(*dec->body, owned);
+  }
+}
@@ -3,7 +3,7 @@
 %skeleton "lalr1.cc"
 
 %code requires {
-  #include <memory>
+  #include <vector>
   #include "absyn.h"
 
   namespace yy {
@@ -13,6 +13,7 @@
 
 %code {
   #include "TigerLexer.h"
+  #include "utils.h"
   #define yylex lexer._yylex
 
   using namespace absyn;
@@ -23,11 +24,14 @@
 %define api.token.constructor
 %define api.location.file "../include/location.hh"
 %define api.value.type variant
+%define api.value.automove
 %define api.parser.class { TigerParser }
 %define parse.assert
 %define api.token.prefix {TOK_}
 %parse-param { yy::TigerLexer &lexer }
-%parse-param { std::shared_ptr<absyn::Exp> &root }
+%parse-param { absyn::Arena &arena }
+%parse-param { absyn::Exp *&root }
+%parse-param { std::vector<std::string> &imports }
 
 %locations
 
@@ -52,6 +56,7 @@
 %token DO           "do"
 %token OF           "of"
 %token NIL          "nil"
+%token IMPORT       "import"
 %token COMMA        ","
 %token COLON        ":"
 %token SEMICOLON    ";"
@@ -77,7 +82,7 @@
 %token ASSIGN       ":="
 %token <int> INT "integer"
 %token <std::string> STRING "string"
-%token <std::string> ID "id"
+%token <sym::Symbol> ID "id"
 %token EOF 0
 
 %nonassoc LVALUE ":=" "then" "do"
@@ -90,124 +95,130 @@
 %left UMINUS
 %nterm <absyn::ptr<absyn::Exp>> exp
 %nterm <absyn::ptr<absyn::Var>> lvalue
-%nterm <absyn::ptrs<absyn::Exp>> expseq expseq_ arg_list arg_list_
-%nterm <absyn::ptrs<absyn::Record>> record_list record_list_
+%nterm <absyn::ptrs<absyn::Exp>> expseq arg_list
+%nterm <std::vector<absyn::Exp *>> expseq_ arg_list_
+%nterm <absyn::ptrs<absyn::Record>> record_list
+%nterm <std::vector<absyn::Record *>> record_list_
 %nterm <absyn::ptr<absyn::Record>> record
-%nterm <absyn::ptrs<absyn::Dec>> decs
+%nterm <std::vector<absyn::Dec *>> decs
 %nterm <absyn::ptr<absyn::Dec>> dec typedec vardec funcdec
 %nterm <absyn::ptr<absyn::Type>> ty
-%nterm <absyn::ptrs<absyn::Field>> tyfields tyfields_
+%nterm <absyn::ptrs<absyn::Field>> tyfields
+%nterm <std::vector<absyn::Field *>> tyfields_
 %nterm <absyn::ptr<absyn::Field>> tyfield
 %nterm <absyn::ptr<absyn::ID>> id
 
 %start program
 %%
 
-program: exp            { root = $1; }
+program: import_list exp    { root = $2; }
 
-exp:        INT                                 { $$ = make_shared<Int>($1, @1.begin); }
-            | STRING                            { $$ = make_shared<String>($1, @1.begin); }
-            | NIL                               { $$ = make_shared<Nil>(@1.begin); }
-            | lvalue                            { $$ = make_shared<VarExp>($1, @1.begin); }
-            | lvalue ":=" exp                   { $$ = make_shared<Assign>($1, $3, @1.begin); }
-            | "(" expseq ")"                    { $$ = make_shared<Seq>($2, @1.begin); }
+import_list:    /* empty */
+            | import_list "import" STRING       { imports.push_back($3); }
+
+exp:        INT                                 { $$ = arena.make<Int>($1, @1.begin); }
+            | STRING                            { $$ = arena.make<String>($1, @1.begin); }
+            | NIL                               { $$ = arena.make<Nil>(@1.begin); }
+            | lvalue                            { $$ = arena.make<VarExp>($1, @1.begin); }
+            | lvalue ":=" exp                   { $$ = arena.make<Assign>($1, $3, @1.begin); }
+            | "(" expseq ")"                    { $$ = arena.make<Seq>($2, @1.begin); }
             | "-" exp %prec UMINUS              {
-                                                  auto zero = make_shared<Int>(0, @1.begin);
-                                                  $$ = make_shared<BinOp>(zero, $2, Oper::minusOp, @1.begin);
+                                                  auto zero = arena.make<Int>(0, @1.begin);
+                                                  $$ = arena.make<BinOp>(zero, $2, Oper::minusOp, @1.begin);
                                                 }
-            | id "(" arg_list ")"               { $$ = make_shared<Call>($1, $3, @1.begin); }
-            | exp "+" exp                       { $$ = make_shared<BinOp>($1, $3, Oper::plusOp, @2.begin); }
-            | exp "-" exp                       { $$ = make_shared<BinOp>($1, $3, Oper::minusOp, @2.begin); }
-            | exp "*" exp                       { $$ = make_shared<BinOp>($1, $3, Oper::timesOp, @2.begin); }
-            | exp "/" exp                       { $$ = make_shared<BinOp>($1, $3, Oper::divideOp, @2.begin); }
-            | exp "=" exp                       { $$ = make_shared<BinOp>($1, $3, Oper::eqOp, @2.begin); }
-            | exp "<>" exp                      { $$ = make_shared<BinOp>($1, $3, Oper::neqOp, @2.begin); }
-            | exp ">" exp                       { $$ = make_shared<BinOp>($1, $3, Oper::gtOp, @2.begin); }
-            | exp "<" exp                       { $$ = make_shared<BinOp>($1, $3, Oper::ltOp, @2.begin); }
-            | exp ">=" exp                      { $$ = make_shared<BinOp>($1, $3, Oper::geOp, @2.begin); }
-            | exp "<=" exp                      { $$ = make_shared<BinOp>($1, $3, Oper::leOp, @2.begin); }
+            | id "(" arg_list ")"               { $$ = arena.make<Call>($1, $3, @1.begin); }
+            | exp "+" exp                       { $$ = arena.make<BinOp>($1, $3, Oper::plusOp, @2.begin); }
+            | exp "-" exp                       { $$ = arena.make<BinOp>($1, $3, Oper::minusOp, @2.begin); }
+            | exp "*" exp                       { $$ = arena.make<BinOp>($1, $3, Oper::timesOp, @2.begin); }
+            | exp "/" exp                       { $$ = arena.make<BinOp>($1, $3, Oper::divideOp, @2.begin); }
+            | exp "=" exp                       { $$ = arena.make<BinOp>($1, $3, Oper::eqOp, @2.begin); }
+            | exp "<>" exp                      { $$ = arena.make<BinOp>($1, $3, Oper::neqOp, @2.begin); }
+            | exp ">" exp                       { $$ = arena.make<BinOp>($1, $3, Oper::gtOp, @2.begin); }
+            | exp "<" exp                       { $$ = arena.make<BinOp>($1, $3, Oper::ltOp, @2.begin); }
+            | exp ">=" exp                      { $$ = arena.make<BinOp>($1, $3, Oper::geOp, @2.begin); }
+            | exp "<=" exp                      { $$ = arena.make<BinOp>($1, $3, Oper::leOp, @2.begin); }
             | exp "&" exp                       {
-                                                  auto zero = make_shared<Int>(0, @1.begin);
-                                                  $$ = make_shared<If>($1, $3, zero, @1.begin);
+                                                  auto zero = arena.make<Int>(0, @1.begin);
+                                                  $$ = arena.make<If>($1, $3, zero, @1.begin);
                                                 }
             | exp "|" exp                       {
-                                                  auto one = make_shared<Int>(1, @1.begin);
-                                                  $$ = make_shared<If>($1, one, $3, @1.begin);
+                                                  auto one = arena.make<Int>(1, @1.begin);
+                                                  $$ = arena.make<If>($1, one, $3, @1.begin);
                                                 }
-            | id "{" record_list "}"            { $$ = make_shared<RecordExp>($1, $3, @1.begin); }
-            | id "[" exp "]" "of" exp           { $$ = make_shared<Array>($1, $3, $6, @1.begin); }
-            | IF exp THEN exp ELSE exp          { $$ = make_shared<If>($2, $4, $6, @1.begin); }
-            | IF exp THEN exp                   { $$ = make_shared<If>($2, $4, nullptr, @1.begin); }
-            | WHILE exp DO exp                  { $$ = make_shared<While>($2, $4, @1.begin); }
-            | FOR id ":=" exp TO exp DO exp     { $$ = make_shared<For>($2, $4, $6, $8, @1.begin); }
-            | BREAK                             { $$ = make_shared<Break>(@1.begin); }
+            | id "{" record_list "}"            { $$ = arena.make<RecordExp>($1, $3, @1.begin); }
+            | id "[" exp "]" "of" exp           { $$ = arena.make<Array>($1, $3, $6, @1.begin); }
+            | IF exp THEN exp ELSE exp          { $$ = arena.make<If>($2, $4, $6, @1.begin); }
+            | IF exp THEN exp                   { $$ = arena.make<If>($2, $4, nullptr, @1.begin); }
+            | WHILE exp DO exp                  { $$ = arena.make<While>($2, $4, @1.begin); }
+            | FOR id ":=" exp TO exp DO exp     { $$ = arena.make<For>($2, $4, $6, $8, @1.begin); }
+            | BREAK                             { $$ = arena.make<Break>(@1.begin); }
             | LET decs IN expseq END            {
-                                                  auto seq = make_shared<Seq>($4, @4.begin);
-                                                  $$ = make_shared<Let>($2, seq, @1.begin);
+                                                  auto seq = arena.make<Seq>($4, @4.begin);
+                                                  $$ = arena.make<Let>(arena.slice($2), seq, @1.begin);
                                                 }
 
-lvalue:     id %prec LVALUE                     { $$ = make_shared<SimpleVar>($1, @1.begin); }
+lvalue:     id %prec LVALUE                     { $$ = arena.make<SimpleVar>($1, @1.begin); }
             | id "[" exp "]"                    {
-                                                  auto var = make_shared<SimpleVar>($1, @1.begin);
-                                                  $$ = make_shared<SubscriptVar>(var, $3, @1.begin);
+                                                  auto var = arena.make<SimpleVar>($1, @1.begin);
+                                                  $$ = arena.make<SubscriptVar>(var, $3, @1.begin);
                                                 }
-            | lvalue "." id                     { $$ = make_shared<FieldVar>($1, $3, @1.begin); }
-            | lvalue "[" exp "]"                { $$ = make_shared<SubscriptVar>($1, $3, @1.begin); }
+            | lvalue "." id                     { $$ = arena.make<FieldVar>($1, $3, @1.begin); }
+            | lvalue "[" exp "]"                { $$ = arena.make<SubscriptVar>($1, $3, @1.begin); }
 
 expseq:     /* empty */                         { $$ = ptrs<Exp>(); }
-            | expseq_                           { $$ = $1; }
+            | expseq_                           { $$ = arena.slice($1); }
 
-expseq_:    exp                                 { $$ = ptrs<Exp>{ $1 }; }
+expseq_:    exp                                 { $$ = vector<Exp *>{ $1 }; }
             | expseq_ ";" exp                   { $$ = $1; $$.push_back($3); }
 
 arg_list:   /* empty */                         { $$ = ptrs<Exp>(); }
-            | arg_list_                         { $$ = $1; }
+            | arg_list_                         { $$ = arena.slice($1); }
 
-arg_list_:  exp                                 { $$ = ptrs<Exp>{ $1 }; }
+arg_list_:  exp                                 { $$ = vector<Exp *>{ $1 }; }
             | arg_list_ "," exp                 { $$ = $1; $$.push_back($3); }
 
 record_list:    /* empty */                     { $$ = ptrs<Record>(); }
-            | record_list_                      { $$ = $1; }
+            | record_list_                      { $$ = arena.slice($1); }
 
-record_list_:   record                          { $$ = ptrs<Record>{ $1 }; }
+record_list_:   record                          { $$ = vector<Record *>{ $1 }; }
             | record_list_ "," record           { $$ = $1; $$.push_back($3); }
 
-record:     id "=" exp                          { $$ = make_shared<Record>($1, $3, @1.begin); }
+record:     id "=" exp                          { $$ = arena.make<Record>($1, $3, @1.begin); }
 
-decs:       /* empty */                         { $$ = ptrs<Dec>(); }
+decs:       /* empty */                         { $$ = vector<Dec *>(); }
             | decs dec                          { $$ = $1, $$.push_back($2); }
 
 dec:        typedec                             { $$ = $1; }
             | vardec                            { $$ = $1; }
             | funcdec                           { $$ = $1; }
 
-typedec:    "type" id "=" ty                    { $$ = make_shared<TypeDec>($2, $4, @1.begin); }
+typedec:    "type" id "=" ty                    { $$ = arena.make<TypeDec>($2, $4, @1.begin); }
 
-ty:         id                                  { $$ = make_shared<NamedType>($1, @1.begin); }
-            | "array" "of" id                   { $$ = make_shared<ArrayType>($3, @1.begin); }
-            | "{" tyfields "}"                  { $$ = make_shared<RecordType>($2, @1.begin); }
+ty:         id                                  { $$ = arena.make<NamedType>($1, @1.begin); }
+            | "array" "of" id                   { $$ = arena.make<ArrayType>($3, @1.begin); }
+            | "{" tyfields "}"                  { $$ = arena.make<RecordType>($2, @1.begin); }
 
 tyfields:   /* empty */                         { $$ = ptrs<Field>(); }
-            | tyfields_                         { $$ = $1; }
+            | tyfields_                         { $$ = arena.slice($1); }
 
-tyfields_:  tyfield                             { $$ = ptrs<Field>{ $1 }; }
+tyfields_:  tyfield                             { $$ = vector<Field *>{ $1 }; }
             | tyfields_ "," tyfield             { $$ = $1; $$.push_back($3); }
 
-tyfield:    id ":" id                           { $$ = make_shared<Field>($1, $3, @1.begin); }
+tyfield:    id ":" id                           { $$ = arena.make<Field>($1, $3, @1.begin); }
 
-vardec:     "var" id ":=" exp                   { $$ = make_shared<VarDec>($2, nullptr, $4, @1.begin); }
-            | "var" id ":" id ":=" exp          { $$ = make_shared<VarDec>($2, $4, $6, @1.begin); }
+vardec:     "var" id ":=" exp                   { $$ = arena.make<VarDec>($2, nullptr, $4, @1.begin); }
+            | "var" id ":" id ":=" exp          { $$ = arena.make<VarDec>($2, $4, $6, @1.begin); }
 
 funcdec:    "function" id "(" tyfields ")" "=" exp
-                                                { $$ = make_shared<FunctionDec>($2, $4, nullptr, $7, @1.begin); }
+                                                { $$ = arena.make<FunctionDec>($2, $4, nullptr, $7, @1.begin); }
             | "function" id "(" tyfields ")" ":" id "=" exp
-                                                { $$ = make_shared<FunctionDec>($2, $4, $7, $9, @1.begin); }
+                                                { $$ = arena.make<FunctionDec>($2, $4, $7, $9, @1.begin); }
 
-id:         ID                                  { $$ = make_shared<ID>($1, @1.begin); }
+id:         ID                                  { $$ = arena.make<ID>($1, @1.begin); }
 
 %%
 
 void yy::TigerParser::error(const yy::location &loc, const string &msg) {
-  cerr << "parser error reason: " << msg << " (row: "
-    << loc.begin.line << ", column: " << loc.begin.column << ")." << endl;
+  throw utils::CompileError("parser error reason: " + msg + " (row: " + to_string(loc.begin.line) +
+                            ", column: " + to_string(loc.begin.column) + ").");
 }
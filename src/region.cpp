@@ -0,0 +1,279 @@
+#include <algorithm>
+#include "region.h"
+#include "fold.h"
+
+using namespace sm;
+using namespace absyn;
+using namespace std;
+
+void Regions::add(Exp &exp)
+{
+  exp.accept(*this);
+}
+
+void Regions::solve()
+{
+  // parameters start out kept and only ever escape, so recursive functions that pass
+  // their parameters along keep them.
+  for (auto changed = true; changed;)
+  {
+    changed = false;
+    for (auto &pass : passes)
+    {
+      if (escaped.count(pass.arg))
+        continue;
+      if (!analyzed.count(pass.callee) || escaped.count(pass.callee->dec->parameters[pass.index]->variable))
+      {
+        escaped.insert(pass.arg);
+        changed = true;
+      }
+    }
+  }
+  for (auto var : vars)
+    var->escape = escaped.count(var->variable);
+  for (auto param : params)
+    param->escape = escaped.count(param->variable);
+}
+
+void Regions::mark(bool regions)
+{
+  for (auto &candidate : candidates)
+  {
+    if (candidate.dec->escape)
+      continue;
+    auto record = dynamic_cast<RecordExp *>(candidate.dec->exp);
+    auto array = dynamic_cast<Array *>(candidate.dec->exp);
+    if (stackable(*candidate.dec))
+    {
+      if (record)
+        record->stack = true;
+      else
+      {
+        array->stack = true;
+        array->length = *constant(*array->capacity);
+      }
+    }
+    else if (regions)
+    {
+      if (record)
+        record->regional = true;
+      else
+        array->regional = true;
+      candidate.let->region = true;
+    }
+  }
+}
+
+// the object of a variable in the frame has no pointers for the collector to follow or
+// references to drop, and only the variable ever refers to it.
+bool Regions::stackable(const VarDec &varDec) const
+{
+  if (assigned.count(varDec.variable))
+    return false;
+  if (auto record = dynamic_cast<const RecordExp *>(varDec.exp))
+  {
+    auto &fields = ty::asRecord(record->type)->fields;
+    return all_of(fields.begin(), fields.end(), [](const auto &field)
+                  { return ty::isA(field.second, ty::Kind::Int); });
+  }
+  auto array = static_cast<const Array *>(varDec.exp);
+  auto length = constant(*array->capacity);
+  return ty::isA(ty::asArray(array->type)->type, ty::Kind::Int) && length && *length >= 0 &&
+         *length <= maxStackLength;
+}
+
+// The value of an integer expression of literals, arithmetic and variables that are never
+// assigned and initialized with such expressions, as in `var N := 8 ... intArray [N+N-1]`.
+optional<int64_t> Regions::constant(const Exp &exp) const
+{
+  if (auto folded = fold(exp))
+  {
+    if (auto value = get_if<int64_t>(&*folded))
+      return *value;
+    return nullopt;
+  }
+  if (auto var = dynamic_cast<const VarExp *>(&exp))
+  {
+    auto simple = dynamic_cast<const SimpleVar *>(var->var);
+    if (!simple || assigned.count(simple->variable))
+      return nullopt;
+    auto init = initializers.find(simple->variable);
+    if (init == initializers.end())
+      return nullopt;
+    return constant(*init->second);
+  }
+  auto bin = dynamic_cast<const BinOp *>(&exp);
+  if (!bin || (bin->op != Oper::plusOp && bin->op != Oper::minusOp && bin->op != Oper::timesOp))
+    return nullopt;
+  auto lhs = constant(*bin->lhs), rhs = constant(*bin->rhs);
+  // small enough that nothing overflows.
+  const int64_t limit = int64_t(1) << 31;
+  if (!lhs || !rhs || *lhs < -limit || *lhs > limit || *rhs < -limit || *rhs > limit)
+    return nullopt;
+  switch (bin->op)
+  {
+  case Oper::plusOp:
+    return *lhs + *rhs;
+  case Oper::minusOp:
+    return *lhs - *rhs;
+  default:
+    return *lhs * *rhs;
+  }
+}
+
+bool Regions::escapes(const Variable *variable) const
+{
+  return escaped.count(variable);
+}
+
+void Regions::inspect(Var &var)
+{
+  if (!dynamic_cast<SimpleVar *>(&var))
+    var.accept(*this);
+}
+
+void Regions::inspect(Exp &exp)
+{
+  auto var = dynamic_cast<VarExp *>(&exp);
+  if (var)
+    inspect(*var->var);
+  else
+    exp.accept(*this);
+}
+
+void Regions::visit(Nil &n) {}
+
+void Regions::visit(Int &i) {}
+
+void Regions::visit(String &s) {}
+
+// anywhere else than where it is inspected, the value of a variable may be kept.
+void Regions::visit(VarExp &var)
+{
+  if (auto simple = dynamic_cast<SimpleVar *>(var.var))
+    escaped.insert(simple->variable);
+  else
+    var.var->accept(*this);
+}
+
+void Regions::visit(Assign &assign)
+{
+  if (auto simple = dynamic_cast<SimpleVar *>(assign.var))
+    assigned.insert(simple->variable);
+  inspect(*assign.var);
+  assign.exp->accept(*this);
+}
+
+void Regions::visit(Seq &seq)
+{
+  for (auto exp : seq.seq)
+    exp->accept(*this);
+}
+
+void Regions::visit(Call &call)
+{
+  for (size_t i = 0; i < call.args.size(); i++)
+  {
+    auto var = dynamic_cast<VarExp *>(call.args[i]);
+    auto simple = var ? dynamic_cast<SimpleVar *>(var->var) : nullptr;
+    if (simple && !call.function->isBuiltin())
+      passes.push_back({simple->variable, call.function, i});
+    else
+      call.args[i]->accept(*this);
+  }
+}
+
+void Regions::visit(BinOp &bin)
+{
+  inspect(*bin.lhs);
+  inspect(*bin.rhs);
+}
+
+void Regions::visit(RecordExp &record)
+{
+  for (auto rcd : record.records)
+    rcd->value->accept(*this);
+}
+
+void Regions::visit(Array &array)
+{
+  array.capacity->accept(*this);
+  array.element->accept(*this);
+}
+
+void Regions::visit(If &iff)
+{
+  iff.condition->accept(*this);
+  iff.then->accept(*this);
+  if (iff.els)
+    iff.els->accept(*this);
+}
+
+void Regions::visit(While &whil)
+{
+  whil.condition->accept(*this);
+  whil.body->accept(*this);
+}
+
+void Regions::visit(For &forr)
+{
+  forr.from->accept(*this);
+  forr.to->accept(*this);
+  forr.body->accept(*this);
+}
+
+void Regions::visit(Break &brk) {}
+
+void Regions::visit(Let &let)
+{
+  auto enclosing = this->let;
+  this->let = &let;
+  for (auto dec : let.decs)
+    dec->accept(*this);
+  let.body->accept(*this);
+  this->let = enclosing;
+}
+
+void Regions::visit(SimpleVar &var) {}
+
+void Regions::visit(FieldVar &field)
+{
+  inspect(*field.var);
+}
+
+void Regions::visit(SubscriptVar &subscript)
+{
+  inspect(*subscript.var);
+  subscript.subscript->accept(*this);
+}
+
+void Regions::visit(ID &id) {}
+
+void Regions::visit(Record &record) {}
+
+void Regions::visit(Field &field) {}
+
+void Regions::visit(NamedType &named) {}
+
+void Regions::visit(ArrayType &arrayType) {}
+
+void Regions::visit(RecordType &recordType) {}
+
+void Regions::visit(TypeDec &typeDec) {}
+
+void Regions::visit(VarDec &varDec)
+{
+  vars.push_back(&varDec);
+  initializers[varDec.variable] = varDec.exp;
+  if (dynamic_cast<RecordExp *>(varDec.exp) || dynamic_cast<Array *>(varDec.exp))
+    candidates.push_back({let, &varDec});
+  varDec.exp->accept(*this);
+}
+
+void Regions::visit(FunctionDec &funcDec)
+{
+  analyzed.insert(funcDec.function);
+  for (auto param : funcDec.parameters)
+    params.push_back(param);
+  funcDec.body->accept(*this);
+}
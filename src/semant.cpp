@@ -0,0 +1,611 @@
+#include <algorithm>
+#include <cassert>
+#include <iostream>
+#include <sstream>
+#include "semant.h"
+#include "utils.h"
+
+using namespace sm;
+using namespace absyn;
+using namespace std;
+
+Variable::Variable(sym::Symbol name, ty::Type *type, Function *owner, int slot)
+    : name(name), type(type), owner(owner), slot(slot) {}
+
+Function::Function(int id, std::string name, absyn::FunctionDec *dec, Function *parent, ty::Type *returnType, std::vector<ty::Type *> args)
+    : id(id), name(name), dec(dec), parent(parent), returnType(returnType), args(args) {}
+
+bool Function::isBuiltin() const
+{
+  return !dec && id != 0;
+}
+
+bool Function::isNestedIn(const Function *other) const
+{
+  for (auto f = this; f; f = f->parent)
+    if (f == other)
+      return true;
+  return false;
+}
+
+int Function::captureIndex(const Variable *variable) const
+{
+  auto found = find(captures.begin(), captures.end(), variable);
+  return found == captures.end() ? -1 : distance(captures.begin(), found);
+}
+
+Checker::Checker()
+{
+  intType = types.intType();
+  stringType = types.stringType();
+  nilType = types.nilType();
+  voidType = types.voidType();
+
+  namedTypes.insert(sym::intern("int"), intType);
+  namedTypes.insert(sym::intern("string"), stringType);
+  namedTypes.insert(sym::intern("nil"), nilType);
+  namedTypes.insert(sym::intern("void"), voidType);
+
+  current = newFunction("main", nullptr, nullptr, {});
+
+  auto builtin = [this](const char *name, string ir_name, ty::Type *returnType, vector<ty::Type *> args)
+  {
+    Binding binding;
+    binding.function = newFunction(ir_name, nullptr, returnType, args);
+    namedValues.insert(sym::intern(name), binding);
+  };
+
+  builtin("print", "tiger_print", nullptr, {stringType});
+  builtin("flush", "tiger_flush", nullptr, {});
+  builtin("getchar", "tiger_getchar", stringType, {});
+  builtin("ord", "tiger_ord", intType, {stringType});
+  builtin("chr", "tiger_chr", stringType, {intType});
+  builtin("size", "tiger_size", intType, {stringType});
+  builtin("substring", "tiger_substring", stringType, {stringType, intType, intType});
+  builtin("concat", "tiger_concat", stringType, {stringType, stringType});
+  builtin("not", "tiger_not", intType, {intType});
+  builtin("exit", "tiger_exit", nullptr, {intType});
+  builtin("string_compare", "tiger_string_compare", intType, {stringType, stringType});
+}
+
+void Checker::check(absyn::Exp &exp)
+{
+  typeOf(exp);
+  resolveCaptures();
+}
+
+// A library module is a let of types and functions with an empty body. Its declarations
+// are checked once and stay in scope for the modules and the program checked after it.
+void Checker::import(std::string module, absyn::Exp &exp)
+{
+  auto let = dynamic_cast<Let *>(&exp);
+  auto body = let ? dynamic_cast<Seq *>(let->body) : nullptr;
+  if (!body || !body->seq.empty())
+    fatalError("module " + module + " must be a let of types and functions with an empty body", exp.pos);
+
+  vector<TypeDec *> ty_decs;
+  vector<FunctionDec *> func_decs;
+  for (auto &dec : let->decs)
+  {
+    if (auto ty_dec = dynamic_cast<TypeDec *>(dec))
+      ty_decs.push_back(ty_dec);
+    else if (auto func_dec = dynamic_cast<FunctionDec *>(dec))
+      func_decs.push_back(func_dec);
+    else
+      fatalError("module " + module + " can only declare types and functions", dec->pos);
+  }
+
+  preprocessTypeDecs(ty_decs);
+  exporting = module;
+  preprocessFunctionDecs(func_decs);
+  exporting.clear();
+
+  for (auto &dec : let->decs)
+    dec->accept(*this);
+  let->type = voidType;
+  modules_.push_back(let);
+  resolveCaptures();
+}
+
+const std::vector<absyn::Let *> &Checker::modules() const
+{
+  return modules_;
+}
+
+const std::vector<std::unique_ptr<Function>> &Checker::functions() const
+{
+  return functions_;
+}
+
+Function *Checker::mainFunction() const
+{
+  return functions_.front().get();
+}
+
+const ty::Context &Checker::typeContext() const
+{
+  return types;
+}
+
+Variable *Checker::newVariable(sym::Symbol name, ty::Type *type)
+{
+  variables.push_back(make_unique<Variable>(name, type, current, current->frameSize++));
+  return variables.back().get();
+}
+
+Function *Checker::newFunction(std::string name, absyn::FunctionDec *dec, ty::Type *returnType, std::vector<ty::Type *> args)
+{
+  int id = functions_.size();
+  functions_.push_back(make_unique<Function>(id, name, dec, current, returnType, args));
+  return functions_.back().get();
+}
+
+ty::Type *Checker::typeOf(absyn::Exp &exp)
+{
+  exp.accept(*this);
+  exp.type = result;
+  return result;
+}
+
+ty::Type *Checker::typeOf(absyn::Var &var)
+{
+  var.accept(*this);
+  var.type = result;
+  return result;
+}
+
+ty::Type *Checker::lookupType(absyn::ID &id, std::string error)
+{
+  auto found = namedTypes.find(id.id);
+  if (!found)
+    fatalError(error + id.id.name(), id.pos);
+  return *found;
+}
+
+void Checker::visit(Nil &n)
+{
+  result = nilType;
+}
+
+void Checker::visit(Int &i)
+{
+  result = intType;
+}
+
+void Checker::visit(String &s)
+{
+  result = stringType;
+}
+
+void Checker::visit(VarExp &var)
+{
+  result = typeOf(*var.var);
+}
+
+void Checker::visit(Assign &assign)
+{
+  auto var = typeOf(*assign.var);
+  auto exp = typeOf(*assign.exp);
+  if (ty::mismatch(var, exp))
+    fatalError("unmatched type assignment", assign.exp->pos);
+  result = voidType;
+}
+
+void Checker::visit(Seq &seq)
+{
+  auto type = voidType;
+  for (auto &exp : seq.seq)
+    type = typeOf(*exp);
+  result = type;
+}
+
+void Checker::visit(Call &call)
+{
+  auto found = namedValues.find(call.func->id);
+  if (!found)
+    fatalError("function " + call.func->id.name() + " not found", call.func->pos);
+
+  auto function = found->function;
+  if (!function)
+    fatalError(call.func->id.name() + " is not a function", call.func->pos);
+
+  if (call.args.size() != function->args.size())
+  {
+    ostringstream o;
+    o << "error number of parameters excepted " << function->args.size() << " actual" << call.args.size();
+    fatalError(o.str(), call.func->pos);
+  }
+
+  auto iter = function->args.begin();
+  for (auto &arg : call.args)
+  {
+    if (ty::mismatch(*iter, typeOf(*arg)))
+      fatalError("unmatched parameter type", arg->pos);
+    iter++;
+  }
+
+  call.function = function;
+  if (!function->isBuiltin() && find(current->callees.begin(), current->callees.end(), function) == current->callees.end())
+    current->callees.push_back(function);
+  result = function->returnType ? function->returnType : voidType;
+}
+
+void Checker::visit(BinOp &bin)
+{
+  auto lhs = typeOf(*bin.lhs);
+  if (isArithOp(bin.op))
+  {
+    if (ty::mismatch(lhs, intType))
+      fatalError("bad type of lhs", bin.lhs->pos);
+    if (ty::mismatch(typeOf(*bin.rhs), intType))
+      fatalError("bad type of rhs", bin.rhs->pos);
+  }
+  else if (ty::match(lhs, stringType) || ty::match(lhs, intType))
+  {
+    if (ty::mismatch(typeOf(*bin.rhs), lhs))
+      fatalError("unmatched type", bin.rhs->pos);
+  }
+  else if (ty::asArray(lhs) || ty::asRecord(lhs))
+  {
+    if (bin.op != Oper::eqOp && bin.op != Oper::neqOp)
+      fatalError("bad operator for reference type", bin.pos);
+    if (ty::mismatch(lhs, typeOf(*bin.rhs)))
+      fatalError("unmatched type", bin.rhs->pos);
+  }
+  else
+  {
+    fatalError("bad type to compare", bin.lhs->pos);
+  }
+  result = intType;
+}
+
+void Checker::visit(RecordExp &record)
+{
+  auto found_type = namedTypes.find(record.type_id->id);
+  if (!found_type)
+    fatalError("type " + record.type_id->id.name() + " is undefined", record.pos);
+  auto type = *found_type;
+  auto record_ty = ty::asRecord(type);
+  if (!record_ty)
+    fatalError("type " + record.type_id->id.name() + " is not a record type", record.pos);
+
+  for (auto &rcd : record.records)
+  {
+    auto index = record_ty->fieldIndex(rcd->name->id);
+    if (index < 0)
+      fatalError("field " + rcd->name->id.name() + " is undefined", rcd->pos);
+    if (ty::mismatch(record_ty->fields[index].second, typeOf(*rcd->value)))
+      fatalError("type of field " + rcd->name->id.name() + " is not matched", rcd->value->pos);
+    rcd->index = index;
+  }
+  result = type;
+}
+
+void Checker::visit(Array &array)
+{
+  auto found_type = namedTypes.find(array.type_id->id);
+  if (!found_type)
+    fatalError("type " + array.type_id->id.name() + " is undefined", array.pos);
+  auto type = *found_type;
+  auto array_ty = ty::asArray(type);
+  if (!array_ty)
+    fatalError("type " + array.type_id->id.name() + " is not a array type", array.pos);
+
+  if (ty::mismatch(typeOf(*array.capacity), intType))
+    fatalError("capacity of array must be int type", array.capacity->pos);
+  if (ty::mismatch(array_ty->type, typeOf(*array.element)))
+    fatalError("type of element is not matched", array.element->pos);
+  result = type;
+}
+
+void Checker::visit(If &iff)
+{
+  if (ty::mismatch(typeOf(*iff.condition), intType))
+    fatalError("if condition must be int type", iff.condition->pos);
+
+  auto then = typeOf(*iff.then);
+  if (!iff.els)
+  {
+    result = voidType;
+    return;
+  }
+
+  auto els = typeOf(*iff.els);
+  if (ty::match(then, voidType) && ty::match(els, voidType))
+    result = voidType;
+  else if (ty::match(then, els))
+    result = ty::isA(then, ty::Kind::Nil) ? els : then;
+  else
+    fatalError("if else, then must have same type or both emit empty value", iff.pos);
+}
+
+void Checker::visit(While &whil)
+{
+  if (ty::mismatch(typeOf(*whil.condition), intType))
+    fatalError("while condition must be int type", whil.condition->pos);
+
+  loops++;
+  typeOf(*whil.body);
+  loops--;
+  result = voidType;
+}
+
+void Checker::visit(For &forr)
+{
+  if (ty::mismatch(typeOf(*forr.from), intType))
+    fatalError("lower of range must be int type", forr.from->pos);
+  if (ty::mismatch(typeOf(*forr.to), intType))
+    fatalError("upper of range must be int type", forr.to->pos);
+
+  beginScope();
+  Binding binding;
+  binding.variable = forr.variable = newVariable(forr.var->id, intType);
+  namedValues.insert(forr.var->id, binding);
+  loops++;
+  typeOf(*forr.body);
+  loops--;
+  endScope();
+  result = voidType;
+}
+
+void Checker::visit(Break &brk)
+{
+  if (loops == 0)
+    fatalError("unexcepted break", brk.pos);
+  result = voidType;
+}
+
+void Checker::visit(Let &let)
+{
+  beginScope();
+
+  vector<TypeDec *> ty_decs;
+  vector<FunctionDec *> func_decs;
+  for (auto &dec : let.decs)
+  {
+    if (auto ty_dec = dynamic_cast<TypeDec *>(dec))
+      ty_decs.push_back(ty_dec);
+    else if (auto func_dec = dynamic_cast<FunctionDec *>(dec))
+      func_decs.push_back(func_dec);
+  }
+
+  preprocessTypeDecs(ty_decs);
+  preprocessFunctionDecs(func_decs);
+
+  for (auto &dec : let.decs)
+    dec->accept(*this);
+  auto body = typeOf(*let.body);
+  endScope();
+  result = body;
+}
+
+void Checker::visit(SimpleVar &var)
+{
+  auto found = namedValues.find(var.name->id);
+  if (!found)
+    fatalError("variable " + var.name->id.name() + " is undefiend.", var.name->pos);
+
+  auto variable = found->variable;
+  if (!variable)
+    fatalError(var.name->id.name() + " is not a name of variable", var.name->pos);
+
+  if (variable->owner != current && current->captureIndex(variable) < 0)
+    current->captures.push_back(variable);
+  var.variable = variable;
+  result = variable->type;
+}
+
+void Checker::visit(FieldVar &field)
+{
+  auto record = ty::asRecord(typeOf(*field.var));
+  if (!record)
+    fatalError("bad field access on a not record type", field.pos);
+
+  auto index = record->fieldIndex(field.field->id);
+  if (index < 0)
+    fatalError("record type has no field " + field.field->id.name(), field.field->pos);
+  field.index = index;
+  result = record->fields[index].second;
+}
+
+void Checker::visit(SubscriptVar &subscript)
+{
+  auto array = ty::asArray(typeOf(*subscript.var));
+  if (!array)
+    fatalError("bad element access on a not array type", subscript.pos);
+  if (ty::mismatch(typeOf(*subscript.subscript), intType))
+    fatalError("subscript of array is not int type", subscript.subscript->pos);
+  result = array->type;
+}
+
+void Checker::visit(ID &id) {}
+
+void Checker::visit(Record &record) {}
+
+void Checker::visit(Field &field) {}
+
+void Checker::visit(NamedType &named) {}
+
+void Checker::visit(ArrayType &arrayType) {}
+
+void Checker::visit(RecordType &recordType) {}
+
+void Checker::visit(TypeDec &typeDec) {}
+
+void Checker::visit(VarDec &varDec)
+{
+  auto exp = typeOf(*varDec.exp);
+  auto type = exp;
+  if (varDec.type_id)
+  {
+    type = lookupType(*varDec.type_id, "undeclared type ");
+    if (ty::mismatch(type, exp))
+      fatalError("unmatched type for var declare " + varDec.type_id->id.name(), varDec.exp->pos);
+  }
+  else if (ty::isA(exp, ty::Kind::Void))
+  {
+    fatalError("variable " + varDec.var->id.name() + " has no value", varDec.exp->pos);
+  }
+  else if (ty::isA(exp, ty::Kind::Nil))
+  {
+    fatalError("variable " + varDec.var->id.name() + " needs a record type to hold nil", varDec.exp->pos);
+  }
+
+  Binding binding;
+  binding.variable = varDec.variable = newVariable(varDec.var->id, type);
+  namedValues.insert(varDec.var->id, binding);
+  result = voidType;
+}
+
+void Checker::visit(FunctionDec &funcDec)
+{
+  auto function = funcDec.function;
+  auto saved_current = current;
+  auto saved_loops = loops;
+  current = function;
+  loops = 0;
+
+  beginScope();
+  auto arg_iter = function->args.begin();
+  for (auto &param : funcDec.parameters)
+  {
+    Binding binding;
+    binding.variable = param->variable = newVariable(param->name->id, *arg_iter++);
+    namedValues.insert(param->name->id, binding);
+  }
+  auto body = typeOf(*funcDec.body);
+  endScope();
+
+  if (function->returnType && ty::mismatch(function->returnType, body))
+    fatalError("function " + funcDec.funcname->id.name() + " mismatch return type", funcDec.body->pos);
+
+  current = saved_current;
+  loops = saved_loops;
+  result = voidType;
+}
+
+// Types of a declaration group may refer to each other in any order, so every name is
+// bound before any reference is resolved.
+void Checker::preprocessTypeDecs(std::vector<absyn::TypeDec *> decs)
+{
+  vector<ty::Type *> declared;
+  for (auto dec : decs)
+  {
+    auto tid = dec->type_id->id;
+    ty::Type *type = nullptr;
+    if (dynamic_cast<NamedType *>(dec->type))
+      type = types.named(tid);
+    else if (dynamic_cast<absyn::ArrayType *>(dec->type))
+      type = types.array(tid);
+    else if (dynamic_cast<RecordType *>(dec->type))
+      type = types.record(tid);
+    else
+      assert(0 && "unrecognized type in AST");
+    namedTypes.insert(tid, type);
+    declared.push_back(type);
+  }
+
+  vector<ty::Named *> aliases;
+  auto type_iter = declared.begin();
+  for (auto dec : decs)
+  {
+    auto type = *type_iter++;
+    if (auto named = dynamic_cast<NamedType *>(dec->type))
+    {
+      auto alias = static_cast<ty::Named *>(type);
+      alias->type = lookupType(*named->named, "undefined type ");
+      aliases.push_back(alias);
+    }
+    else if (auto array = dynamic_cast<absyn::ArrayType *>(dec->type))
+    {
+      static_cast<ty::Array *>(type)->type = lookupType(*array->array, "undefined type ");
+    }
+    else if (auto record = dynamic_cast<RecordType *>(dec->type))
+    {
+      auto record_ty = static_cast<ty::Record *>(type);
+      for (auto field : record->fields)
+      {
+        if (record_ty->fieldIndex(field->name->id) >= 0)
+          fatalError("duplicate field " + field->name->id.name(), field->pos);
+        record_ty->addField(field->name->id, lookupType(*field->type_id, "undefined type "));
+      }
+    }
+  }
+
+  if (auto cyclic = types.resolve(aliases))
+    for (auto dec : decs)
+      if (dec->type_id->id == cyclic->name)
+        fatalError("illegal cycle in declaration of type " + cyclic->name.name(), dec->pos);
+}
+
+void Checker::preprocessFunctionDecs(std::vector<absyn::FunctionDec *> decs)
+{
+  for (auto f_dec : decs)
+  {
+    if (namedValues.find_top(f_dec->funcname->id))
+      fatalError("redeclare function " + f_dec->funcname->id.name(), f_dec->pos);
+
+    vector<ty::Type *> args;
+    for (auto field : f_dec->parameters)
+      args.push_back(lookupType(*field->type_id, "undefined type "));
+
+    ty::Type *returnType = nullptr;
+    if (f_dec->return_type)
+      returnType = lookupType(*f_dec->return_type, "undefined type ");
+
+    auto name = f_dec->funcname->id.name();
+    Binding binding;
+    if (exporting.empty())
+    {
+      // a symbol follows the functions the declaration is nested in and counts only the
+      // functions of the same name declared in the same function before it, so that it
+      // stays the same when other functions are added or removed.
+      auto path = current == mainFunction() ? name : current->name + "." + name;
+      auto index = ++siblings[path];
+      binding.function = newFunction(path + "_" + to_string(index), f_dec, returnType, args);
+    }
+    else
+    {
+      binding.function = newFunction(exporting + "." + name, f_dec, returnType, args);
+      binding.function->exported = true;
+    }
+    f_dec->function = binding.function;
+    namedValues.insert(f_dec->funcname->id, binding);
+  }
+}
+
+// A call passes the callee's captures along, so every capture of a callee that is
+// not one of the caller's own variables becomes a capture of the caller as well.
+void Checker::resolveCaptures()
+{
+  bool changed = true;
+  while (changed)
+  {
+    changed = false;
+    for (auto &function : functions_)
+      for (auto callee : function->callees)
+        for (auto variable : callee->captures)
+          if (variable->owner != function.get() && function->captureIndex(variable) < 0)
+          {
+            function->captures.push_back(variable);
+            changed = true;
+          }
+  }
+}
+
+void Checker::beginScope()
+{
+  namedValues.enter();
+  namedTypes.enter();
+}
+
+void Checker::endScope()
+{
+  namedTypes.exit();
+  namedValues.exit();
+}
+
+void Checker::fatalError(std::string error, absyn::position pos)
+{
+  throw utils::CompileError(error + " (row: " + to_string(pos.line) + ", column: " + to_string(pos.column) + ").");
+}
@@ -0,0 +1,488 @@
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <numeric>
+#include <sstream>
+#include <vector>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "server.h"
+
+using namespace server;
+using namespace std;
+
+// Requests start with their kind. A compile request carries the working directory, the
+// arguments and the forwarded environment of the client, and every request is answered
+// with a status and the text the client prints. Integers are in host order, strings are
+// prefixed with their size.
+
+// environment variables a compilation reads.
+static const char *forwardedEnvironment[] = {"KALEC_CACHE_DIR"};
+
+std::string server::socketPath()
+{
+  if (auto path = getenv("KALECD_SOCKET"))
+    return path;
+  return "/tmp/kalecd-" + to_string(getuid()) + ".sock";
+}
+
+static bool writeAll(int fd, const void *data, size_t size)
+{
+  auto bytes = static_cast<const char *>(data);
+  while (size > 0)
+  {
+    auto written = write(fd, bytes, size);
+    if (written < 0 && errno == EINTR)
+      continue;
+    if (written <= 0)
+      return false;
+    bytes += written;
+    size -= written;
+  }
+  return true;
+}
+
+static bool readAll(int fd, void *data, size_t size)
+{
+  auto bytes = static_cast<char *>(data);
+  while (size > 0)
+  {
+    auto got = read(fd, bytes, size);
+    if (got < 0 && errno == EINTR)
+      continue;
+    if (got <= 0)
+      return false;
+    bytes += got;
+    size -= got;
+  }
+  return true;
+}
+
+static bool writeInt(int fd, uint32_t value)
+{
+  return writeAll(fd, &value, sizeof(value));
+}
+
+static bool readInt(int fd, uint32_t &value)
+{
+  return readAll(fd, &value, sizeof(value));
+}
+
+static bool writeString(int fd, const string &value)
+{
+  return writeInt(fd, value.size()) && writeAll(fd, value.data(), value.size());
+}
+
+static bool readString(int fd, string &value)
+{
+  uint32_t size;
+  if (!readInt(fd, size))
+    return false;
+  value.resize(size);
+  return readAll(fd, value.data(), size);
+}
+
+static bool writeStrings(int fd, const vector<string> &values)
+{
+  if (!writeInt(fd, values.size()))
+    return false;
+  for (auto &value : values)
+    if (!writeString(fd, value))
+      return false;
+  return true;
+}
+
+static bool readStrings(int fd, vector<string> &values)
+{
+  uint32_t count;
+  if (!readInt(fd, count))
+    return false;
+  values.resize(count);
+  for (auto &value : values)
+    if (!readString(fd, value))
+      return false;
+  return true;
+}
+
+static bool socketAddress(const string &path, sockaddr_un &address)
+{
+  memset(&address, 0, sizeof(address));
+  if (path.size() >= sizeof(address.sun_path))
+    return false;
+  address.sun_family = AF_UNIX;
+  memcpy(address.sun_path, path.c_str(), path.size() + 1);
+  return true;
+}
+
+static int connectTo(const string &path)
+{
+  sockaddr_un address;
+  if (!socketAddress(path, address))
+    return -1;
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0)
+    return -1;
+  fcntl(fd, F_SETFD, FD_CLOEXEC);
+  if (connect(fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) < 0)
+  {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+static bool answer(int fd, int status, const string &text)
+{
+  return writeInt(fd, status) && writeString(fd, text);
+}
+
+static bool receive(int fd, int &status, string &text)
+{
+  uint32_t code;
+  if (!readInt(fd, code) || !readString(fd, text))
+    return false;
+  status = static_cast<int32_t>(code);
+  return true;
+}
+
+// A daemon that goes away while it compiles leaves the client to compile by itself.
+bool server::forward(int argc, char *argv[], int &status)
+{
+  auto fd = connectTo(socketPath());
+  if (fd < 0)
+    return false;
+  signal(SIGPIPE, SIG_IGN);
+
+  auto cwd = getcwd(nullptr, 0);
+  string directory = cwd ? cwd : ".";
+  free(cwd);
+  vector<string> arguments(argv, argv + argc);
+  vector<string> environment;
+  for (auto name : forwardedEnvironment)
+    if (auto value = getenv(name))
+      environment.push_back(string(name) + "=" + value);
+
+  string diagnostics;
+  auto answered = writeInt(fd, static_cast<uint32_t>(Request::Compile)) && writeString(fd, directory) &&
+                  writeStrings(fd, arguments) && writeStrings(fd, environment) &&
+                  receive(fd, status, diagnostics);
+  close(fd);
+  if (answered)
+    cerr << diagnostics;
+  return answered;
+}
+
+bool server::query(const std::string &path, Request request, std::string &reply)
+{
+  auto fd = connectTo(path);
+  if (fd < 0)
+    return false;
+  signal(SIGPIPE, SIG_IGN);
+  int status;
+  auto answered = writeInt(fd, static_cast<uint32_t>(request)) && receive(fd, status, reply);
+  close(fd);
+  return answered;
+}
+
+namespace
+{
+  // The daemon is one thread that polls its listener and the output of its workers. It
+  // never runs a thread of its own, so nothing in it holds a lock when it forks.
+  class Daemon
+  {
+  public:
+    Daemon(int listener, unsigned workers, Compile compile)
+        : listener(listener), workers(workers), compile(compile) {}
+
+    void run();
+
+  private:
+    // latencies of the most recent requests are kept for the statistics.
+    static constexpr size_t window = 1024;
+    // a client that does not send its request within this time is dropped.
+    static constexpr int requestTimeout = 5;
+
+    using clock = std::chrono::steady_clock;
+
+    struct Request
+    {
+      int client;
+      std::string directory;
+      std::vector<std::string> arguments;
+      std::vector<std::string> environment;
+      clock::time_point start;
+      // requests waiting when it came.
+      size_t depth;
+    };
+
+    struct Worker
+    {
+      pid_t pid;
+      // the read end of the stdout and stderr of the worker.
+      int output;
+      std::string text;
+      Request request;
+    };
+
+    int listener;
+    unsigned workers;
+    Compile compile;
+
+    std::deque<Request> queue;
+    std::vector<Worker> running;
+    uint64_t served = 0;
+    double slowest = 0;
+    std::deque<double> latencies;
+    bool stopped = false;
+
+    void accept();
+    void start(Request request);
+    void finish(Worker &worker);
+    std::string stats();
+  };
+}
+
+// Requests already accepted are still served after a stop request.
+void Daemon::run()
+{
+  while (!stopped || !queue.empty() || !running.empty())
+  {
+    while (running.size() < workers && !queue.empty())
+    {
+      start(std::move(queue.front()));
+      queue.pop_front();
+    }
+
+    vector<pollfd> fds;
+    for (auto &worker : running)
+      fds.push_back({worker.output, POLLIN, 0});
+    if (!stopped)
+      fds.push_back({listener, POLLIN, 0});
+    if (fds.empty())
+      continue;
+    if (poll(fds.data(), fds.size(), -1) < 0)
+    {
+      if (errno == EINTR)
+        continue;
+      cerr << "kalecd: poll failed: " << strerror(errno) << endl;
+      break;
+    }
+
+    // backwards, so that removing a finished worker keeps the others at their poll entry.
+    for (size_t i = running.size(); i-- > 0;)
+    {
+      if (!fds[i].revents)
+        continue;
+      char buffer[4096];
+      auto got = read(running[i].output, buffer, sizeof(buffer));
+      if (got < 0 && errno == EINTR)
+        continue;
+      if (got > 0)
+      {
+        running[i].text.append(buffer, got);
+        continue;
+      }
+      finish(running[i]);
+      running.erase(running.begin() + i);
+    }
+    if (!stopped && fds.back().revents)
+      accept();
+  }
+  close(listener);
+}
+
+void Daemon::accept()
+{
+  int client = ::accept(listener, nullptr, nullptr);
+  if (client < 0)
+    return;
+  fcntl(client, F_SETFD, FD_CLOEXEC);
+  timeval timeout{requestTimeout, 0};
+  setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+  uint32_t kind;
+  if (!readInt(client, kind))
+  {
+    close(client);
+    return;
+  }
+  switch (static_cast<server::Request>(kind))
+  {
+  case server::Request::Compile:
+  {
+    // waiting for a worker counts towards the latency of a request.
+    Request request{client, {}, {}, {}, clock::now(), queue.size()};
+    if (readString(client, request.directory) && readStrings(client, request.arguments) &&
+        readStrings(client, request.environment) && !request.arguments.empty())
+    {
+      queue.push_back(std::move(request));
+      return;
+    }
+    break;
+  }
+  case server::Request::Stats:
+    answer(client, 0, stats());
+    break;
+  case server::Request::Stop:
+    answer(client, 0, "");
+    stopped = true;
+    break;
+  default:
+    answer(client, 1, "kalecd: unknown request\n");
+    break;
+  }
+  close(client);
+}
+
+void Daemon::start(Request request)
+{
+  int pipes[2];
+  if (pipe(pipes) != 0)
+  {
+    answer(request.client, 1, "kalecd: could not create a pipe\n");
+    close(request.client);
+    return;
+  }
+
+  auto pid = fork();
+  if (pid == 0)
+  {
+    // the worker keeps nothing of the daemon but its own request.
+    close(pipes[0]);
+    close(listener);
+    close(request.client);
+    for (auto &waiting : queue)
+      close(waiting.client);
+    for (auto &worker : running)
+    {
+      close(worker.output);
+      close(worker.request.client);
+    }
+    dup2(pipes[1], STDOUT_FILENO);
+    dup2(pipes[1], STDERR_FILENO);
+    close(pipes[1]);
+    if (chdir(request.directory.c_str()) != 0)
+    {
+      cerr << "kalecd: could not enter " << request.directory << endl;
+      exit(1);
+    }
+    for (auto name : forwardedEnvironment)
+      unsetenv(name);
+    for (auto &variable : request.environment)
+    {
+      auto split = variable.find('=');
+      setenv(variable.substr(0, split).c_str(), variable.substr(split + 1).c_str(), 1);
+    }
+
+    vector<char *> argv;
+    for (auto &argument : request.arguments)
+      argv.push_back(argument.data());
+    argv.push_back(nullptr);
+    exit(compile(request.arguments.size(), argv.data()));
+  }
+  close(pipes[1]);
+
+  if (pid < 0)
+  {
+    close(pipes[0]);
+    answer(request.client, 1, "kalecd: could not start a worker\n");
+    close(request.client);
+    return;
+  }
+  running.push_back({pid, pipes[0], "", std::move(request)});
+}
+
+void Daemon::finish(Worker &worker)
+{
+  close(worker.output);
+  int wait_status, status;
+  while (waitpid(worker.pid, &wait_status, 0) < 0 && errno == EINTR)
+    ;
+  if (WIFEXITED(wait_status))
+  {
+    status = WEXITSTATUS(wait_status);
+  }
+  else
+  {
+    status = 128 + WTERMSIG(wait_status);
+    worker.text += "kalecd: compiler killed by signal " + to_string(WTERMSIG(wait_status)) + "\n";
+  }
+
+  auto &request = worker.request;
+  auto milliseconds = chrono::duration<double, milli>(clock::now() - request.start).count();
+  served++;
+  slowest = max(slowest, milliseconds);
+  latencies.push_back(milliseconds);
+  if (latencies.size() > window)
+    latencies.pop_front();
+
+  cerr << "kalecd:";
+  for (size_t i = 1; i < request.arguments.size(); i++)
+    cerr << " " << request.arguments[i];
+  cerr << ": status " << status << " in " << milliseconds << " ms, " << request.depth << " queued before it" << endl;
+  answer(request.client, status, worker.text);
+  close(request.client);
+}
+
+std::string Daemon::stats()
+{
+  vector<double> sorted(latencies.begin(), latencies.end());
+  sort(sorted.begin(), sorted.end());
+  auto percentile = [&](double p)
+  { return sorted.empty() ? 0.0 : sorted[min(sorted.size() - 1, static_cast<size_t>(p * sorted.size()))]; };
+  auto mean = sorted.empty() ? 0.0 : accumulate(sorted.begin(), sorted.end(), 0.0) / sorted.size();
+
+  ostringstream out;
+  out << "kalecd: " << served << " requests, " << running.size() << " running, " << queue.size() << " queued, latency "
+      << mean << " ms mean, " << percentile(0.5) << " ms p50, " << percentile(0.95) << " ms p95, "
+      << slowest << " ms max\n";
+  return out.str();
+}
+
+int server::serve(const std::string &path, unsigned workers, Compile compile)
+{
+  signal(SIGPIPE, SIG_IGN);
+  string reply;
+  if (query(path, Request::Stats, reply))
+  {
+    cerr << "a daemon already listens on " << path << endl;
+    return 1;
+  }
+
+  sockaddr_un address;
+  if (!socketAddress(path, address))
+  {
+    cerr << "socket path " << path << " is too long" << endl;
+    return 1;
+  }
+  // only the user running the daemon may connect to it.
+  unlink(path.c_str());
+  int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+  auto mask = umask(S_IRWXG | S_IRWXO);
+  auto bound = listener >= 0 && bind(listener, reinterpret_cast<sockaddr *>(&address), sizeof(address)) == 0;
+  umask(mask);
+  if (!bound || listen(listener, SOMAXCONN) != 0)
+  {
+    cerr << "could not listen on " << path << ": " << strerror(errno) << endl;
+    return 1;
+  }
+  fcntl(listener, F_SETFD, FD_CLOEXEC);
+
+  cerr << "kalecd: listening on " << path << " with " << workers << " workers" << endl;
+  Daemon kalecd(listener, workers, compile);
+  kalecd.run();
+  unlink(path.c_str());
+  return 0;
+}
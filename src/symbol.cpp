@@ -0,0 +1,56 @@
+#include <deque>
+#include <mutex>
+#include <unordered_map>
+#include "symbol.h"
+
+using namespace sym;
+using namespace std;
+
+namespace
+{
+  struct Interner
+  {
+    mutex lock;
+    // a deque keeps the strings in place, so the views used as keys stay valid.
+    deque<string> names;
+    unordered_map<string_view, uint32_t> ids;
+
+    Interner()
+    {
+      names.emplace_back();
+      ids.emplace(names.back(), 0);
+    }
+  };
+
+  Interner &interner()
+  {
+    static Interner instance;
+    return instance;
+  }
+}
+
+Symbol sym::intern(std::string_view name)
+{
+  auto &table = interner();
+  lock_guard<mutex> guard(table.lock);
+  auto found = table.ids.find(name);
+  if (found != table.ids.end())
+    return Symbol(found->second);
+
+  uint32_t id = table.names.size();
+  table.names.emplace_back(name);
+  table.ids.emplace(table.names.back(), id);
+  return Symbol(id);
+}
+
+const std::string &Symbol::name() const
+{
+  auto &table = interner();
+  lock_guard<mutex> guard(table.lock);
+  return table.names[id_];
+}
+
+std::ostream &sym::operator<<(std::ostream &out, Symbol symbol)
+{
+  return out << symbol.name();
+}
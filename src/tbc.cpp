@@ -0,0 +1,29 @@
+#include "tbc.h"
+
+using namespace bc;
+
+const char *const bc::opcodeNames[OPCODE_COUNT] = {
+#define TIGER_OPCODE_NAME(name, kinds) #name,
+    TIGER_OPCODES(TIGER_OPCODE_NAME)
+#undef TIGER_OPCODE_NAME
+};
+
+const char *const bc::operandKinds[OPCODE_COUNT] = {
+#define TIGER_OPCODE_KINDS(name, kinds) kinds,
+    TIGER_OPCODES(TIGER_OPCODE_KINDS)
+#undef TIGER_OPCODE_KINDS
+};
+
+const char *const bc::builtinNames[BUILTIN_COUNT] = {
+    "tiger_print",
+    "tiger_flush",
+    "tiger_getchar",
+    "tiger_ord",
+    "tiger_chr",
+    "tiger_size",
+    "tiger_substring",
+    "tiger_concat",
+    "tiger_not",
+    "tiger_exit",
+    "tiger_string_compare",
+};
@@ -0,0 +1,148 @@
+#include <chrono>
+#include <set>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/GlobalVariable.h>
+#include <llvm/Transforms/Utils/Cloning.h>
+#include "interp.h"
+
+using namespace interp;
+using namespace llvm;
+using namespace std;
+
+Tier::Tier(absyn::Exp &program, const sm::Checker &checker, cg::CompileOptions options)
+    : program(program), checker(checker), options(options) {}
+
+Tier::~Tier() = default;
+
+int Tier::compiledFunctions() const
+{
+  return compiled;
+}
+
+double Tier::compileMilliseconds() const
+{
+  return milliseconds;
+}
+
+// The whole program is translated once, on the first tier-up, and every hot function
+// is cloned out of that module afterwards.
+void Tier::prepare()
+{
+  if (module)
+    return;
+
+  jit = make_unique<cg::JIT>(options);
+  jit->define("tiger_tier_call", reinterpret_cast<void *>(&tiger_tier_call));
+  generator = make_unique<cg::CodeGenerator>(checker, options);
+  generator->translate(program);
+  module = std::move(generator->moduler);
+  context = orc::ThreadSafeContext(generator->takeContext());
+  jit->addModule(createStubs(), context);
+}
+
+// For every function f:
+//   f         jumps through f.target, which points to f.interp until f is compiled.
+//   f.interp  packs the arguments and enters the interpreter through tiger_tier_call.
+//   f.entry   unpacks the arguments of the interpreter and calls f.
+unique_ptr<Module> Tier::createStubs()
+{
+  auto &ctx = module->getContext();
+  auto stubs = make_unique<Module>("tier stubs", ctx);
+  stubs->setDataLayout(module->getDataLayout());
+  stubs->setTargetTriple(module->getTargetTriple());
+
+  IRBuilder<> builder(ctx);
+  auto i64 = builder.getInt64Ty();
+  auto ptr = builder.getPtrTy();
+  auto bridge = Function::Create(
+      FunctionType::get(i64, {i64, ptr}, false), Function::ExternalLinkage, "tiger_tier_call", stubs.get());
+
+  auto toInt = [&](Value *value) -> Value *
+  { return value->getType()->isPointerTy() ? builder.CreatePtrToInt(value, i64) : value; };
+  auto fromInt = [&](Value *value, Type *type) -> Value *
+  { return type->isPointerTy() ? builder.CreateIntToPtr(value, type) : value; };
+  auto ret = [&](Value *value, Type *type)
+  {
+    if (type->isVoidTy())
+      builder.CreateRetVoid();
+    else
+      builder.CreateRet(fromInt(value, type));
+  };
+
+  for (auto &function : checker.functions())
+  {
+    if (!function->dec)
+      continue;
+    auto type = module->getFunction(function->name)->getFunctionType();
+    auto returnType = type->getReturnType();
+    auto arity = type->getNumParams();
+
+    auto interpreted = Function::Create(type, Function::InternalLinkage, function->name + ".interp", stubs.get());
+    builder.SetInsertPoint(BasicBlock::Create(ctx, "entry", interpreted));
+    auto packed = builder.CreateAlloca(i64, builder.getInt32(max(arity, 1u)));
+    for (auto &arg : interpreted->args())
+      builder.CreateStore(toInt(&arg), builder.CreateConstInBoundsGEP1_64(i64, packed, arg.getArgNo()));
+    ret(builder.CreateCall(bridge, {builder.getInt64(function->id), packed}), returnType);
+
+    auto target = new GlobalVariable(*stubs, ptr, false, GlobalValue::ExternalLinkage, interpreted, function->name + ".target");
+
+    auto dispatch = Function::Create(type, Function::ExternalLinkage, function->name, stubs.get());
+    builder.SetInsertPoint(BasicBlock::Create(ctx, "entry", dispatch));
+    vector<Value *> args;
+    for (auto &arg : dispatch->args())
+      args.push_back(&arg);
+    auto call = builder.CreateCall(type, builder.CreateLoad(ptr, target), args);
+    call->setTailCall();
+    if (returnType->isVoidTy())
+      builder.CreateRetVoid();
+    else
+      builder.CreateRet(call);
+
+    auto entry = Function::Create(
+        FunctionType::get(i64, {ptr}, false), Function::ExternalLinkage, function->name + ".entry", stubs.get());
+    builder.SetInsertPoint(BasicBlock::Create(ctx, "entry", entry));
+    args.clear();
+    for (unsigned i = 0; i < arity; i++)
+    {
+      auto arg = builder.CreateLoad(i64, builder.CreateConstInBoundsGEP1_64(i64, entry->getArg(0), i));
+      args.push_back(fromInt(arg, type->getParamType(i)));
+    }
+    auto result = builder.CreateCall(dispatch, args);
+    builder.CreateRet(returnType->isVoidTy() ? builder.getInt64(0) : toInt(result));
+  }
+
+  return stubs;
+}
+
+Entry Tier::compile(const sm::Function *function)
+{
+  using clock = chrono::steady_clock;
+  auto start = clock::now();
+  prepare();
+
+  // nested functions are compiled along with their parent, everything else stays a
+  // declaration that resolves to its stub.
+  set<const GlobalValue *> definitions;
+  for (auto &candidate : checker.functions())
+    if (candidate->dec && candidate->isNestedIn(function))
+      definitions.insert(module->getFunction(candidate->name));
+
+  ValueToValueMapTy map;
+  auto clone = CloneModule(*module, map, [&](const GlobalValue *value)
+                           { return !isa<Function>(value) || definitions.count(value); });
+  if (auto main = clone->getFunction("main"); main && main->use_empty())
+    main->eraseFromParent();
+  auto native = clone->getFunction(function->name);
+  native->setName(function->name + ".native");
+  native->setLinkage(GlobalValue::ExternalLinkage);
+  generator->optimize(*clone);
+  jit->addModule(std::move(clone), context);
+
+  auto address = jit->lookup(function->name + ".native");
+  *static_cast<void **>(jit->lookup(function->name + ".target")) = address;
+  auto entry = reinterpret_cast<Entry>(jit->lookup(function->name + ".entry"));
+
+  compiled++;
+  milliseconds += chrono::duration<double, milli>(clock::now() - start).count();
+  return entry;
+}
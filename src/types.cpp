@@ -1,201 +1,79 @@
-#include <algorithm>
-#include <vector>
-#include <map>
+#include <set>
 #include "types.h"
 
 using namespace ty;
 using namespace std;
 
-bool Type::operator==(const Type &other) const
-{
-  return this == &other;
-}
+Type::Type(Kind kind, uint32_t id) : kind(kind), id(id) {}
 
-bool Type::operator!=(const Type &other) const
-{
-  return !this->operator==(other);
-}
+Named::Named(uint32_t id, sym::Symbol name) : Type(Kind::Named, id), name(name) {}
 
-bool Type::match(const Type &other) const
-{
-  return *this == other;
-}
+Array::Array(uint32_t id, sym::Symbol name) : Type(Kind::Array, id), name(name) {}
 
-bool Undefined::operator==(const Type &other) const
-{
-  return false;
-}
+Record::Record(uint32_t id, sym::Symbol name) : Type(Kind::Record, id), name(name) {}
 
-bool Int::operator==(const Type &other) const
+void Record::addField(sym::Symbol name, Type *type)
 {
-  return dynamic_cast<const Int *>(&other) != nullptr;
+  indices.emplace(name, fields.size());
+  fields.emplace_back(name, type);
 }
 
-bool String::operator==(const Type &other) const
+int Record::fieldIndex(sym::Symbol name) const
 {
-  return dynamic_cast<const String *>(&other) != nullptr;
+  auto found = indices.find(name);
+  return found == indices.end() ? -1 : found->second;
 }
 
-bool Nil::operator==(const Type &other) const
+Context::Context()
 {
-  return dynamic_cast<const Nil *>(&other) != nullptr;
+  void_ = make<Type>(Kind::Void, 0);
+  nil = make<Type>(Kind::Nil, 1);
+  int_ = make<Type>(Kind::Int, 2);
+  string = make<Type>(Kind::String, 3);
 }
 
-bool Void::operator==(const Type &other) const
+template <typename T, typename... Args>
+T *Context::make(Args &&...args)
 {
-  return dynamic_cast<const Void *>(&other) != nullptr;
+  auto type = new T(std::forward<Args>(args)...);
+  types.emplace_back(type);
+  return type;
 }
 
-static inline const Array *isArray(const Type *ptr)
+Named *Context::named(sym::Symbol name)
 {
-  return dynamic_cast<const Array *>(ptr);
+  return make<Named>(types.size(), name);
 }
 
-static inline const Record *isRecord(const Type *ptr)
+Array *Context::array(sym::Symbol name)
 {
-  return dynamic_cast<const Record *>(ptr);
+  return make<Array>(types.size(), name);
 }
 
-static inline const Named *isNamed(const Type *ptr)
+Record *Context::record(sym::Symbol name)
 {
-  return dynamic_cast<const Named *>(ptr);
+  return make<Record>(types.size(), name);
 }
 
-static bool deepCompare(const Type *lhs, const Type *rhs)
+Named *Context::resolve(const std::vector<Named *> &aliases)
 {
-  vector<pair<const Type *, const Type *>> stack{{lhs, rhs}};
-  map<const Type *, const Type *> visited;
-
-  auto isVisited = [&visited](const Type *lhs, const Type *rhs) -> bool
-  { return visited[lhs] == rhs || visited[rhs] == lhs; };
-
-  auto visit = [&visited](const Type *lhs, const Type *rhs)
-  { visited[lhs] = rhs; };
-
-  while (!stack.empty())
+  for (auto alias : aliases)
   {
-    auto lhs = stack.back().first;
-    auto rhs = stack.back().second;
-    stack.pop_back();
-
-    if (lhs == nullptr && rhs == nullptr)
-    {
-      continue;
-    }
-    else if (lhs == nullptr || rhs == nullptr)
-    {
-      return false;
-    }
-    if (isArray(lhs) && isArray(rhs))
-    {
-      if (isVisited(lhs, rhs) || lhs == rhs)
-      {
-        continue;
-      }
-      else
-      {
-        visit(lhs, rhs);
-        auto lhs_arr = isArray(lhs);
-        auto rhs_arr = isArray(rhs);
-        stack.push_back({lhs_arr->type, rhs_arr->type});
-      }
-    }
-    else if (isNamed(lhs) && isNamed(rhs))
+    set<const Named *> seen;
+    Type *target = alias;
+    while (target->is(Kind::Named))
     {
-
-      if (isVisited(lhs, rhs) || lhs == rhs)
-      {
-        continue;
-      }
-      else
-      {
-        auto l_named = isNamed(lhs);
-        auto r_named = isNamed(rhs);
-
-        if (l_named->name != r_named->name)
-        {
-          return false;
-        }
-        else
-        {
-          visit(lhs, rhs);
-          stack.push_back({l_named->type, r_named->type});
-        }
-      }
-    }
-    else if (isRecord(lhs) && isRecord(rhs))
-    {
-      if (isVisited(lhs, rhs) || lhs == rhs)
-      {
-        continue;
-      }
-      else
-      {
-        visit(lhs, rhs);
-        auto lhs_rec = isRecord(lhs);
-        auto rhs_rec = isRecord(rhs);
-
-        if (lhs_rec->records.size() != rhs_rec->records.size())
-        {
-          return false;
-        }
-        else
-        {
-          for (auto pair : lhs_rec->records)
-          {
-            auto found = rhs_rec->records.find(pair.first);
-
-            if (found == rhs_rec->records.end())
-            {
-              return false;
-            }
-            else
-            {
-              visit(pair.second, found->second);
-            }
-          }
-        }
-      }
-    }
-    else
-    {
-      if (*lhs != *rhs)
-        return false;
+      auto named = static_cast<Named *>(target);
+      if (!seen.insert(named).second)
+        return alias;
+      target = named->type;
     }
+    alias->type = target;
   }
-
-  return true;
+  return nullptr;
 }
 
-Named::Named(std::string name, Type *type) : name(name), type(type) {}
-
-bool Named::operator==(const Type &other) const
+size_t Context::size() const
 {
-  auto other_named = dynamic_cast<const Named *>(&other);
-  if (other_named == nullptr)
-    return false;
-
-  return deepCompare(this, other_named);
-}
-
-Array::Array(Type *type) : type(type) {}
-
-bool Array::operator==(const Type &other) const
-{
-  auto other_array = dynamic_cast<const Array *>(&other);
-  if (other_array == nullptr)
-    return false;
-
-  return deepCompare(this, other_array);
-}
-
-Record::Record(std::string name, std::map<std::string, Type *> records) : name(name), records(records) {}
-
-bool Record::operator==(const Type &other) const
-{
-  auto other_record = dynamic_cast<const Record *>(&other);
-  if (other_record == nullptr)
-    return false;
-
-  return deepCompare(this, other_record);
+  return types.size();
 }
@@ -0,0 +1,448 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "vm.h"
+#include "runtime.h"
+
+using namespace bc;
+using namespace std;
+
+namespace
+{
+  const tiger_string *str(int64_t value)
+  {
+    return reinterpret_cast<const tiger_string *>(value);
+  }
+
+  int64_t val(const void *pointer)
+  {
+    return reinterpret_cast<int64_t>(pointer);
+  }
+
+  int64_t *cells(int64_t value)
+  {
+    return reinterpret_cast<int64_t *>(value);
+  }
+
+  [[noreturn]] void runtimeError(const char *message)
+  {
+    fflush(stdout);
+    cerr << "runtime error: " << message << endl;
+    exit(1);
+  }
+
+  int64_t callBuiltin(uint32_t builtin, const int64_t *args)
+  {
+    switch (builtin)
+    {
+    case PRINT:
+      tiger_print(str(args[0]));
+      return 0;
+    case FLUSH:
+      tiger_flush();
+      return 0;
+    case GETCHAR:
+      return val(tiger_getchar());
+    case ORD:
+      return tiger_ord(str(args[0]));
+    case CHR:
+      return val(tiger_chr(args[0]));
+    case SIZE:
+      return tiger_size(str(args[0]));
+    case SUBSTRING:
+      return val(tiger_substring(str(args[0]), args[1], args[2]));
+    case CONCAT:
+      return val(tiger_concat(str(args[0]), str(args[1])));
+    case NOT:
+      return tiger_not(args[0]);
+    case EXIT:
+      tiger_exit(args[0]);
+      return 0;
+    case STRING_COMPARE:
+      return tiger_string_compare(str(args[0]), str(args[1]));
+    }
+    return 0;
+  }
+}
+
+Image::Image(const std::string &filename)
+{
+  int fd = open(filename.c_str(), O_RDONLY);
+  struct stat info;
+  if (fd < 0 || fstat(fd, &info) != 0)
+  {
+    cerr << "could not open file " << filename << endl;
+    exit(1);
+  }
+
+  size = info.st_size;
+  if (size > 0)
+  {
+    auto mapped = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (mapped == MAP_FAILED)
+    {
+      cerr << "could not map file " << filename << endl;
+      exit(1);
+    }
+    data = static_cast<const char *>(mapped);
+  }
+  close(fd);
+  verify(filename);
+}
+
+Image::~Image()
+{
+  if (data)
+    munmap(const_cast<char *>(data), size);
+}
+
+const Header &Image::header() const
+{
+  return *reinterpret_cast<const Header *>(data);
+}
+
+const FunctionInfo *Image::functions() const
+{
+  return reinterpret_cast<const FunctionInfo *>(data + header().functionOffset);
+}
+
+const uint32_t *Image::code() const
+{
+  return reinterpret_cast<const uint32_t *>(data + header().codeOffset);
+}
+
+const tiger_string *Image::strings() const
+{
+  return literals.data();
+}
+
+// Checks every section and operand once, so the interpreter loop does not have to, and
+// finds the strings of the pool.
+void Image::verify(const std::string &filename)
+{
+  auto fail = [&](const string &reason)
+  {
+    cerr << "invalid bytecode file " << filename << ": " << reason << endl;
+    exit(1);
+  };
+  auto within = [&](uint64_t offset, uint64_t count, uint64_t width, uint64_t alignment)
+  { return offset % alignment == 0 && offset <= size && count <= (size - offset) / width; };
+
+  if (size < sizeof(Header))
+    fail("truncated header");
+  auto &h = header();
+  if (h.magic != magic)
+    fail("not a tiger bytecode file");
+  if (h.version != version)
+    fail("unsupported version " + to_string(h.version));
+  if (!within(h.functionOffset, h.functionCount, sizeof(FunctionInfo), alignof(FunctionInfo)) ||
+      !within(h.codeOffset, h.codeWords, sizeof(uint32_t), alignof(uint32_t)) ||
+      !within(h.stringOffset, h.stringBytes, 1, alignof(uint64_t)))
+    fail("section out of bounds");
+  for (uint64_t offset = 0; offset < h.stringBytes;)
+  {
+    uint64_t length;
+    if (h.stringBytes - offset < sizeof(length))
+      fail("truncated string pool");
+    memcpy(&length, data + h.stringOffset + offset, sizeof(length));
+    offset += sizeof(length);
+    if (length > h.stringBytes - offset)
+      fail("truncated string pool");
+    literals.push_back({static_cast<int64_t>(length), data + h.stringOffset + offset});
+    offset += (length + 7) & ~uint64_t(7);
+  }
+  if (literals.size() != h.stringCount)
+    fail("bad string count");
+  if (h.mainFunction >= h.functionCount || functions()[h.mainFunction].frameSize == 0)
+    fail("missing main function");
+
+  // registers of each instruction are bounded by the frame of the function it belongs to.
+  auto code = this->code();
+  vector<uint32_t> frameSizes(h.codeWords, 0);
+  vector<const FunctionInfo *> bodies;
+  for (uint32_t i = 0; i < h.functionCount; i++)
+    if (functions()[i].frameSize > 0)
+    {
+      if (functions()[i].entry >= h.codeWords)
+        fail("function entry out of bounds");
+      bodies.push_back(&functions()[i]);
+    }
+  sort(bodies.begin(), bodies.end(), [](auto a, auto b)
+       { return a->entry < b->entry; });
+  for (size_t i = 0; i < bodies.size(); i++)
+  {
+    auto end = i + 1 < bodies.size() ? bodies[i + 1]->entry : h.codeWords;
+    fill(frameSizes.begin() + bodies[i]->entry, frameSizes.begin() + end, bodies[i]->frameSize);
+  }
+
+  vector<bool> boundaries(h.codeWords, false);
+  vector<uint32_t> jumps;
+  uint64_t pc = 0;
+  Opcode last = HALT;
+  while (pc < h.codeWords)
+  {
+    if (code[pc] >= OPCODE_COUNT)
+      fail("bad opcode at " + to_string(pc));
+    last = static_cast<Opcode>(code[pc]);
+    auto kinds = operandKinds[last];
+    auto count = strlen(kinds);
+    if (pc + count >= h.codeWords)
+      fail("truncated instruction at " + to_string(pc));
+
+    boundaries[pc] = true;
+    for (size_t i = 0; i < count; i++)
+    {
+      auto operand = code[pc + 1 + i];
+      bool valid = true;
+      switch (kinds[i])
+      {
+      case 'r':
+        valid = operand < frameSizes[pc];
+        break;
+      case 's':
+        valid = operand < h.stringCount;
+        break;
+      case 'j':
+        jumps.push_back(operand);
+        break;
+      case 'f':
+        valid = operand < h.functionCount && functions()[operand].frameSize > 0;
+        break;
+      case 'b':
+        valid = operand < BUILTIN_COUNT;
+        break;
+      }
+      if (!valid)
+        fail("bad operand of " + string(opcodeNames[last]) + " at " + to_string(pc));
+    }
+    pc += count + 1;
+  }
+
+  if (last != HALT && last != RET && last != RETV && last != JMP)
+    fail("code falls off the end");
+  for (auto jump : jumps)
+    if (jump >= h.codeWords || !boundaries[jump])
+      fail("bad jump target " + to_string(jump));
+  for (auto body : bodies)
+    if (!boundaries[body->entry])
+      fail("bad function entry " + to_string(body->entry));
+}
+
+// Registers hold integers, strings and pointers to records and arrays alike. The frame of a
+// callee starts at the base register of the call, right on top of the registers the caller
+// is still using, so a call copies nothing.
+int bc::execute(const Image &image)
+{
+  struct Return
+  {
+    const uint32_t *ip;
+    int64_t *fp;
+    uint32_t dst;
+  };
+
+  const size_t stackSize = 1 << 20;
+  unique_ptr<int64_t[]> stack(new int64_t[stackSize]);
+  int64_t *const stackEnd = stack.get() + stackSize;
+  vector<Return> returns;
+  returns.reserve(256);
+
+  auto functions = image.functions();
+  auto code = image.code();
+  auto strings = image.strings();
+  auto &main = functions[image.header().mainFunction];
+  int64_t *fp = stack.get();
+  const uint32_t *ip = code + main.entry;
+  if (fp + main.frameSize > stackEnd)
+    runtimeError("stack overflow");
+
+#define R(n) fp[ip[n]]
+#define IMM(n) static_cast<int64_t>(static_cast<int32_t>(ip[n]))
+#define WRAP(a, op, b) static_cast<int64_t>(static_cast<uint64_t>(a) op static_cast<uint64_t>(b))
+
+  // computed goto jumps straight from one handler to the next, the switch is a fallback
+  // for compilers without labels as values.
+#if defined(__GNUC__)
+  static const void *const labels[OPCODE_COUNT] = {
+#define TIGER_OPCODE_LABEL(name, kinds) &&op_##name,
+      TIGER_OPCODES(TIGER_OPCODE_LABEL)
+#undef TIGER_OPCODE_LABEL
+  };
+#define DISPATCH() goto *labels[*ip]
+#define CASE(name) op_##name:
+  DISPATCH();
+#else
+#define DISPATCH() continue
+#define CASE(name) case name:
+  for (;;)
+    switch (*ip)
+    {
+#endif
+#define NEXT(count)    \
+  {                    \
+    ip += (count) + 1; \
+    DISPATCH();        \
+  }
+#define JUMP_UNLESS(condition, count)                     \
+  {                                                       \
+    ip = (condition) ? ip + (count) + 1 : code + ip[count]; \
+    DISPATCH();                                           \
+  }
+
+  CASE(HALT)
+  return 0;
+  CASE(MOVE)
+  R(1) = R(2);
+  NEXT(2);
+  CASE(LOADI)
+  R(1) = IMM(2);
+  NEXT(2);
+  CASE(LOADS)
+  R(1) = val(&strings[ip[2]]);
+  NEXT(2);
+  CASE(ADD)
+  R(1) = WRAP(R(2), +, R(3));
+  NEXT(3);
+  CASE(SUB)
+  R(1) = WRAP(R(2), -, R(3));
+  NEXT(3);
+  CASE(MUL)
+  R(1) = WRAP(R(2), *, R(3));
+  NEXT(3);
+  CASE(DIV)
+  R(1) = R(2) / R(3);
+  NEXT(3);
+  CASE(ADDI)
+  R(1) = WRAP(R(2), +, IMM(3));
+  NEXT(3);
+  CASE(EQ)
+  R(1) = R(2) == R(3);
+  NEXT(3);
+  CASE(NE)
+  R(1) = R(2) != R(3);
+  NEXT(3);
+  CASE(LT)
+  R(1) = R(2) < R(3);
+  NEXT(3);
+  CASE(LE)
+  R(1) = R(2) <= R(3);
+  NEXT(3);
+  CASE(GT)
+  R(1) = R(2) > R(3);
+  NEXT(3);
+  CASE(GE)
+  R(1) = R(2) >= R(3);
+  NEXT(3);
+  CASE(SCMP)
+  R(1) = tiger_string_compare(str(R(2)), str(R(3)));
+  NEXT(3);
+  CASE(JMP)
+  ip = code + ip[1];
+  DISPATCH();
+  CASE(JZ)
+  JUMP_UNLESS(R(1), 2);
+  CASE(JNZ)
+  JUMP_UNLESS(!R(1), 2);
+  CASE(JFEQ)
+  JUMP_UNLESS(R(1) == R(2), 3);
+  CASE(JFNE)
+  JUMP_UNLESS(R(1) != R(2), 3);
+  CASE(JFLT)
+  JUMP_UNLESS(R(1) < R(2), 3);
+  CASE(JFLE)
+  JUMP_UNLESS(R(1) <= R(2), 3);
+  CASE(JFGT)
+  JUMP_UNLESS(R(1) > R(2), 3);
+  CASE(JFGE)
+  JUMP_UNLESS(R(1) >= R(2), 3);
+  CASE(JFEQX)
+  JUMP_UNLESS(cells(R(1))[R(2)] == R(3), 4);
+  CASE(JFNEX)
+  JUMP_UNLESS(cells(R(1))[R(2)] != R(3), 4);
+  CASE(FORLOOP)
+  ip = ++R(1) <= R(2) ? code + ip[3] : ip + 4;
+  DISPATCH();
+  CASE(LOADX)
+  R(1) = cells(R(2))[R(3)];
+  NEXT(3);
+  CASE(STOREX)
+  cells(R(1))[R(2)] = R(3);
+  NEXT(3);
+  CASE(LOADF)
+  R(1) = cells(R(2))[ip[3]];
+  NEXT(3);
+  CASE(STOREF)
+  cells(R(1))[ip[2]] = R(3);
+  NEXT(3);
+  CASE(ADDR)
+  R(1) = val(&R(2));
+  NEXT(2);
+  CASE(LOADP)
+  R(1) = *cells(R(2));
+  NEXT(2);
+  CASE(STOREP)
+  *cells(R(1)) = R(2);
+  NEXT(2);
+  CASE(NEWREC)
+  R(1) = val(malloc(sizeof(int64_t) * max<uint32_t>(ip[2], 1)));
+  NEXT(2);
+  CASE(NEWARR)
+  {
+    auto capacity = R(2);
+    auto element = R(3);
+    auto elements = malloc(sizeof(int64_t) * capacity);
+    tiger_array_initialize(elements, &element, capacity, sizeof(int64_t));
+    R(1) = val(elements);
+  }
+  NEXT(3);
+  CASE(CALL)
+  {
+    auto &callee = functions[ip[1]];
+    auto base = fp + ip[2];
+    if (base + callee.frameSize > stackEnd)
+      runtimeError("stack overflow");
+    returns.push_back({ip + 4, fp, ip[3]});
+    fp = base;
+    ip = code + callee.entry;
+  }
+  DISPATCH();
+  CASE(CALLB)
+  R(3) = callBuiltin(ip[1], fp + ip[2]);
+  NEXT(3);
+  CASE(RET)
+  {
+    auto value = R(1);
+    auto ret = returns.back();
+    returns.pop_back();
+    fp = ret.fp;
+    fp[ret.dst] = value;
+    ip = ret.ip;
+  }
+  DISPATCH();
+  CASE(RETV)
+  {
+    auto ret = returns.back();
+    returns.pop_back();
+    fp = ret.fp;
+    ip = ret.ip;
+  }
+  DISPATCH();
+
+#if !defined(__GNUC__)
+    }
+#endif
+#undef JUMP_UNLESS
+#undef NEXT
+#undef CASE
+#undef DISPATCH
+#undef WRAP
+#undef IMM
+#undef R
+}
@@ -0,0 +1,17 @@
+#include <iostream>
+#include <string>
+#include "vm.h"
+
+using namespace std;
+
+int main(int argc, char *argv[])
+{
+  if (argc != 2)
+  {
+    cerr << "usage: tigervm program.tbc" << endl;
+    return 1;
+  }
+
+  bc::Image image(argv[1]);
+  return bc::execute(image);
+}